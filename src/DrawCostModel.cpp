@@ -3,6 +3,9 @@
 
 #include "DrawCostModel.h"
 
+#include "Geometry.h"
+#include "QtLogger.h"
+
 // Figure out quality we should use to render points with the current camera
 // transformation
 double DrawCostModel::quality(double targetMillisecs,
@@ -21,11 +24,11 @@ double DrawCostModel::quality(double targetMillisecs,
                                qualities, drawCounts, numQualitySamps);
     }
     // Estimate frame time at each quality
+    const FrameCostFit& fit = m_fits[m_shaderKey];
     double frameTimeEst[numQualitySamps] = {0};
     for (int i = 0; i < numQualitySamps; ++i)
     {
-        V3d v(1, drawCounts[i].numVertices, 0);
-        frameTimeEst[i] = m_modelCoeffs.dot(v);
+        frameTimeEst[i] = fit.predict(drawCounts[i]);
     }
 
     // Interpolate desired quality using guess at the frame time
@@ -63,28 +66,30 @@ double DrawCostModel::quality(double targetMillisecs,
 }
 
 
-V3d DrawCostModel::fitCostModel(const DrawRecords& drawRecords)
+void DrawCostModel::addSample(const DrawCount& drawCount, double frameTime,
+                              unsigned int shaderKey)
 {
-    // Initialize sums to nonzero for a weak conservative regularization:
-    // assert that we can draw nvsum vertices in tsum millisecs.
-    double nvsum = 1000000;
-    double tsum = 50;
-
-    double regWeight = 1e-3;
-    nvsum *= regWeight;
-    tsum *= regWeight;
-
-    int numDrawRecs = (int)drawRecords.size();
-    for (int i = 0; i < numDrawRecs; ++i)
+    m_fits[shaderKey].addSample(drawCount, frameTime);
+    if (m_traceFile)
     {
-        // Weight in favour of recent measurements.
-        double w = exp(-0.2*(numDrawRecs - 1 - i));
-        auto& rec = drawRecords[i];
-        nvsum += w*rec.first.numVertices;
-        tsum += w*rec.second;
+        *m_traceFile << shaderKey << " " << drawCount.numVertices << " "
+                     << drawCount.numDrawCalls << " " << drawCount.uploadBytes << " "
+                     << frameTime << "\n";
     }
-
-    return V3d(0, tsum/nvsum, 0);
 }
 
 
+void DrawCostModel::setTraceFile(const std::string& fileName)
+{
+    m_traceFile.reset();
+    if (fileName.empty())
+        return;
+    m_traceFile.reset(new std::ofstream(fileName.c_str(), std::ios::app));
+    if (!*m_traceFile)
+    {
+        g_logger.error("Could not open draw cost trace file \"%s\"", fileName);
+        m_traceFile.reset();
+        return;
+    }
+    *m_traceFile << "# shader numVertices numDrawCalls uploadBytes frameTime\n";
+}
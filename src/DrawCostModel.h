@@ -4,12 +4,18 @@
 #ifndef DRAW_COST_MODEL_H_INCLUDED
 #define DRAW_COST_MODEL_H_INCLUDED
 
-#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
-#include "Geometry.h"
+#include "FrameCostFit.h"
 #include "util.h"
 
+class Geometry;
+struct TransformState;
+
 /// Frame time cost model for drawn geometry
 ///
 /// We want to draw as much geometry per frame as possible, without the time
@@ -20,49 +26,54 @@
 ///
 /// We model the cost of drawing geometry as the function
 ///
-///   t(T,q) = a*Nv(T,q)
+///   t(T,q) = c0 + c1*Nv(T,q) + c2*Nd(T,q) + c3*Nb(T,q)
 ///
 /// where
 ///   * t is the frame time
 ///   * T is the camera transformation
 ///   * q is the quality
 ///   * Nv is the number of vertices shaded
+///   * Nd is the number of draw calls
+///   * Nb is the number of bytes uploaded to the GPU
 ///
-/// and a is an unknown fitting parameter which depends on the shader, speed of
-/// the GPU etc.
+/// and the c's are unknown fitting parameters which depend on the shader,
+/// speed of the GPU etc.  See FrameCostFit.  Since the per-vertex cost
+/// depends strongly on the shader, a separate fit is kept for each shader.
 class DrawCostModel
 {
     public:
         DrawCostModel()
             : m_quality(1),
             m_incQuality(1),
-            m_maxDrawRecords(20),
-            m_drawRecords(),
-            m_modelCoeffs(fitCostModel(m_drawRecords))
+            m_shaderKey(0)
         { }
 
+        /// Use the fit for shader `key` (eg, a hash of the shader source)
+        /// for following calls
+        void setShaderKey(unsigned int key) { m_shaderKey = key; }
+
         double quality(double targetMillisecs,
                        const std::vector<const Geometry*>& geoms,
                        const TransformState& transState, bool firstIncrementalFrame);
 
-        void addSample(const DrawCount& drawCount, double frameTime)
-        {
-            m_drawRecords.push_back(std::make_pair(drawCount, double(frameTime)));
-            if ((int)m_drawRecords.size() > m_maxDrawRecords)
-                m_drawRecords.pop_front();
-            m_modelCoeffs = fitCostModel(m_drawRecords);
-        }
+        unsigned int shaderKey() const { return m_shaderKey; }
 
-    private:
-        typedef std::deque<std::pair<DrawCount,double>> DrawRecords;
+        /// Update the fit for shader `shaderKey` with a measured frame time
+        /// in milliseconds.  Measurements may arrive a few frames late, so
+        /// the key isn't necessarily the current one.
+        void addSample(const DrawCount& drawCount, double frameTime,
+                       unsigned int shaderKey);
 
-        static V3d fitCostModel(const DrawRecords& drawRecords);
+        /// Record samples to a trace file for offline analysis with
+        /// drawcost_replay.  An empty name stops recording.
+        void setTraceFile(const std::string& fileName);
 
+    private:
         double m_quality;
         double m_incQuality;
-        int m_maxDrawRecords;
-        DrawRecords m_drawRecords;
-        V3d m_modelCoeffs;
+        unsigned int m_shaderKey;
+        std::map<unsigned int, FrameCostFit> m_fits;
+        std::unique_ptr<std::ofstream> m_traceFile;
 };
 
 
@@ -0,0 +1,129 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include "FrameCostFit.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Features are scaled to similar magnitudes for typical frames so that the
+// regularization treats all terms alike.
+static const double featureScales[FrameCostFit::numTerms] = {1, 1e-6, 1e-3, 1e-6};
+
+// Prior coefficients for scaled features, and strength of regularization
+static const double priorCoeffs[FrameCostFit::numTerms] = {0, 50, 0, 0};
+static const double regWeight = 1e-3;
+
+
+FrameCostFit::FrameCostFit(double forgetting)
+    : m_forgetting(forgetting),
+    m_numSamples(0)
+{
+    for (int i = 0; i < numTerms; ++i)
+    {
+        m_b[i] = 0;
+        for (int j = 0; j < numTerms; ++j)
+            m_A[i][j] = 0;
+    }
+    solve();
+}
+
+
+void FrameCostFit::features(const DrawCount& drawCount, double x[numTerms])
+{
+    x[0] = featureScales[0];
+    x[1] = featureScales[1]*drawCount.numVertices;
+    x[2] = featureScales[2]*drawCount.numDrawCalls;
+    x[3] = featureScales[3]*drawCount.uploadBytes;
+}
+
+
+double FrameCostFit::predict(const DrawCount& drawCount) const
+{
+    double x[numTerms];
+    features(drawCount, x);
+    double t = 0;
+    for (int i = 0; i < numTerms; ++i)
+        t += m_scaledCoeffs[i]*x[i];
+    return t;
+}
+
+
+void FrameCostFit::addSample(const DrawCount& drawCount, double frameTime)
+{
+    double x[numTerms];
+    features(drawCount, x);
+    for (int i = 0; i < numTerms; ++i)
+    {
+        m_b[i] = m_forgetting*m_b[i] + x[i]*frameTime;
+        for (int j = 0; j < numTerms; ++j)
+            m_A[i][j] = m_forgetting*m_A[i][j] + x[i]*x[j];
+    }
+    ++m_numSamples;
+    solve();
+}
+
+
+/// Solve the regularized normal equations for the coefficients, dropping
+/// terms from the fit until all coefficients are nonnegative.
+void FrameCostFit::solve()
+{
+    bool active[numTerms];
+    for (int i = 0; i < numTerms; ++i)
+        active[i] = true;
+    for (int iter = 0; iter < numTerms; ++iter)
+    {
+        // Cholesky factorization L*L^T of the active part of
+        // (A + regWeight*I), which is positive definite.
+        int inds[numTerms];
+        int n = 0;
+        for (int i = 0; i < numTerms; ++i)
+            if (active[i])
+                inds[n++] = i;
+        double L[numTerms][numTerms] = {};
+        double c[numTerms] = {};
+        for (int i = 0; i < n; ++i)
+        {
+            for (int j = 0; j <= i; ++j)
+            {
+                double s = m_A[inds[i]][inds[j]] + (i == j ? regWeight : 0);
+                for (int k = 0; k < j; ++k)
+                    s -= L[i][k]*L[j][k];
+                L[i][j] = (i == j) ? std::sqrt(s) : s/L[j][j];
+            }
+        }
+        // Forward and back substitution
+        for (int i = 0; i < n; ++i)
+        {
+            double s = m_b[inds[i]] + regWeight*priorCoeffs[inds[i]];
+            for (int k = 0; k < i; ++k)
+                s -= L[i][k]*c[k];
+            c[i] = s/L[i][i];
+        }
+        for (int i = n-1; i >= 0; --i)
+        {
+            double s = c[i];
+            for (int k = i+1; k < n; ++k)
+                s -= L[k][i]*c[k];
+            c[i] = s/L[i][i];
+        }
+        for (int i = 0; i < numTerms; ++i)
+            m_scaledCoeffs[i] = 0;
+        int mostNegative = -1;
+        for (int i = 0; i < n; ++i)
+        {
+            m_scaledCoeffs[inds[i]] = c[i];
+            if (c[i] < 0 && (mostNegative < 0 || c[i] < m_scaledCoeffs[mostNegative]))
+                mostNegative = inds[i];
+        }
+        if (mostNegative < 0)
+            break;
+        m_scaledCoeffs[mostNegative] = 0;
+        active[mostNegative] = false;
+    }
+    for (int i = 0; i < numTerms; ++i)
+    {
+        m_scaledCoeffs[i] = std::max(0.0, m_scaledCoeffs[i]);
+        m_coeffs[i] = m_scaledCoeffs[i]*featureScales[i];
+    }
+}
@@ -0,0 +1,59 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#ifndef DISPLAZ_FRAMECOSTFIT_H_INCLUDED
+#define DISPLAZ_FRAMECOSTFIT_H_INCLUDED
+
+#include "DrawCount.h"
+
+/// Online fit of frame time as a linear function of the amount drawn
+///
+/// Frame time in milliseconds is modelled as
+///
+///   t = c0 + c1*Nv + c2*Nd + c3*Nb
+///
+/// where Nv, Nd and Nb are the numVertices, numDrawCalls and uploadBytes of
+/// a DrawCount, c0 is the fixed per-frame overhead, and the coefficients are
+/// fit by exponentially weighted recursive least squares so that the model
+/// tracks changes in the scene and GPU load.  Coefficients are constrained
+/// to be nonnegative so that drawing more never appears to be faster.
+///
+/// The fit is weakly regularized toward a prior of drawing 1e6 vertices in
+/// 50 ms, which is the model used before any samples have been added, and
+/// which keeps the fit well defined when only some terms vary.
+class FrameCostFit
+{
+    public:
+        static const int numTerms = 4;
+
+        /// Create fit where the weight of each sample decays by a factor of
+        /// `forgetting` for each newer sample
+        FrameCostFit(double forgetting = 0.9);
+
+        /// Return predicted frame time in milliseconds
+        double predict(const DrawCount& drawCount) const;
+
+        /// Update fit with measured frame time in milliseconds
+        void addSample(const DrawCount& drawCount, double frameTime);
+
+        /// Fitted coefficients [c0, c1, c2, c3] of the model above
+        const double* coeffs() const { return m_coeffs; }
+
+        int numSamples() const { return m_numSamples; }
+
+    private:
+        static void features(const DrawCount& drawCount, double x[numTerms]);
+        void solve();
+
+        double m_forgetting;
+        int m_numSamples;
+        /// Weighted normal equations m_A*c == m_b in scaled features
+        double m_A[numTerms][numTerms];
+        double m_b[numTerms];
+        /// Coefficients for scaled features, and in natural units
+        double m_scaledCoeffs[numTerms];
+        double m_coeffs[numTerms];
+};
+
+
+#endif // DISPLAZ_FRAMECOSTFIT_H_INCLUDED
@@ -0,0 +1,65 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include <catch.hpp>
+
+#include <cmath>
+#include <random>
+
+#include "FrameCostFit.h"
+
+
+static DrawCount makeDrawCount(double numVertices, double numDrawCalls, double uploadBytes)
+{
+    DrawCount drawCount;
+    drawCount.numVertices = numVertices;
+    drawCount.numDrawCalls = numDrawCalls;
+    drawCount.uploadBytes = uploadBytes;
+    return drawCount;
+}
+
+
+TEST_CASE("FrameCostFit prior")
+{
+    FrameCostFit fit;
+    CHECK(fit.numSamples() == 0);
+    CHECK(std::abs(fit.predict(makeDrawCount(1e6, 0, 0)) - 50) < 1e-6);
+    CHECK(fit.predict(makeDrawCount(0, 0, 0)) == 0);
+}
+
+
+TEST_CASE("FrameCostFit recovers linear model")
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> u(0, 1);
+    const double c[4] = {5, 2e-5, 0.01, 1e-6};
+    FrameCostFit fit;
+    for (int i = 0; i < 200; ++i)
+    {
+        DrawCount dc = makeDrawCount(1e6*u(rng), 1000*u(rng), 1e7*u(rng));
+        double t = c[0] + c[1]*dc.numVertices + c[2]*dc.numDrawCalls + c[3]*dc.uploadBytes;
+        fit.addSample(dc, t);
+    }
+    CHECK(fit.numSamples() == 200);
+    for (int i = 0; i < FrameCostFit::numTerms; ++i)
+        CHECK(std::abs(fit.coeffs()[i] - c[i]) < 0.01*c[i]);
+}
+
+
+TEST_CASE("FrameCostFit coefficients are nonnegative")
+{
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<double> u(0, 1);
+    FrameCostFit fit;
+    for (int i = 0; i < 100; ++i)
+    {
+        // Time decreasing with draw calls isn't physical
+        DrawCount dc = makeDrawCount(1e6*u(rng), 1000*u(rng), 0);
+        double t = 10 + 3e-5*dc.numVertices - 0.002*dc.numDrawCalls;
+        fit.addSample(dc, std::max(0.0, t));
+    }
+    for (int i = 0; i < FrameCostFit::numTerms; ++i)
+        CHECK(fit.coeffs()[i] >= 0);
+    CHECK(fit.coeffs()[1] > 0);
+    CHECK(fit.predict(makeDrawCount(2e6, 0, 0)) > fit.predict(makeDrawCount(1e6, 0, 0)));
+}
@@ -0,0 +1,153 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include <catch.hpp>
+
+#include <cstring>
+
+#include "LeafBufferCache.h"
+
+
+/// Storage in host memory, for checking buffer use without OpenGL
+class TestLeafStorage : public LeafBufferStorage
+{
+    public:
+        std::map<GLuint, std::vector<char>> buffers;
+        size_t liveBytes = 0;
+
+        GLuint create(size_t bytes) override
+        {
+            GLuint buffer = ++m_lastBuffer;
+            buffers[buffer].resize(bytes);
+            liveBytes += bytes;
+            m_bound = buffer;
+            return buffer;
+        }
+
+        void bind(GLuint buffer) override
+        {
+            REQUIRE(buffers.count(buffer));
+            m_bound = buffer;
+        }
+
+        void upload(size_t offset, size_t bytes, const void* data) override
+        {
+            std::vector<char>& buf = buffers.at(m_bound);
+            REQUIRE(offset + bytes <= buf.size());
+            std::memcpy(buf.data() + offset, data, bytes);
+        }
+
+        void destroy(GLuint buffer) override
+        {
+            liveBytes -= buffers.at(buffer).size();
+            buffers.erase(buffer);
+        }
+
+    private:
+        GLuint m_lastBuffer = 0;
+        GLuint m_bound = 0;
+};
+
+
+TEST_CASE("Leaf buffer cache uploads each point once")
+{
+    TestLeafStorage* storage = new TestLeafStorage();
+    LeafBufferCache cache{std::unique_ptr<LeafBufferStorage>(storage)};
+    const size_t stride = 16;
+    const size_t leafSize = 1000;
+    std::vector<char> points(2*leafSize*stride);
+    for (size_t i = 0; i < points.size(); ++i)
+        points[i] = char(i % 251);
+    int owner = 0;
+    int leaf0 = 0, leaf1 = 0;
+
+    cache.beginFrame();
+    LeafBufferCache::LeafRange range0 =
+        cache.makeResident(&owner, &leaf0, points.data(), stride, 0, leafSize, 100);
+    CHECK(cache.residentCount(&leaf0) == 100);
+    CHECK(cache.uploadedBytes() == 100*stride);
+    // A prefix already resident isn't uploaded again
+    cache.makeResident(&owner, &leaf0, points.data(), stride, 0, leafSize, 50);
+    CHECK(cache.uploadedBytes() == 100*stride);
+    cache.makeResident(&owner, &leaf0, points.data(), stride, 0, leafSize, 300);
+    CHECK(cache.uploadedBytes() == 300*stride);
+    LeafBufferCache::LeafRange range1 =
+        cache.makeResident(&owner, &leaf1, points.data(), stride, leafSize, leafSize, leafSize);
+    CHECK(cache.residentCount(&leaf1) == leafSize);
+    // Pools are sized by the geometry drawn so far, rather than taking the
+    // maximum pool size for a few small leaves
+    CHECK(cache.poolCount() == 2);
+    CHECK(cache.poolCount(&owner) == 2);
+    CHECK(cache.poolCount(&leaf0) == 0);
+    CHECK(cache.totalBytes() == 2*leafSize*stride);
+    CHECK(storage->liveBytes == cache.totalBytes());
+    const std::vector<char>& buf0 = storage->buffers.at(range0.buffer);
+    const std::vector<char>& buf1 = storage->buffers.at(range1.buffer);
+    CHECK(std::memcmp(buf0.data() + range0.first*stride, points.data(), 300*stride) == 0);
+    CHECK(std::memcmp(buf1.data() + range1.first*stride, points.data() + leafSize*stride,
+                      leafSize*stride) == 0);
+
+    cache.invalidate(&owner);
+    CHECK(cache.residentCount(&leaf0) == 0);
+    cache.release(&owner);
+    CHECK(cache.poolCount() == 0);
+    CHECK(cache.totalBytes() == 0);
+    CHECK(storage->liveBytes == 0);
+}
+
+
+TEST_CASE("Leaf buffer pools stay within budget")
+{
+    TestLeafStorage* storage = new TestLeafStorage();
+    LeafBufferCache cache{std::unique_ptr<LeafBufferStorage>(storage)};
+    const size_t budget = 1024*1024;
+    cache.setBudget(budget);
+    const size_t stride = 16;
+    const size_t numLeaves = 64;
+    const size_t leafSize = 5000;
+    std::vector<char> points(numLeaves*leafSize*stride);
+    int owners[2] = {};
+    std::vector<int> leaves(numLeaves);
+
+    // Draw a moving window of leaves at varying quality, for two geometries
+    // sharing the cache.  Each frame needs well under the budget.
+    for (size_t frame = 0; frame < 200; ++frame)
+    {
+        cache.beginFrame();
+        for (size_t i = 0; i < 4; ++i)
+        {
+            size_t leafIdx = (frame + 3*i) % numLeaves;
+            size_t count = 500 + (frame*37 + i*1013) % (leafSize - 500);
+            cache.makeResident(&owners[leafIdx % 2], &leaves[leafIdx], points.data(),
+                               stride, leafIdx*leafSize, leafSize, count);
+            CHECK(cache.totalBytes() <= budget);
+            CHECK(storage->liveBytes == cache.totalBytes());
+        }
+    }
+    CHECK(cache.poolCount() > 1);
+
+    // A working set which fits in the budget stays resident, so after the
+    // first frame nothing is uploaded again, even though little space is
+    // left over.  Leaves are used in turn, so each one is evictable until
+    // it's drawn in a frame.
+    const size_t workingSet = 12;
+    for (size_t frame = 0; frame < 10; ++frame)
+    {
+        cache.beginFrame();
+        uint64_t initialUploadedBytes = cache.uploadedBytes();
+        for (size_t i = 0; i < workingSet; ++i)
+        {
+            size_t leafIdx = 5*i + 1;
+            cache.makeResident(&owners[leafIdx % 2], &leaves[leafIdx], points.data(),
+                               stride, leafIdx*leafSize, leafSize, leafSize);
+            CHECK(cache.totalBytes() <= budget);
+        }
+        if (frame > 0)
+            CHECK(cache.uploadedBytes() == initialUploadedBytes);
+    }
+
+    cache.release(&owners[0]);
+    cache.release(&owners[1]);
+    CHECK(cache.poolCount() == 0);
+    CHECK(storage->liveBytes == 0);
+}
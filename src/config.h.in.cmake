@@ -1,3 +1,4 @@
 #define DISPLAZ_VERSION_STRING "@DISPLAZ_VERSION_STRING@"
 #define DISPLAZ_SHADER_DIR "@DISPLAZ_SHADER_DIR@"
 #define DISPLAZ_DOC_DIR "@DISPLAZ_DOC_DIR@"
+#cmakedefine DISPLAZ_HAVE_PREADV
@@ -0,0 +1,97 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+// Offline replay of frame time traces recorded with `displaz -costtrace`
+//
+// Feeds the recorded draw counts and frame times through FrameCostFit in
+// order, predicting each frame time before the fit sees it, to show how
+// quickly the model converges and how often frames miss their deadline.
+//
+// Usage: drawcost_replay trace_file [target_millisecs] [window]
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "FrameCostFit.h"
+#include "util.h"
+
+
+struct ReplayStats
+{
+    FrameCostFit fit;
+    size_t numFrames = 0;
+    size_t numMissed = 0;      ///< Frames exceeding the target time
+    size_t numUnexpected = 0;  ///< Missed frames predicted to be on time
+    double windowError = 0;    ///< Sum of relative errors in current window
+    size_t windowFrames = 0;
+};
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        tfm::printf("Usage: %s trace_file [target_millisecs] [window]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::ifstream in(argv[1]);
+    if (!in)
+    {
+        tfm::printf("Could not open trace file \"%s\"\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    double targetMillisecs = argc > 2 ? atof(argv[2]) : 40;
+    size_t window = argc > 3 ? (size_t)atoll(argv[3]) : 100;
+
+    std::map<unsigned int, ReplayStats> stats;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream lineIn(line);
+        unsigned int shaderKey = 0;
+        DrawCount drawCount;
+        double frameTime = 0;
+        if (!(lineIn >> shaderKey >> drawCount.numVertices >> drawCount.numDrawCalls
+                     >> drawCount.uploadBytes >> frameTime))
+        {
+            tfm::printf("Skipping bad trace line \"%s\"\n", line);
+            continue;
+        }
+        ReplayStats& s = stats[shaderKey];
+        double predicted = s.fit.predict(drawCount);
+        ++s.numFrames;
+        if (frameTime > targetMillisecs)
+        {
+            ++s.numMissed;
+            if (predicted <= targetMillisecs)
+                ++s.numUnexpected;
+        }
+        s.windowError += std::abs(predicted - frameTime) / std::max(frameTime, 1.0);
+        ++s.windowFrames;
+        if (s.windowFrames == window)
+        {
+            tfm::printf("shader %d frames %6d: mean relative error %.3f\n",
+                        shaderKey, s.numFrames, s.windowError/s.windowFrames);
+            s.windowError = 0;
+            s.windowFrames = 0;
+        }
+        s.fit.addSample(drawCount, frameTime);
+    }
+
+    for (const auto& keyStats : stats)
+    {
+        const ReplayStats& s = keyStats.second;
+        const double* c = s.fit.coeffs();
+        tfm::printf("\nshader %d: %d frames\n", keyStats.first, s.numFrames);
+        tfm::printf("  coefficients: %.3g ms + %.3g ms/vertex + %.3g ms/draw + %.3g ms/byte\n",
+                    c[0], c[1], c[2], c[3]);
+        tfm::printf("  frames over %g ms: %d (%.1f%%), of which predicted on time: %d\n",
+                    targetMillisecs, s.numMissed, 100.0*s.numMissed/s.numFrames,
+                    s.numUnexpected);
+    }
+    return 0;
+}
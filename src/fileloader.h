@@ -4,6 +4,7 @@
 #ifndef DISPLAZ_POINTINPUT_INCLUDED
 #define DISPLAZ_POINTINPUT_INCLUDED
 
+#include <atomic>
 #include <memory>
 
 #include <QFile>
@@ -12,6 +13,7 @@
 #include <QStringList>
 
 #include "Geometry.h"
+#include "PointArray.h"
 #include "QtLogger.h"
 
 
@@ -56,11 +58,35 @@ class FileLoader : public QObject
     public:
         FileLoader(size_t maxPointsPerFile, QObject* parent = 0)
             : QObject(parent),
-            m_maxPointsPerFile(maxPointsPerFile)
+            m_maxPointsPerFile(maxPointsPerFile),
+            m_useOctreeCache(false),
+            m_interleaveFields(false)
         {
             qRegisterMetaType<FileLoadInfo>("FileLoadInfo");
         }
 
+        /// Set maximum number of points to load from each file, for files
+        /// loaded after this call.  Threadsafe.
+        void setMaxPointsPerFile(size_t maxPointsPerFile)
+        {
+            m_maxPointsPerFile = maxPointsPerFile;
+        }
+
+        /// Enable on-disk octree caches for point files loaded after this
+        /// call (see PointArray::setUseOctreeCache).  Threadsafe.
+        void setUseOctreeCache(bool useCache)
+        {
+            m_useOctreeCache = useCache;
+        }
+
+        /// Pack point fields into interleaved arrays for drawing, for files
+        /// loaded after this call (see PointArray::setInterleaveFields).
+        /// Threadsafe.
+        void setInterleaveFields(bool interleave)
+        {
+            m_interleaveFields = interleave;
+        }
+
     public slots:
         /// Load file given by `loadInfo.filePath` asynchronously.  Threadsafe.
         ///
@@ -137,6 +163,11 @@ class FileLoader : public QObject
             // Standard loading code
             std::shared_ptr<Geometry> geom = Geometry::create(loadInfo.filePath);
             geom->setLabel(loadInfo.dataSetLabel);
+            if (PointArray* points = dynamic_cast<PointArray*>(geom.get()))
+            {
+                points->setUseOctreeCache(m_useOctreeCache);
+                points->setInterleaveFields(m_interleaveFields);
+            }
             connect(geom.get(), SIGNAL(loadProgress(int)),
                     this, SIGNAL(loadProgress(int)));
             connect(geom.get(), SIGNAL(loadStepStarted(QString)),
@@ -178,7 +209,9 @@ class FileLoader : public QObject
         }
 
     private:
-        size_t m_maxPointsPerFile;
+        std::atomic<size_t> m_maxPointsPerFile;
+        std::atomic<bool> m_useOctreeCache;
+        std::atomic<bool> m_interleaveFields;
 };
 
 
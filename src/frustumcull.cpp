@@ -0,0 +1,139 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include "frustumcull.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define DISPLAZ_CULL_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#   include <arm_neon.h>
+#   define DISPLAZ_CULL_NEON
+#endif
+
+
+/// Box corners nearest to (negative) and furthest along (positive) the
+/// normal of each plane, as pointers to the coordinate arrays to use.
+struct PlaneVertexArrays
+{
+    const float* pos[6][3];
+    const float* neg[6][3];
+
+    PlaneVertexArrays(const FrustumPlanes& planes, const BoxArrays& boxes)
+    {
+        for (int j = 0; j < 6; ++j)
+        {
+            bool px = planes.nx[j] >= 0, py = planes.ny[j] >= 0, pz = planes.nz[j] >= 0;
+            pos[j][0] = px ? boxes.maxX : boxes.minX;
+            pos[j][1] = py ? boxes.maxY : boxes.minY;
+            pos[j][2] = pz ? boxes.maxZ : boxes.minZ;
+            neg[j][0] = px ? boxes.minX : boxes.maxX;
+            neg[j][1] = py ? boxes.minY : boxes.maxY;
+            neg[j][2] = pz ? boxes.minZ : boxes.maxZ;
+        }
+    }
+};
+
+
+static inline float planeDist(const FrustumPlanes& planes, int j,
+                              float x, float y, float z)
+{
+    return planes.nx[j]*x + planes.ny[j]*y + planes.nz[j]*z + planes.d[j];
+}
+
+
+static inline uint8_t classifyOne(const FrustumPlanes& planes,
+                                  const PlaneVertexArrays& verts, size_t i)
+{
+    uint8_t result = Cull_Inside;
+    for (int j = 0; j < 6; ++j)
+    {
+        if (planeDist(planes, j, verts.pos[j][0][i], verts.pos[j][1][i],
+                      verts.pos[j][2][i]) < 0)
+            return Cull_Outside;
+        if (planeDist(planes, j, verts.neg[j][0][i], verts.neg[j][1][i],
+                      verts.neg[j][2][i]) < 0)
+            result = Cull_Intersect;
+    }
+    return result;
+}
+
+
+CullResult classifyBox(const FrustumPlanes& planes, const Imath::Box3f& box)
+{
+    BoxArrays boxes = {&box.min.x, &box.min.y, &box.min.z,
+                       &box.max.x, &box.max.y, &box.max.z};
+    return (CullResult)classifyOne(planes, PlaneVertexArrays(planes, boxes), 0);
+}
+
+
+void classifyBoxes(const FrustumPlanes& planes, const BoxArrays& boxes,
+                   size_t n, uint8_t* results)
+{
+    PlaneVertexArrays verts(planes, boxes);
+    size_t i = 0;
+#if defined(DISPLAZ_CULL_SSE2)
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 outside = zero;
+        __m128 intersect = zero;
+        for (int j = 0; j < 6; ++j)
+        {
+            __m128 nx = _mm_set1_ps(planes.nx[j]);
+            __m128 ny = _mm_set1_ps(planes.ny[j]);
+            __m128 nz = _mm_set1_ps(planes.nz[j]);
+            __m128 d  = _mm_set1_ps(planes.d[j]);
+            __m128 distPos = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(nx, _mm_loadu_ps(verts.pos[j][0] + i)),
+                _mm_mul_ps(ny, _mm_loadu_ps(verts.pos[j][1] + i))),
+                _mm_mul_ps(nz, _mm_loadu_ps(verts.pos[j][2] + i))), d);
+            __m128 distNeg = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(nx, _mm_loadu_ps(verts.neg[j][0] + i)),
+                _mm_mul_ps(ny, _mm_loadu_ps(verts.neg[j][1] + i))),
+                _mm_mul_ps(nz, _mm_loadu_ps(verts.neg[j][2] + i))), d);
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(distPos, zero));
+            intersect = _mm_or_ps(intersect, _mm_cmplt_ps(distNeg, zero));
+        }
+        int outsideMask = _mm_movemask_ps(outside);
+        int intersectMask = _mm_movemask_ps(intersect);
+        for (int k = 0; k < 4; ++k)
+        {
+            results[i+k] = ((outsideMask >> k) & 1)   ? Cull_Outside :
+                           ((intersectMask >> k) & 1) ? Cull_Intersect : Cull_Inside;
+        }
+    }
+#elif defined(DISPLAZ_CULL_NEON)
+    const float32x4_t zero = vdupq_n_f32(0);
+    for (; i + 4 <= n; i += 4)
+    {
+        uint32x4_t outside = vdupq_n_u32(0);
+        uint32x4_t intersect = vdupq_n_u32(0);
+        for (int j = 0; j < 6; ++j)
+        {
+            float32x4_t distPos = vaddq_f32(vaddq_f32(vaddq_f32(
+                vmulq_n_f32(vld1q_f32(verts.pos[j][0] + i), planes.nx[j]),
+                vmulq_n_f32(vld1q_f32(verts.pos[j][1] + i), planes.ny[j])),
+                vmulq_n_f32(vld1q_f32(verts.pos[j][2] + i), planes.nz[j])),
+                vdupq_n_f32(planes.d[j]));
+            float32x4_t distNeg = vaddq_f32(vaddq_f32(vaddq_f32(
+                vmulq_n_f32(vld1q_f32(verts.neg[j][0] + i), planes.nx[j]),
+                vmulq_n_f32(vld1q_f32(verts.neg[j][1] + i), planes.ny[j])),
+                vmulq_n_f32(vld1q_f32(verts.neg[j][2] + i), planes.nz[j])),
+                vdupq_n_f32(planes.d[j]));
+            outside = vorrq_u32(outside, vcltq_f32(distPos, zero));
+            intersect = vorrq_u32(intersect, vcltq_f32(distNeg, zero));
+        }
+        uint32_t outsideLanes[4], intersectLanes[4];
+        vst1q_u32(outsideLanes, outside);
+        vst1q_u32(intersectLanes, intersect);
+        for (int k = 0; k < 4; ++k)
+        {
+            results[i+k] = outsideLanes[k]   ? Cull_Outside :
+                           intersectLanes[k] ? Cull_Intersect : Cull_Inside;
+        }
+    }
+#endif
+    for (; i < n; ++i)
+        results[i] = classifyOne(planes, verts, i);
+}
@@ -0,0 +1,71 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#ifndef DISPLAZ_FRUSTUMCULL_H_INCLUDED
+#define DISPLAZ_FRUSTUMCULL_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+#include "util.h"
+
+/// Result of classifying a bounding box against the view frustum
+enum CullResult
+{
+    Cull_Outside,    ///< Entirely outside some plane - can be discarded
+    Cull_Intersect,  ///< Possibly crosses the frustum boundary
+    Cull_Inside      ///< Entirely inside all planes - children need no tests
+};
+
+
+/// Six frustum planes `n.dot(v) + d >= 0` for points `v` inside
+///
+/// Coefficients are stored as separate arrays so that a plane can be
+/// broadcast against several boxes at once.
+struct FrustumPlanes
+{
+    float nx[6];
+    float ny[6];
+    float nz[6];
+    float d[6];
+
+    void setPlane(int j, const V3f& normal, float distance)
+    {
+        nx[j] = normal.x;
+        ny[j] = normal.y;
+        nz[j] = normal.z;
+        d[j] = distance;
+    }
+};
+
+
+/// Axis aligned boxes in struct of arrays layout, as input to classifyBoxes()
+struct BoxArrays
+{
+    const float* minX;
+    const float* minY;
+    const float* minZ;
+    const float* maxX;
+    const float* maxY;
+    const float* maxZ;
+};
+
+
+/// Classify `box` against `planes`
+///
+/// Uses the positive/negative vertex test: the box corner furthest along a
+/// plane normal is outside the plane only if the whole box is, and the
+/// nearest corner is inside the plane only if the whole box is.
+CullResult classifyBox(const FrustumPlanes& planes, const Imath::Box3f& box);
+
+
+/// Classify boxes [0,n) of `boxes` against `planes`, storing the CullResult
+/// of box `i` in `results[i]`
+///
+/// Gives the same results as classifyBox(), but tests several boxes at once
+/// with SSE2 or NEON where available.
+void classifyBoxes(const FrustumPlanes& planes, const BoxArrays& boxes,
+                   size_t n, uint8_t* results);
+
+
+#endif // DISPLAZ_FRUSTUMCULL_H_INCLUDED
@@ -0,0 +1,71 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+// Micro benchmark for frustum culling of bounding boxes in frustumcull.h
+//
+// Usage: frustumcull_bench [num_boxes]
+
+#include <chrono>
+#include <cstdlib>
+#include <random>
+
+#include "frustumcull.h"
+
+
+/// Run `func` a few times and return the fastest time in milliseconds
+template<typename FuncT>
+static double timeMillisecs(FuncT func, int repeats = 5)
+{
+    double best = 1e100;
+    for (int i = 0; i < repeats; ++i)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        func();
+        auto t1 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+    }
+    return best;
+}
+
+
+int main(int argc, char* argv[])
+{
+    size_t N = argc > 1 ? (size_t)atoll(argv[1]) : 1000*1000;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> u(-1, 1);
+    FrustumPlanes planes;
+    for (int j = 0; j < 6; ++j)
+        planes.setPlane(j, V3f(u(rng), u(rng), u(rng)), 0.5f + u(rng));
+    std::vector<Box3f> boxes(N);
+    std::vector<float> bounds[6];
+    for (size_t i = 0; i < N; ++i)
+    {
+        V3f c(2*u(rng), 2*u(rng), 2*u(rng));
+        V3f r(0.1f*(u(rng) + 1), 0.1f*(u(rng) + 1), 0.1f*(u(rng) + 1));
+        boxes[i] = Box3f(c - r, c + r);
+        for (int k = 0; k < 3; ++k)
+        {
+            bounds[k].push_back(boxes[i].min[k]);
+            bounds[3+k].push_back(boxes[i].max[k]);
+        }
+    }
+    BoxArrays arrays = {bounds[0].data(), bounds[1].data(), bounds[2].data(),
+                        bounds[3].data(), bounds[4].data(), bounds[5].data()};
+    std::vector<uint8_t> results(N);
+
+    double tScalar = timeMillisecs([&]()
+    {
+        for (size_t i = 0; i < N; ++i)
+            results[i] = (uint8_t)classifyBox(planes, boxes[i]);
+    });
+    size_t numVisible = N - std::count(results.begin(), results.end(), Cull_Outside);
+    double tBatch = timeMillisecs([&]()
+    {
+        classifyBoxes(planes, arrays, N, results.data());
+    });
+
+    tfm::printf("Frustum classification of %d boxes (%d not culled)\n", N, numVisible);
+    tfm::printf("  classifyBox     %8.2f ms\n", tScalar);
+    tfm::printf("  classifyBoxes   %8.2f ms  (%.1fx)\n", tBatch, tScalar/tBatch);
+    return 0;
+}
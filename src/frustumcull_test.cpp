@@ -0,0 +1,108 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include <catch.hpp>
+
+#include <random>
+
+#include "frustumcull.h"
+
+
+/// Planes of the cube [-1,1]^3
+static FrustumPlanes unitCubePlanes()
+{
+    FrustumPlanes planes;
+    planes.setPlane(0, V3f( 1, 0, 0), 1);
+    planes.setPlane(1, V3f(-1, 0, 0), 1);
+    planes.setPlane(2, V3f(0,  1, 0), 1);
+    planes.setPlane(3, V3f(0, -1, 0), 1);
+    planes.setPlane(4, V3f(0, 0,  1), 1);
+    planes.setPlane(5, V3f(0, 0, -1), 1);
+    return planes;
+}
+
+
+/// Reference classification testing all eight box corners
+static CullResult classifyCorners(const FrustumPlanes& planes, const Box3f& box)
+{
+    bool intersect = false;
+    for (int j = 0; j < 6; ++j)
+    {
+        int numOutside = 0;
+        for (int c = 0; c < 8; ++c)
+        {
+            V3f p((c & 1) ? box.max.x : box.min.x,
+                  (c & 2) ? box.max.y : box.min.y,
+                  (c & 4) ? box.max.z : box.min.z);
+            if (planes.nx[j]*p.x + planes.ny[j]*p.y + planes.nz[j]*p.z + planes.d[j] < 0)
+                ++numOutside;
+        }
+        if (numOutside == 8)
+            return Cull_Outside;
+        if (numOutside != 0)
+            intersect = true;
+    }
+    return intersect ? Cull_Intersect : Cull_Inside;
+}
+
+
+TEST_CASE("classifyBox")
+{
+    FrustumPlanes planes = unitCubePlanes();
+    CHECK(classifyBox(planes, Box3f(V3f(-0.5), V3f(0.5))) == Cull_Inside);
+    CHECK(classifyBox(planes, Box3f(V3f(0.5), V3f(1.5))) == Cull_Intersect);
+    CHECK(classifyBox(planes, Box3f(V3f(-2), V3f(2))) == Cull_Intersect);
+    CHECK(classifyBox(planes, Box3f(V3f(2), V3f(3))) == Cull_Outside);
+    CHECK(classifyBox(planes, Box3f(V3f(-3,0,0), V3f(-2,0,0))) == Cull_Outside);
+}
+
+
+TEST_CASE("classifyBoxes agrees with corner tests")
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> u(-1, 1);
+    // Random planes, biased to contain the origin
+    FrustumPlanes planes;
+    for (int j = 0; j < 6; ++j)
+        planes.setPlane(j, V3f(u(rng), u(rng), u(rng)), 0.5f + u(rng));
+    // Test lengths which exercise both the vector and scalar tail loops
+    for (size_t n : {0, 1, 3, 4, 8, 13, 1000})
+    {
+        std::vector<float> bounds[6];
+        std::vector<Box3f> boxes;
+        for (size_t i = 0; i < n; ++i)
+        {
+            V3f c(2*u(rng), 2*u(rng), 2*u(rng));
+            V3f r(0.5f*(u(rng) + 1), 0.5f*(u(rng) + 1), 0.5f*(u(rng) + 1));
+            Box3f box(c - r, c + r);
+            boxes.push_back(box);
+            for (int k = 0; k < 3; ++k)
+            {
+                bounds[k].push_back(box.min[k]);
+                bounds[3+k].push_back(box.max[k]);
+            }
+        }
+        BoxArrays arrays = {bounds[0].data(), bounds[1].data(), bounds[2].data(),
+                            bounds[3].data(), bounds[4].data(), bounds[5].data()};
+        std::vector<uint8_t> results(n + 1, 0xff);
+        classifyBoxes(planes, arrays, n, results.data());
+        int numMismatched = 0;
+        int numClass[3] = {0, 0, 0};
+        for (size_t i = 0; i < n; ++i)
+        {
+            CullResult expected = classifyCorners(planes, boxes[i]);
+            numMismatched += results[i] != expected ||
+                             classifyBox(planes, boxes[i]) != expected;
+            ++numClass[expected];
+        }
+        CHECK(numMismatched == 0);
+        CHECK(results[n] == 0xff);
+        if (n == 1000)
+        {
+            // Check the random boxes cover all cases
+            CHECK(numClass[Cull_Outside] > 0);
+            CHECK(numClass[Cull_Intersect] > 0);
+            CHECK(numClass[Cull_Inside] > 0);
+        }
+    }
+}
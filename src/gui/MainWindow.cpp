@@ -10,6 +10,7 @@
 #include "HelpDialog.h"
 #include "IpcChannel.h"
 #include "QtLogger.h"
+#include "LeafBufferCache.h"
 #include "TriMesh.h"
 #include "Enable.h"
 #include "ShaderEditor.h"
@@ -595,6 +596,39 @@ void MainWindow::handleMessage(QByteArray message)
     else if (commandTokens[0] == "SET_MAX_POINT_COUNT")
     {
         m_maxPointCount = commandTokens[1].toLongLong();
+        m_fileLoader->setMaxPointsPerFile(m_maxPointCount);
+    }
+    else if (commandTokens[0] == "SET_GPU_BUFFER_BUDGET")
+    {
+        LeafBufferCache::instance().setBudget(size_t(commandTokens[1].toLongLong())*1024*1024);
+    }
+    else if (commandTokens[0] == "SET_RENDER_POLICY")
+    {
+        RenderPolicy policy = m_pointView->renderPolicy();
+        for (int i = 1; i < commandTokens.size(); ++i)
+        {
+            QList<QByteArray> nameValue = commandTokens[i].split('=');
+            bool ok = nameValue.size() == 2;
+            double value = ok ? nameValue[1].toDouble(&ok) : 0;
+            if (!ok || !policy.setParameter(nameValue[0].toStdString(), value))
+            {
+                g_logger.error("Bad render policy setting: %s",
+                               QString::fromUtf8(commandTokens[i]));
+            }
+        }
+        m_pointView->setRenderPolicy(policy);
+    }
+    else if (commandTokens[0] == "SET_COST_TRACE")
+    {
+        m_pointView->drawCostModel().setTraceFile(commandTokens[1].toStdString());
+    }
+    else if (commandTokens[0] == "SET_OCTREE_CACHE")
+    {
+        m_fileLoader->setUseOctreeCache(commandTokens[1].toInt() != 0);
+    }
+    else if (commandTokens[0] == "SET_INTERLEAVE_FIELDS")
+    {
+        m_fileLoader->setInterleaveFields(commandTokens[1].toInt() != 0);
     }
     else if (commandTokens[0] == "OPEN_SHADER")
     {
@@ -4,8 +4,13 @@
 #include "util.h"
 #include "QtLogger.h"
 #include "PointArray.h"
+#include "parallel.h"
 
-#include <random>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include <QFile>
 
 // FIXME! The point loader code is really a horrible mess.  It should be
 // cleaned up to conform to a proper interface, and moved out of the PointArray
@@ -45,37 +50,223 @@ bool PointArray::loadLas(QString fileName, size_t maxPointCount,
 
 
 
-bool PointArray::loadLas(QString fileName, size_t maxPointCount,
-                         std::vector<GeomField>& fields, V3d& offset,
-                         size_t& npoints, uint64_t& totalPoints)
+/// Output arrays for point data loaded from las
+struct LasFieldArrays
 {
-    File file;
-    auto lasReadOpener = std::make_unique<LASreadOpener>();
-    auto lasReader = std::make_unique<LASreaderLAS>(lasReadOpener.get());
+    V3f* position;
+    uint16_t* intensity;
+    uint8_t* returnNumber;
+    uint8_t* numReturns;
+    uint16_t* pointSourceId;
+    uint8_t* classification;
+    uint16_t* color;            ///< Null if the point format has no color
+};
+
+
+/// Return true if las point data format `format` includes RGB color
+static bool lasFormatHasRgb(int format)
+{
+    return format == 2 || format == 3 || format == 5 ||
+           format == 7 || format == 8 || format == 10;
+}
+
+
+/// Convert las 1.4 extended return numbering to the legacy three bit fields,
+/// in the same way as laslib.
+static void legacyReturnNumbers(int extReturnNumber, int extNumReturns,
+                                uint8_t& returnNumber, uint8_t& numReturns)
+{
+    if (extNumReturns > 7)
+    {
+        if (extReturnNumber > 6)
+            returnNumber = extReturnNumber >= extNumReturns ? 7 : 6;
+        else
+            returnNumber = extReturnNumber;
+        numReturns = 7;
+    }
+    else
+    {
+        returnNumber = extReturnNumber;
+        numReturns = extNumReturns;
+    }
+}
+
+
+template<typename T>
+static inline T readRecordValue(const uchar* record, int byteOffset)
+{
+    T val;
+    memcpy(&val, record + byteOffset, sizeof(T));
+    return val;
+}
+
+
+/// Decode raw uncompressed las point records for output points
+/// [beginIndex,endIndex) directly into the output arrays.
+///
+/// `records` points to the start of the point data in the file, which must
+/// hold `decimator.totalPoints()` records.
+static void decodeLasRecords(const uchar* records, const LASheader& header,
+                             const V3d& offset, const LasFieldArrays& out,
+                             size_t beginIndex, size_t endIndex,
+                             const PointDecimator& decimator)
+{
+    const int recordLength = header.point_data_record_length;
+    const bool extended = header.point_data_format >= 6;
+    const int rgbOffset = extended ? 30 : (header.point_data_format == 2 ? 20 : 28);
+    const V3d scale(header.x_scale_factor, header.y_scale_factor, header.z_scale_factor);
+    const V3d recordOffset(header.x_offset, header.y_offset, header.z_offset);
+    for (size_t i = beginIndex; i < endIndex; ++i)
+    {
+        const uchar* rec = records +
+            decimator.inputIndex(i)*recordLength;
+        V3d P = V3d(readRecordValue<int32_t>(rec, 0)*scale.x + recordOffset.x,
+                    readRecordValue<int32_t>(rec, 4)*scale.y + recordOffset.y,
+                    readRecordValue<int32_t>(rec, 8)*scale.z + recordOffset.z);
+        out.position[i] = P - offset;
+        out.intensity[i] = readRecordValue<uint16_t>(rec, 12);
+        uint8_t returnBits = rec[14];
+        if (extended)
+        {
+            legacyReturnNumbers(returnBits & 0xF, returnBits >> 4,
+                                out.returnNumber[i], out.numReturns[i]);
+            out.classification[i] = rec[16];
+            out.pointSourceId[i] = readRecordValue<uint16_t>(rec, 20);
+        }
+        else
+        {
+            out.returnNumber[i] = returnBits & 0x7;
+            out.numReturns[i] = (returnBits >> 3) & 0x7;
+            // Flags are already packed into the classification byte
+            out.classification[i] = rec[15];
+            out.pointSourceId[i] = readRecordValue<uint16_t>(rec, 18);
+        }
+        if (out.color)
+        {
+            out.color[3*i]   = readRecordValue<uint16_t>(rec, rgbOffset);
+            out.color[3*i+1] = readRecordValue<uint16_t>(rec, rgbOffset + 2);
+            out.color[3*i+2] = readRecordValue<uint16_t>(rec, rgbOffset + 4);
+        }
+    }
+}
+
+
+/// Store laslib point as output point `i`
+static void storeLasPoint(const LASpoint& point, const V3d& offset,
+                          const LasFieldArrays& out, size_t i)
+{
+    V3d P = V3d(point.get_x(), point.get_y(), point.get_z());
+    out.position[i] = P - offset;
+    // float intens = float(point.scan_angle_rank) / 40;
+    out.intensity[i] = point.intensity;
+    out.returnNumber[i] = point.return_number;
+#   if LAS_TOOLS_VERSION >= 140315
+    out.numReturns[i] = point.number_of_returns;
+#   else
+    out.numReturns[i] = point.number_of_returns_of_given_pulse;
+#   endif
+    out.pointSourceId[i] = point.point_source_ID;
+    if (point.extended_point_type) {
+        out.classification[i] = point.extended_classification;
+    } else {
+        // Put flags back in classification byte to avoid memory bloat
+        out.classification[i] = point.classification | (point.synthetic_flag << 5) |
+                                (point.keypoint_flag << 6) | (point.withheld_flag << 7);
+    }
+    // Extract point RGB
+    if (out.color)
+    {
+        out.color[3*i]   = point.rgb[0];
+        out.color[3*i+1] = point.rgb[1];
+        out.color[3*i+2] = point.rgb[2];
+    }
+}
+
+
+/// Open `fileName` with laslib, returning null on failure.
+///
+/// The returned reader owns `file`, which must be kept open as long as the
+/// reader is in use.
+static std::unique_ptr<LASreaderLAS> openLasReader(const QString& fileName,
+                                                   LASreadOpener* lasReadOpener,
+                                                   File& file)
+{
+    auto lasReader = std::make_unique<LASreaderLAS>(lasReadOpener);
 #ifdef _WIN32
     file = _wfopen(fileName.toStdWString().data(), L"rb");
 #else
     file = fopen(fileName.toUtf8().constData(), "rb");
 #endif
     if(!file || !lasReader->open(file))
+        return nullptr;
+    return lasReader;
+}
+
+
+bool PointArray::loadLas(QString fileName, size_t maxPointCount,
+                         std::vector<GeomField>& fields, V3d& offset,
+                         size_t& npoints, uint64_t& totalPoints)
+{
+    File file;
+    auto lasReadOpener = std::make_unique<LASreadOpener>();
+    std::unique_ptr<LASreaderLAS> lasReader = openLasReader(fileName, lasReadOpener.get(), file);
+    if (!lasReader)
     {
         g_logger.error("Couldn't open file \"%s\"", fileName);
         return false;
     }
+    const LASheader& header = lasReader->header;
 
     //std::ofstream dumpFile("points.txt");
+    totalPoints = std::max<uint64_t>(header.extended_number_of_point_records,
+                                     header.number_of_point_records);
+    offset = V3d(header.x_offset, header.y_offset, header.z_offset);
+
+    // Uncompressed point records are decoded directly from a memory map of
+    // the file, as long as the record layout is one we understand.
+    QFile mappedFile(fileName);
+    const uchar* records = nullptr;
+    int minRecordLength = header.point_data_format >= 6 ? 30 : 20;
+    if (lasFormatHasRgb(header.point_data_format))
+        minRecordLength = header.point_data_format >= 6 ? 36 :
+                          (header.point_data_format == 2 ? 26 : 34);
+    if (!header.laszip && header.point_data_format <= 10 &&
+        header.point_data_record_length >= minRecordLength &&
+        totalPoints > 0 && mappedFile.open(QIODevice::ReadOnly))
+    {
+        uint64_t availablePoints = 0;
+        if ((uint64_t)mappedFile.size() > header.offset_to_point_data)
+        {
+            availablePoints = ((uint64_t)mappedFile.size() - header.offset_to_point_data) /
+                              header.point_data_record_length;
+        }
+        availablePoints = std::min(availablePoints, totalPoints);
+        if (availablePoints > 0)
+        {
+            const uchar* data = mappedFile.map(header.offset_to_point_data,
+                        availablePoints*header.point_data_record_length);
+            if (data)
+            {
+                records = data;
+                if (availablePoints < totalPoints)
+                {
+                    g_logger.warning("Expected %d points in file \"%s\", got %d",
+                                     totalPoints, fileName, availablePoints);
+                    totalPoints = availablePoints;
+                }
+            }
+        }
+    }
+
     // Figure out how much to decimate the point cloud.
-    totalPoints = std::max<uint64_t>(lasReader->header.extended_number_of_point_records,
-                                   lasReader->header.number_of_point_records);
-    size_t decimate = totalPoints == 0 ? 1 : 1 + (totalPoints - 1) / maxPointCount;
-    if(decimate > 1)
+    PointDecimator decimator(totalPoints, maxPointCount);
+    if(decimator.factor() > 1)
     {
         g_logger.info("Decimating \"%s\" by factor of %d",
-                        fileName.toStdString(), decimate);
+                        fileName.toStdString(), decimator.factor());
     }
-    npoints = (totalPoints + decimate - 1) / decimate;
-    offset = V3d(lasReader->header.x_offset, lasReader->header.y_offset, lasReader->header.z_offset);
-
+    const uint64_t decimate = decimator.factor();
+    npoints = decimator.outputCount();
     fields.push_back(GeomField(TypeSpec::vec3float32(), "position", npoints));
     fields.push_back(GeomField(TypeSpec::uint16_i(), "intensity", npoints));
     fields.push_back(GeomField(TypeSpec::uint8_i(), "returnNumber", npoints));
@@ -87,88 +278,162 @@ bool PointArray::loadLas(QString fileName, size_t maxPointCount,
         g_logger.warning("File %s has zero points", fileName);
         return true;
     }
-    // Iterate over all points & pull in the data.
-    V3f* position           = (V3f*)fields[0].as<float>();
-    uint16_t* intensity     = fields[1].as<uint16_t>();
-    uint8_t* returnNumber   = fields[2].as<uint8_t>();
-    uint8_t* numReturns     = fields[3].as<uint8_t>();
-    uint16_t* pointSourceId  = fields[4].as<uint16_t>();
-    uint8_t* classification = fields[5].as<uint8_t>();
-    uint64_t readCount = 0;
-    uint64_t nextDecimateBlock = 1;
-    uint64_t nextStore = 1;
-    size_t storeCount = 0;
-    std::mt19937 rand;
-    if (!lasReader->read_point())
-        return false;
-    const LASpoint& point = lasReader->point;
-    uint16_t* color = 0;
-    if (point.have_rgb)
+    LasFieldArrays out;
+    out.position       = (V3f*)fields[0].as<float>();
+    out.intensity      = fields[1].as<uint16_t>();
+    out.returnNumber   = fields[2].as<uint8_t>();
+    out.numReturns     = fields[3].as<uint8_t>();
+    out.pointSourceId  = fields[4].as<uint16_t>();
+    out.classification = fields[5].as<uint8_t>();
+    out.color = 0;
+    if (lasFormatHasRgb(header.point_data_format))
     {
         fields.push_back(GeomField(TypeSpec(TypeSpec::Uint,2,3,TypeSpec::Color),
                                    "color", npoints));
-        color = fields.back().as<uint16_t>();
+        out.color = fields.back().as<uint16_t>();
     }
-    do
-    {
-        // Read a point from the las file
-        ++readCount;
-        if(readCount % 10000 == 0)
-            emit loadProgress(100*readCount/totalPoints);
-        V3d P = V3d(point.get_x(), point.get_y(), point.get_z());
-        if(readCount < nextStore)
-            continue;
-        ++storeCount;
-        // Store the point
-        *position++ = P - offset;
-        // float intens = float(point.scan_angle_rank) / 40;
-        *intensity++ = point.intensity;
-        *returnNumber++ = point.return_number;
-#       if LAS_TOOLS_VERSION >= 140315
-        *numReturns++ = point.number_of_returns;
-#       else
-        *numReturns++ = point.number_of_returns_of_given_pulse;
-#       endif
-        *pointSourceId++ = point.point_source_ID;
-
-        if (point.extended_point_type) {
-            *classification++ = point.extended_classification;
-        } else {
-            // Put flags back in classification byte to avoid memory bloat
-            *classification++ = point.classification | (point.synthetic_flag << 5) |
-                                (point.keypoint_flag << 6) | (point.withheld_flag << 7);
-        }
 
-        // Extract point RGB
-        if (color)
+    // Points are decoded in parallel over ranges of output points.  Progress
+    // is only emitted from the loading thread, using the total across all
+    // threads.
+    std::atomic<uint64_t> readCount(0);
+    const std::thread::id loaderThread = std::this_thread::get_id();
+    auto progress = [&](uint64_t newlyRead)
+    {
+        uint64_t count = (readCount += newlyRead);
+        if (std::this_thread::get_id() == loaderThread)
+            emit loadProgress(int(100*count/totalPoints));
+    };
+    const size_t progressBlockSize = 100000;
+
+    if (records)
+    {
+        parallelFor(0, npoints, progressBlockSize, [&](size_t beginIndex, size_t endIndex)
+        {
+            for (size_t b = beginIndex; b < endIndex; b += progressBlockSize)
+            {
+                size_t e = std::min(endIndex, b + progressBlockSize);
+                decodeLasRecords(records, header, offset, out, b, e, decimator);
+                progress(std::min(e*decimate, totalPoints) - b*decimate);
+            }
+        });
+        return true;
+    }
+
+    // Compressed (or otherwise unmappable) files go through laslib.  Each
+    // range of points gets its own reader which seeks to the start of the
+    // range; for laz this uses the chunk table, so only the partial laz chunk
+    // at the start of each range is decoded redundantly.
+    lasReader.reset();
+    file.close();
+    const size_t minRangeRecords = 2*1000*1000;
+    const size_t numRanges = std::min<size_t>(4*ThreadPool::global().concurrency(),
+                                  (totalPoints + minRangeRecords - 1) / minRangeRecords);
+    const size_t rangeSize = (npoints + numRanges - 1) / numRanges;
+    // Decode output points [beginIndex,endIndex) from `reader`, positioned
+    // at input record `record`.  Return the number of points stored.
+    auto decodeRange = [&](LASreaderLAS& reader, uint64_t record,
+                           size_t beginIndex, size_t endIndex)
+    {
+        uint64_t recordEnd = std::min<uint64_t>(endIndex*decimate, totalPoints);
+        size_t storeIndex = beginIndex;
+        uint64_t nextStore = decimator.inputIndex(storeIndex);
+        uint64_t unreported = 0;
+        for (; record < recordEnd && reader.read_point(); ++record)
         {
-            *color++ = point.rgb[0];
-            *color++ = point.rgb[1];
-            *color++ = point.rgb[2];
+            if (++unreported == progressBlockSize)
+            {
+                progress(unreported);
+                unreported = 0;
+            }
+            if (record != nextStore)
+                continue;
+            storeLasPoint(reader.point, offset, out, storeIndex);
+            ++storeIndex;
+            if (storeIndex < endIndex)
+                nextStore = decimator.inputIndex(storeIndex);
         }
-        // Figure out which point will be the next stored point.
-        nextDecimateBlock += decimate;
-        nextStore = nextDecimateBlock;
-        if(decimate > 1)
+        progress(unreported);
+        return storeIndex - beginIndex;
+    };
+    std::vector<size_t> storeCounts(numRanges, 0);
+    std::vector<uint8_t> rangeFailed(numRanges, 0);
+    parallelFor(0, numRanges, 1, [&](size_t rangeBegin, size_t rangeEnd)
+    {
+        for (size_t range = rangeBegin; range < rangeEnd; ++range)
+        {
+            size_t beginIndex = range*rangeSize;
+            size_t endIndex = std::min<size_t>(npoints, beginIndex + rangeSize);
+            if (beginIndex >= endIndex)
+                continue;
+            File rangeFile;
+            auto rangeOpener = std::make_unique<LASreadOpener>();
+            std::unique_ptr<LASreaderLAS> reader = openLasReader(fileName, rangeOpener.get(), rangeFile);
+            uint64_t record = beginIndex*decimate;
+            if (!reader || !reader->seek(record))
+            {
+                rangeFailed[range] = 1;
+                continue;
+            }
+            storeCounts[range] = decodeRange(*reader, record, beginIndex, endIndex);
+            reader->close();
+        }
+    });
+    // Ranges which couldn't be opened or seeked to are read sequentially
+    // from the start of the file instead.
+    for (size_t range = 0; range < numRanges; ++range)
+    {
+        if (!rangeFailed[range])
+            continue;
+        size_t beginIndex = range*rangeSize;
+        size_t endIndex = std::min<size_t>(npoints, beginIndex + rangeSize);
+        uint64_t recordBegin = beginIndex*decimate;
+        g_logger.error("Could not seek to points %d-%d of \"%s\"; reading sequentially",
+                       recordBegin, std::min<uint64_t>(endIndex*decimate, totalPoints) - 1,
+                       fileName);
+        File rangeFile;
+        auto rangeOpener = std::make_unique<LASreadOpener>();
+        std::unique_ptr<LASreaderLAS> reader = openLasReader(fileName, rangeOpener.get(), rangeFile);
+        if (!reader)
         {
-            // Randomize selected point within block to avoid repeated patterns
-            nextStore += (rand() % decimate);
-            if(nextDecimateBlock <= totalPoints && nextStore > totalPoints)
-                nextStore = totalPoints;
+            g_logger.error("Couldn't reopen file \"%s\"", fileName);
+            return false;
         }
+        uint64_t record = 0;
+        while (record < recordBegin && reader->read_point())
+            ++record;
+        if (record == recordBegin)
+            storeCounts[range] = decodeRange(*reader, record, beginIndex, endIndex);
+        reader->close();
+    }
+    // A short file leaves only a prefix of the points readable, so the loaded
+    // points are those up to the first incomplete range.
+    size_t storeCount = 0;
+    for (size_t range = 0; range < numRanges; ++range)
+    {
+        storeCount += storeCounts[range];
+        size_t expected = std::min<size_t>(npoints, (range + 1)*rangeSize) -
+                          std::min<size_t>(npoints, range*rangeSize);
+        if (storeCounts[range] < expected)
+            break;
+    }
+    if (storeCount == 0)
+    {
+        g_logger.error("Could not read any points from file \"%s\"", fileName);
+        return false;
     }
-    while(lasReader->read_point());
-    lasReader->close();
-    if (readCount < totalPoints)
+    if (storeCount < npoints)
     {
+        // Input records covered by the stored points
+        uint64_t storedRecords = std::min<uint64_t>(storeCount*decimate, totalPoints);
         g_logger.warning("Expected %d points in file \"%s\", got %d",
-                         totalPoints, fileName, readCount);
+                         totalPoints, fileName, storedRecords);
         npoints = storeCount;
         // Shrink all fields to fit - these will have wasted space at the end,
         // but that will be fixed during reordering.
         for (size_t i = 0; i < fields.size(); ++i)
             fields[i].size = npoints;
-        totalPoints = readCount;
+        totalPoints = storedRecords;
     }
     return true;
 }
@@ -70,6 +70,15 @@ int main(int argc, char *argv[])
     }
 
     int maxPointCount = -1;
+    bool useOctreeCache = false;
+    bool interleaveFields = false;
+    int gpuBufferBudget = -1;
+    std::string costTraceFile;
+    double interactiveMillisecs = -DBL_MAX;
+    double refineMillisecs = -DBL_MAX;
+    int refineIntervalMillisecs = -1;
+    double maxRefineMillisecs = -DBL_MAX;
+    bool settle = false;
     std::string serverName = "default";
     double posX = -DBL_MAX, posY = -DBL_MAX, posZ = -DBL_MAX;
     double yaw = -DBL_MAX, pitch = -DBL_MAX, roll = -DBL_MAX;
@@ -113,6 +122,15 @@ int main(int argc, char *argv[])
 
         "<SEPARATOR>", "\nInitial settings / remote commands:",
         "-maxpoints %d", &maxPointCount, "Maximum number of points to load at a time",
+        "-gpubudget %d", &gpuBufferBudget, "GPU memory in MB used to keep point data resident between frames",
+        "-interleave",   &interleaveFields, "Pack point fields into one interleaved array for faster drawing, at the cost of extra memory",
+        "-frametime %F", &interactiveMillisecs, "Target frame time in ms after the view changes (default 40)",
+        "-refinetime %F", &refineMillisecs, "Target frame time in ms for incremental refinement frames (default 40)",
+        "-refineinterval %d", &refineIntervalMillisecs, "Delay in ms between refinement frames (default 10)",
+        "-refinecap %F", &maxRefineMillisecs, "Stop refining this many ms after the view changes to save power; 0 for no limit",
+        "-settle",       &settle,        "When refinement is capped, finish with one frame drawing all remaining points",
+        "-costtrace %s", &costTraceFile, "Append per-frame draw counts and times to a file, for analysis with drawcost_replay",
+        "-octreecache",  &useOctreeCache, "Cache sorted point data in a <file>.dzoctree file next to each point file, and reuse it for fast reloading",
         "-noserver",     &noServer,      "Don't attempt to open files in existing window",
         "-server %s",    &serverName,    "Name of displaz instance to message on startup",
         "-shader %s",    &shaderName,    "Name of shader file to load on startup",
@@ -340,6 +358,33 @@ int main(int argc, char *argv[])
         channel->sendMessage("SET_MAX_POINT_COUNT\n" +
                              QByteArray().setNum(maxPointCount));
     }
+    if (gpuBufferBudget >= 0)
+    {
+        channel->sendMessage("SET_GPU_BUFFER_BUDGET\n" +
+                             QByteArray().setNum(gpuBufferBudget));
+    }
+    QByteArray renderPolicy;
+    if (interactiveMillisecs != -DBL_MAX)
+        renderPolicy += "\ninteractive=" + QByteArray().setNum(interactiveMillisecs);
+    if (refineMillisecs != -DBL_MAX)
+        renderPolicy += "\nrefine=" + QByteArray().setNum(refineMillisecs);
+    if (refineIntervalMillisecs >= 0)
+        renderPolicy += "\ninterval=" + QByteArray().setNum(refineIntervalMillisecs);
+    if (maxRefineMillisecs != -DBL_MAX)
+        renderPolicy += "\nrefinecap=" + QByteArray().setNum(maxRefineMillisecs);
+    if (settle)
+        renderPolicy += "\nsettle=1";
+    if (!renderPolicy.isEmpty())
+        channel->sendMessage("SET_RENDER_POLICY" + renderPolicy);
+    if (!costTraceFile.empty())
+    {
+        channel->sendMessage("SET_COST_TRACE\n" +
+            QDir::current().absoluteFilePath(QString::fromStdString(costTraceFile)).toUtf8());
+    }
+    if (useOctreeCache)
+        channel->sendMessage("SET_OCTREE_CACHE\n1");
+    if (interleaveFields)
+        channel->sendMessage("SET_INTERLEAVE_FIELDS\n1");
     if (!shaderName.empty() && startedGui)
     {
         // Note - only send the OPEN_SHADER command when the GUI is initially
@@ -0,0 +1,126 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include "octreelod.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+
+/// Hash of a point index, for choosing points at random but repeatably
+static inline uint32_t hashPointIndex(uint64_t h)
+{
+    // MurmurHash3 finalizer
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+
+/// Index of the grid cell containing coordinate `c`, in units of cells
+static inline int gridCell(float c, int gridSize)
+{
+    // Clamp before converting, since the conversion of out of range floats
+    // is undefined.
+    return (int)std::min(std::max(c, 0.0f), float(gridSize - 1));
+}
+
+
+/// Keep the point with the smallest key in each cell of `cellPoint`, for
+/// points P[inds[begin..end)]
+///
+/// The key is the hash of the point index, with the position in inds to
+/// break ties.  Positions fit in 32 bits, as for the indices of PointArray.
+static void fillGridCells(const V3f* P, const size_t* inds, size_t begin, size_t end,
+                          const V3f& origin, float cellsPerUnit, int G,
+                          uint64_t* cellPoint)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        V3f c = (P[inds[i]] - origin)*cellsPerUnit;
+        int x = gridCell(c.x, G);
+        int y = gridCell(c.y, G);
+        int z = gridCell(c.z, G);
+        uint64_t key = (uint64_t(hashPointIndex(inds[i])) << 32) | i;
+        uint64_t& cell = cellPoint[(size_t(z)*G + y)*G + x];
+        cell = std::min(cell, key);
+    }
+}
+
+
+size_t selectGridPoints(const V3f* P, const size_t* inds, size_t n,
+                        const V3f& center, float halfWidth, int gridSize,
+                        uint8_t* selected, ThreadPool& pool)
+{
+    const int G = gridSize;
+    const size_t numCells = size_t(G)*G*G;
+    V3f origin = center - V3f(halfWidth);
+    float cellsPerUnit = G/(2*halfWidth);
+    if (!(halfWidth > 0) || !std::isfinite(cellsPerUnit))
+        cellsPerUnit = 0;
+    // Only split the points when there are enough per chunk to pay for
+    // clearing and merging a grid for each.
+    size_t numChunks = std::min((size_t)pool.concurrency(), n/(8*numCells));
+    std::vector<uint64_t> cellPoint(numCells, UINT64_MAX);
+    if (numChunks <= 1)
+    {
+        fillGridCells(P, inds, 0, n, origin, cellsPerUnit, G, cellPoint.data());
+        std::fill(selected, selected + n, 0);
+    }
+    else
+    {
+        size_t chunkSize = (n + numChunks - 1)/numChunks;
+        std::vector<std::vector<uint64_t>> chunkCells(numChunks - 1);
+        parallelFor(0, numChunks, 1, [&](size_t chunkBegin, size_t chunkEnd)
+        {
+            for (size_t c = chunkBegin; c < chunkEnd; ++c)
+            {
+                uint64_t* cells = cellPoint.data();
+                if (c > 0)
+                {
+                    chunkCells[c-1].assign(numCells, UINT64_MAX);
+                    cells = chunkCells[c-1].data();
+                }
+                fillGridCells(P, inds, c*chunkSize, std::min(n, (c+1)*chunkSize),
+                              origin, cellsPerUnit, G, cells);
+            }
+        }, pool);
+        parallelFor(0, numCells, 4096, [&](size_t b, size_t e)
+        {
+            for (const std::vector<uint64_t>& cells : chunkCells)
+            {
+                for (size_t i = b; i < e; ++i)
+                    cellPoint[i] = std::min(cellPoint[i], cells[i]);
+            }
+        }, pool);
+        parallelFor(0, n, 1024*1024, [&](size_t b, size_t e)
+        {
+            std::fill(selected + b, selected + e, 0);
+        }, pool);
+    }
+    size_t numSelected = 0;
+    for (uint64_t key : cellPoint)
+    {
+        if (key != UINT64_MAX)
+        {
+            selected[key & 0xffffffff] = 1;
+            ++numSelected;
+        }
+    }
+    return numSelected;
+}
+
+
+double lodDrawWeight(double pointSpacing, double pixelsPerUnit, double pointsPerPixel)
+{
+    if (!(pointSpacing > 0) || !std::isfinite(pointSpacing))
+        return DBL_MAX;
+    // On-screen density of all points is 1/spacingPixels^2
+    double spacingPixels = pointSpacing*pixelsPerUnit;
+    return pointsPerPixel*spacingPixels*spacingPixels;
+}
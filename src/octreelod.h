@@ -0,0 +1,41 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#ifndef DISPLAZ_OCTREELOD_H_INCLUDED
+#define DISPLAZ_OCTREELOD_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+#include "util.h"
+#include "parallel.h"
+
+/// Choose one point from each occupied cell of a `gridSize`^3 grid over the
+/// cube with the given `center` and `halfWidth`
+///
+/// Points are P[inds[0..n)].  The point chosen in each cell is the one with
+/// the smallest hash of its index into P, so the choice is random but
+/// repeatable.  Sets `selected[i]` to 1 if P[inds[i]] is chosen and 0
+/// otherwise, and returns the number chosen.  A cube of zero width (eg, for
+/// coincident points) is a single cell.
+///
+/// Large inputs are split into chunks which fill separate grids on the
+/// threads of `pool`, and the grids are then merged.  The result is the same
+/// as for a single grid.
+size_t selectGridPoints(const V3f* P, const size_t* inds, size_t n,
+                        const V3f& center, float halfWidth, int gridSize,
+                        uint8_t* selected,
+                        ThreadPool& pool = ThreadPool::global());
+
+
+/// Fraction of the points of a node to draw at unit quality, before
+/// clamping to 1
+///
+/// Points `pointSpacing` apart, appearing `pixelsPerUnit` pixels on screen
+/// per unit length, are thinned to `pointsPerPixel` points per pixel of
+/// screen area.  Zero or non-finite spacing (eg, single or coincident
+/// points) can't be thinned, so all points are drawn.
+double lodDrawWeight(double pointSpacing, double pixelsPerUnit, double pointsPerPixel);
+
+
+#endif // DISPLAZ_OCTREELOD_H_INCLUDED
@@ -0,0 +1,102 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include <catch.hpp>
+
+#include <cmath>
+#include <numeric>
+#include <random>
+
+#include "octreelod.h"
+
+
+TEST_CASE("selectGridPoints keeps one point per occupied cell")
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> u(-1, 1);
+    const size_t n = 10000;
+    std::vector<V3f> P(n);
+    for (size_t i = 0; i < n; ++i)
+        P[i] = V3f(u(rng), u(rng), u(rng));
+    std::vector<size_t> inds(n);
+    std::iota(inds.begin(), inds.end(), 0);
+    std::vector<uint8_t> selected(n, 0xff);
+    // 2x2x2 grid over [-1,1]^3 - one point from each octant
+    CHECK(selectGridPoints(P.data(), inds.data(), n, V3f(0), 1, 2, selected.data()) == 8);
+    int numInOctant[8] = {0};
+    for (size_t i = 0; i < n; ++i)
+    {
+        CHECK(selected[i] <= 1);
+        if (selected[i])
+        {
+            const V3f& p = P[inds[i]];
+            ++numInOctant[4*(p.z >= 0) + 2*(p.y >= 0) + (p.x >= 0)];
+        }
+    }
+    for (int i = 0; i < 8; ++i)
+        CHECK(numInOctant[i] == 1);
+    // Selection is repeatable
+    std::vector<uint8_t> selected2(n);
+    selectGridPoints(P.data(), inds.data(), n, V3f(0), 1, 2, selected2.data());
+    CHECK(selected == selected2);
+}
+
+
+TEST_CASE("selectGridPoints in parallel agrees with serial")
+{
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> u(-1, 1);
+    const size_t n = 100000;
+    std::vector<V3f> P(n);
+    for (size_t i = 0; i < n; ++i)
+        P[i] = V3f(u(rng), u(rng), u(rng));
+    std::vector<size_t> inds(n);
+    std::iota(inds.begin(), inds.end(), 0);
+    std::shuffle(inds.begin(), inds.end(), rng);
+    ThreadPool serialPool(0);
+    ThreadPool parallelPool(3);
+    std::vector<uint8_t> selected1(n), selected2(n, 0xff);
+    size_t count1 = selectGridPoints(P.data(), inds.data(), n, V3f(0), 1, 8,
+                                     selected1.data(), serialPool);
+    size_t count2 = selectGridPoints(P.data(), inds.data(), n, V3f(0), 1, 8,
+                                     selected2.data(), parallelPool);
+    CHECK(count1 == 512);
+    CHECK(count2 == count1);
+    CHECK(selected1 == selected2);
+}
+
+
+TEST_CASE("selectGridPoints with coincident points")
+{
+    const size_t n = 1000;
+    std::vector<V3f> P(n, V3f(1, 2, 3));
+    std::vector<size_t> inds(n);
+    std::iota(inds.begin(), inds.end(), 0);
+    std::vector<uint8_t> selected(n);
+    // Zero width node, as for a subtree of coincident points
+    CHECK(selectGridPoints(P.data(), inds.data(), n, V3f(1, 2, 3), 0, 64, selected.data()) == 1);
+    CHECK(std::count(selected.begin(), selected.end(), 1) == 1);
+    // Denormal width, where the cell scale overflows
+    CHECK(selectGridPoints(P.data(), inds.data(), n, V3f(1, 2, 3), 1e-44f, 64, selected.data()) == 1);
+    CHECK(selectGridPoints(P.data(), inds.data(), 0, V3f(1, 2, 3), 0, 64, selected.data()) == 0);
+}
+
+
+TEST_CASE("lodDrawWeight")
+{
+    // Points 0.1 apart at 20 pixels per unit are 2 pixels apart, a quarter
+    // of a point per pixel, which is too sparse to thin: the weight of 4
+    // means all points are drawn, even at a quarter of unit quality.
+    CHECK(lodDrawWeight(0.1, 20, 1) == Approx(4));
+    // At 2 pixels per unit they're 0.2 pixels apart, 25 points per pixel,
+    // so 1 in 25 is drawn.
+    CHECK(lodDrawWeight(0.1, 2, 1) == Approx(0.04));
+    CHECK(lodDrawWeight(0.1, 2, 0.5) == Approx(0.02));
+    // Single or coincident points are always drawn in full, so that
+    // refinement of their nodes finishes.
+    const size_t numPoints = 100000;
+    CHECK(lodDrawWeight(0, 2, 1) >= numPoints);
+    CHECK(lodDrawWeight(0, 1e-10, 1) >= numPoints);
+    CHECK(lodDrawWeight(INFINITY, 2, 1) >= numPoints);
+    CHECK(lodDrawWeight(NAN, 2, 1) >= numPoints);
+}
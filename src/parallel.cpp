@@ -0,0 +1,127 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include "parallel.h"
+
+/// Index of the pool worker queue owned by the current thread, or -1 for
+/// threads which aren't pool workers.
+static thread_local int t_workerIndex = -1;
+static thread_local const ThreadPool* t_workerPool = nullptr;
+
+
+ThreadPool::ThreadPool(int numWorkers)
+    : m_queuedCount(0),
+    m_stop(false)
+{
+    numWorkers = std::max(numWorkers, 0);
+    for (int i = 0; i < numWorkers + 1; ++i)
+        m_queues.emplace_back(new TaskQueue());
+    for (int i = 0; i < numWorkers; ++i)
+        m_workers.emplace_back([this,i]() { workerLoop(i); });
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    for (auto& w : m_workers)
+        w.join();
+}
+
+
+ThreadPool& ThreadPool::global()
+{
+    static ThreadPool pool((int)std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+
+void ThreadPool::submit(Task task)
+{
+    // Workers push onto their own queue; everyone else uses the injection
+    // queue at the end.
+    size_t queueIdx = (t_workerPool == this) ? t_workerIndex : m_queues.size() - 1;
+    {
+        // Count before pushing so that m_queuedCount never underestimates
+        // the number of queued tasks.  Lock to avoid a lost wakeup between a
+        // sleeping worker checking m_queuedCount and going to sleep.
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        ++m_queuedCount;
+    }
+    {
+        TaskQueue& queue = *m_queues[queueIdx];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    m_wakeup.notify_one();
+}
+
+
+bool ThreadPool::popTask(Task& task)
+{
+    if (m_queuedCount.load() == 0)
+        return false;
+    int nqueues = (int)m_queues.size();
+    int ownIdx = (t_workerPool == this) ? t_workerIndex : -1;
+    // Newest task from own queue first
+    if (ownIdx >= 0)
+    {
+        TaskQueue& queue = *m_queues[ownIdx];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            --m_queuedCount;
+            return true;
+        }
+    }
+    // Otherwise steal the oldest task from someone else, starting with the
+    // neighbouring queue to spread contention.
+    for (int k = 1; k <= nqueues; ++k)
+    {
+        int idx = (ownIdx + k + nqueues) % nqueues;
+        if (idx == ownIdx)
+            continue;
+        TaskQueue& queue = *m_queues[idx];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            --m_queuedCount;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool ThreadPool::runPendingTask()
+{
+    Task task;
+    if (!popTask(task))
+        return false;
+    task.group->runTask(task.func);
+    return true;
+}
+
+
+void ThreadPool::workerLoop(int workerIndex)
+{
+    t_workerIndex = workerIndex;
+    t_workerPool = this;
+    while (true)
+    {
+        if (runPendingTask())
+            continue;
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wakeup.wait(lock, [this]() { return m_stop || m_queuedCount.load() != 0; });
+        if (m_stop)
+            break;
+    }
+}
@@ -0,0 +1,199 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#ifndef DISPLAZ_PARALLEL_H_INCLUDED
+#define DISPLAZ_PARALLEL_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+//------------------------------------------------------------------------------
+/// Work stealing thread pool for data parallel processing
+///
+/// Each worker thread owns a task queue.  Tasks spawned from a worker are
+/// pushed onto the back of its own queue and popped from the back (LIFO, for
+/// cache locality of recursive algorithms), while idle workers steal from the
+/// front of other queues.  Tasks submitted from a thread outside the pool go
+/// into a shared injection queue.
+///
+/// Threads waiting on a TaskGroup help out by running pending tasks, so it's
+/// fine for tasks to spawn and wait on nested task groups.
+class ThreadPool
+{
+    public:
+        /// Create pool with the given number of worker threads.
+        ///
+        /// Zero workers is valid: all tasks will then be run by the threads
+        /// calling TaskGroup::wait().
+        explicit ThreadPool(int numWorkers);
+        ~ThreadPool();
+
+        /// Get shared pool with one worker per hardware thread (less one for
+        /// the thread which waits on the work)
+        static ThreadPool& global();
+
+        /// Total number of threads which can be expected to run tasks
+        /// concurrently, including a single waiting thread.
+        int concurrency() const { return (int)m_workers.size() + 1; }
+
+    private:
+        friend class TaskGroup;
+
+        struct Task
+        {
+            std::function<void()> func;
+            TaskGroup* group;
+        };
+
+        struct TaskQueue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void submit(Task task);
+        bool popTask(Task& task);
+        bool runPendingTask();
+        void workerLoop(int workerIndex);
+
+        std::vector<std::unique_ptr<TaskQueue>> m_queues; ///< One per worker + injection queue
+        std::vector<std::thread> m_workers;
+        std::atomic<size_t> m_queuedCount;
+        std::mutex m_sleepMutex;
+        std::condition_variable m_wakeup;
+        bool m_stop;
+};
+
+
+//------------------------------------------------------------------------------
+/// A set of tasks which may be waited on together
+///
+/// Typical use:
+///
+/// ```
+/// TaskGroup tasks;
+/// for (...)
+///     tasks.run([=]() { doWork(...); });
+/// tasks.wait();
+/// ```
+///
+/// The first exception thrown by any task is rethrown from wait().
+class TaskGroup
+{
+    public:
+        TaskGroup(ThreadPool& pool = ThreadPool::global())
+            : m_pool(pool),
+            m_pending(0)
+        { }
+
+        ~TaskGroup()
+        {
+            // Never leave tasks referring to a dead group
+            while (m_pending.load() != 0)
+                if (!m_pool.runPendingTask())
+                    std::this_thread::yield();
+        }
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        /// Queue `func` to be run asynchronously
+        template<typename FuncT>
+        void run(FuncT&& func)
+        {
+            ++m_pending;
+            m_pool.submit(ThreadPool::Task{std::forward<FuncT>(func), this});
+        }
+
+        /// Wait until all tasks in the group (including tasks added by the
+        /// running tasks) have completed.  The calling thread helps run
+        /// queued tasks while waiting.
+        void wait()
+        {
+            while (m_pending.load() != 0)
+            {
+                if (!m_pool.runPendingTask())
+                    std::this_thread::yield();
+            }
+            if (m_error)
+            {
+                std::exception_ptr err = m_error;
+                m_error = nullptr;
+                std::rethrow_exception(err);
+            }
+        }
+
+        ThreadPool& pool() { return m_pool; }
+
+    private:
+        friend class ThreadPool;
+
+        void runTask(std::function<void()>& func)
+        {
+            try
+            {
+                func();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_errorMutex);
+                if (!m_error)
+                    m_error = std::current_exception();
+            }
+            --m_pending;
+        }
+
+        ThreadPool& m_pool;
+        std::atomic<size_t> m_pending;
+        std::mutex m_errorMutex;
+        std::exception_ptr m_error;
+};
+
+
+//------------------------------------------------------------------------------
+/// Call `func(chunkBegin, chunkEnd)` over disjoint subranges covering
+/// [begin,end), in parallel.
+///
+/// Subranges have at least `grainSize` elements (except possibly the last),
+/// and there are a few more of them than threads to help with load balancing.
+/// Small ranges are processed on the calling thread.
+template<typename FuncT>
+void parallelFor(size_t begin, size_t end, size_t grainSize, FuncT func,
+                 ThreadPool& pool = ThreadPool::global())
+{
+    if (end <= begin)
+        return;
+    size_t n = end - begin;
+    grainSize = std::max<size_t>(grainSize, 1);
+    size_t maxChunks = 4*(size_t)pool.concurrency();
+    size_t numChunks = std::min(maxChunks, (n + grainSize - 1)/grainSize);
+    if (numChunks <= 1)
+    {
+        func(begin, end);
+        return;
+    }
+    size_t chunkSize = (n + numChunks - 1)/numChunks;
+    TaskGroup tasks(pool);
+    for (size_t b = begin + chunkSize; b < end; b += chunkSize)
+    {
+        size_t e = std::min(end, b + chunkSize);
+        tasks.run([&func,b,e]() { func(b, e); });
+    }
+    // Calling thread does the first chunk itself
+    func(begin, std::min(end, begin + chunkSize));
+    tasks.wait();
+}
+
+
+#endif // DISPLAZ_PARALLEL_H_INCLUDED
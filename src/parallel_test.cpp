@@ -0,0 +1,74 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include <catch.hpp>
+
+#include <numeric>
+#include <stdexcept>
+
+#include "parallel.h"
+
+// gcc 4.6 and 4.7 warns/suggests parentheses around == comparison
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wparentheses"
+#endif
+
+
+/// Recursive sum, spawning nested tasks
+static void treeSum(TaskGroup& tasks, const int* v, size_t n, std::atomic<long>& sum)
+{
+    if (n <= 100)
+    {
+        sum += std::accumulate(v, v + n, 0L);
+        return;
+    }
+    size_t h = n/2;
+    tasks.run([&tasks,v,h,&sum]() { treeSum(tasks, v, h, sum); });
+    treeSum(tasks, v + h, n - h, sum);
+}
+
+
+TEST_CASE("ThreadPool nested tasks")
+{
+    std::vector<int> v(100000);
+    std::iota(v.begin(), v.end(), 0);
+    long expected = std::accumulate(v.begin(), v.end(), 0L);
+    for (int numWorkers : {0, 1, 4})
+    {
+        ThreadPool pool(numWorkers);
+        std::atomic<long> sum(0);
+        TaskGroup tasks(pool);
+        treeSum(tasks, v.data(), v.size(), sum);
+        tasks.wait();
+        CHECK(sum == expected);
+    }
+}
+
+
+TEST_CASE("parallelFor covers range exactly once")
+{
+    ThreadPool pool(3);
+    std::vector<int> hits(12345, 0);
+    parallelFor(0, hits.size(), 100, [&](size_t b, size_t e)
+    {
+        for (size_t i = b; i < e; ++i)
+            hits[i] += 1;
+    }, pool);
+    CHECK(std::count(hits.begin(), hits.end(), 1) == (int)hits.size());
+    // Empty range
+    parallelFor(10, 10, 1, [&](size_t, size_t) { hits[0] = 100; }, pool);
+    CHECK(hits[0] == 1);
+}
+
+
+TEST_CASE("TaskGroup propagates exceptions")
+{
+    ThreadPool pool(2);
+    TaskGroup tasks(pool);
+    for (int i = 0; i < 10; ++i)
+        tasks.run([i]() { if (i == 5) throw std::runtime_error("task failed"); });
+    CHECK_THROWS_AS(tasks.wait(), const std::runtime_error&);
+    // Group is reusable after an error
+    tasks.run([]() {});
+    CHECK_NOTHROW(tasks.wait());
+}
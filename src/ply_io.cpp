@@ -4,8 +4,13 @@
 #include "ply_io.h"
 
 #include <cstdint>
+#include <cstring>
+#include <map>
+
+#include <QFile>
 
 #include "QtLogger.h"
+#include "parallel.h"
 
 //------------------------------------------------------------------------------
 // Utilities for interfacing with rply
@@ -14,8 +19,10 @@
 class PlyFieldLoader
 {
     public:
-        PlyFieldLoader(GeomField& field)
+        PlyFieldLoader(GeomField& field, const PointDecimator& decimator)
             : m_field(&field),
+            m_decimator(decimator),
+            m_inputIndex(0),
             m_pointIndex(0),
             m_componentReadCount(0),
             m_isPositionField(field.name == "position")
@@ -34,6 +41,15 @@ class PlyFieldLoader
         /// Accept a single element of a point field from the ply file
         int writeValue(int componentIndex, double value)
         {
+            if (!m_decimator.keep(m_inputIndex))
+            {
+                if (++m_componentReadCount == m_field->spec.count)
+                {
+                    ++m_inputIndex;
+                    m_componentReadCount = 0;
+                }
+                return 1;
+            }
             if (m_isPositionField)
             {
                 // Remove fixed offset using first value read.
@@ -75,6 +91,7 @@ class PlyFieldLoader
             ++m_componentReadCount;
             if (m_componentReadCount == m_field->spec.count)
             {
+                ++m_inputIndex;
                 ++m_pointIndex;
                 m_componentReadCount = 0;
             }
@@ -85,6 +102,8 @@ class PlyFieldLoader
 
     private:
         GeomField* m_field;
+        PointDecimator m_decimator;
+        uint64_t m_inputIndex;
         size_t m_pointIndex;
         int m_componentReadCount;
         bool m_isPositionField;
@@ -110,6 +129,240 @@ void plyTypeToPointFieldType(e_ply_type& plyType, TypeSpec::Type& type, int& els
 }
 
 
+//------------------------------------------------------------------------------
+// Utilities for direct access to binary ply data in a memory mapped file
+
+/// Size in bytes of ply scalar type
+static int plyTypeSize(e_ply_type plyType)
+{
+    TypeSpec::Type type = TypeSpec::Unknown;
+    int elsize = 0;
+    plyTypeToPointFieldType(plyType, type, elsize);
+    return elsize;
+}
+
+
+static bool hostIsBigEndian()
+{
+    const uint16_t one = 1;
+    uint8_t firstByte = 0;
+    memcpy(&firstByte, &one, 1);
+    return firstByte == 0;
+}
+
+
+/// Read value of type T from possibly unaligned `src`, reversing the byte
+/// order if `swapBytes` is true.
+template<typename T>
+static inline T readPlyValue(const uchar* src, bool swapBytes)
+{
+    T val;
+    if (swapBytes)
+    {
+        uchar tmp[sizeof(T)];
+        for (size_t i = 0; i < sizeof(T); ++i)
+            tmp[i] = src[sizeof(T)-1-i];
+        memcpy(&val, tmp, sizeof(T));
+    }
+    else
+        memcpy(&val, src, sizeof(T));
+    return val;
+}
+
+
+/// Memory map of the data section of a binary ply file
+///
+/// The header is parsed by rply; this just finds the storage format and the
+/// start of the data, and the location of each element's data within it,
+/// which is possible when no element has list properties.
+class PlyDataMap
+{
+    public:
+        /// Map data of `ply`, which was opened from `fileName`.  Return false
+        /// if the file isn't binary or the data couldn't be mapped.
+        bool map(const QString& fileName, p_ply ply)
+        {
+            m_file.setFileName(fileName);
+            if (!m_file.open(QIODevice::ReadOnly) || m_file.size() <= 0)
+                return false;
+            size_t fileSize = m_file.size();
+            const uchar* data = m_file.map(0, fileSize);
+            if (!data)
+                return false;
+            // Find storage format, and end of header
+            const char* header = (const char*)data;
+            size_t headerSearchLen = std::min<size_t>(fileSize, 1024*1024);
+            const char* formatLine = "\nformat binary_";
+            const char* formatPos = std::search(header, header + headerSearchLen,
+                                                formatLine, formatLine + strlen(formatLine));
+            const char* endLine = "\nend_header";
+            const char* endPos = std::search(header, header + headerSearchLen,
+                                             endLine, endLine + strlen(endLine));
+            if (formatPos == header + headerSearchLen || endPos == header + headerSearchLen)
+                return false;
+            bool fileIsBigEndian = strncmp(formatPos + strlen(formatLine), "big_endian", 10) == 0;
+            m_swapBytes = fileIsBigEndian != hostIsBigEndian();
+            const char* dataStart = (const char*)memchr(endPos + 1, '\n',
+                                                        header + headerSearchLen - endPos - 1);
+            if (!dataStart)
+                return false;
+            size_t offset = dataStart + 1 - header;
+            // Lay out elements consecutively after the header
+            for (p_ply_element elem = ply_get_next_element(ply, NULL);
+                 elem != NULL; elem = ply_get_next_element(ply, elem))
+            {
+                const char* name = 0;
+                long ninstances = 0;
+                if (!ply_get_element_info(elem, &name, &ninstances))
+                    return false;
+                size_t recordSize = 0;
+                for (p_ply_property prop = ply_get_next_property(elem, NULL);
+                     prop != NULL; prop = ply_get_next_property(elem, prop))
+                {
+                    e_ply_type propType;
+                    if (!ply_get_property_info(prop, NULL, &propType, NULL, NULL) ||
+                        propType == PLY_LIST)
+                        return false;
+                    recordSize += plyTypeSize(propType);
+                }
+                m_elements.push_back(ElementData{elem, data + offset, recordSize});
+                offset += recordSize*ninstances;
+            }
+            if (offset > fileSize)
+            {
+                g_logger.error("Binary ply file %s is truncated", fileName);
+                return false;
+            }
+            return true;
+        }
+
+        /// Get start of data for element `elem`, and the size of each
+        /// instance in bytes
+        const uchar* elementData(p_ply_element elem, size_t& recordSize) const
+        {
+            for (const ElementData& e: m_elements)
+            {
+                if (e.elem == elem)
+                {
+                    recordSize = e.recordSize;
+                    return e.data;
+                }
+            }
+            return nullptr;
+        }
+
+        /// True if data needs byte swapping to native order
+        bool swapBytes() const { return m_swapBytes; }
+
+    private:
+        struct ElementData
+        {
+            p_ply_element elem;
+            const uchar* data;
+            size_t recordSize;
+        };
+
+        QFile m_file;
+        bool m_swapBytes = false;
+        std::vector<ElementData> m_elements;
+};
+
+
+/// Convert `count` values of a ply property from binary data `src` to
+/// field storage `dest`, as `dest[i*destStride] = src[i*srcStride] - offset`.
+///
+/// Strides are in bytes; `offset` is only applied when `subtractOffset` is
+/// true.
+template<typename SrcT, typename DstT, bool subtractOffset>
+static void convertPlyProperty(const uchar* src, size_t srcStride,
+                               char* dest, size_t destStride, size_t count,
+                               bool swapBytes, double offset)
+{
+    for (size_t i = 0; i < count; ++i, src += srcStride, dest += destStride)
+    {
+        double value = readPlyValue<SrcT>(src, swapBytes);
+        if (subtractOffset)
+            value -= offset;
+        DstT d = (DstT)value;
+        memcpy(dest, &d, sizeof(DstT));
+    }
+}
+
+typedef void (*PlyPropertyConverter)(const uchar* src, size_t srcStride,
+                                     char* dest, size_t destStride, size_t count,
+                                     bool swapBytes, double offset);
+
+
+/// Get converter from ply type SrcT to the type of field `destSpec`
+template<typename SrcT>
+static PlyPropertyConverter plyPropertyConverter(const TypeSpec& destSpec, bool isPosition)
+{
+    if (isPosition)
+        return &convertPlyProperty<SrcT, float, true>;
+    switch (destSpec.type)
+    {
+        case TypeSpec::Int:
+            switch (destSpec.elsize)
+            {
+                case 1: return &convertPlyProperty<SrcT, int8_t,  false>;
+                case 2: return &convertPlyProperty<SrcT, int16_t, false>;
+                case 4: return &convertPlyProperty<SrcT, int32_t, false>;
+            }
+            break;
+        case TypeSpec::Uint:
+            switch (destSpec.elsize)
+            {
+                case 1: return &convertPlyProperty<SrcT, uint8_t,  false>;
+                case 2: return &convertPlyProperty<SrcT, uint16_t, false>;
+                case 4: return &convertPlyProperty<SrcT, uint32_t, false>;
+            }
+            break;
+        case TypeSpec::Float:
+            switch (destSpec.elsize)
+            {
+                case 4: return &convertPlyProperty<SrcT, float,  false>;
+                case 8: return &convertPlyProperty<SrcT, double, false>;
+            }
+            break;
+        default:
+            break;
+    }
+    return nullptr;
+}
+
+
+/// Get converter from ply type `plyType` to the type of field `destSpec`, or
+/// null if there's no suitable conversion
+static PlyPropertyConverter plyPropertyConverter(e_ply_type plyType,
+                                                 const TypeSpec& destSpec,
+                                                 bool isPosition)
+{
+    switch (plyType)
+    {
+        case PLY_INT8:    case PLY_CHAR:   return plyPropertyConverter<int8_t>  (destSpec, isPosition);
+        case PLY_INT16:   case PLY_SHORT:  return plyPropertyConverter<int16_t> (destSpec, isPosition);
+        case PLY_INT32:   case PLY_INT:    return plyPropertyConverter<int32_t> (destSpec, isPosition);
+        case PLY_UINT8:   case PLY_UCHAR:  return plyPropertyConverter<uint8_t> (destSpec, isPosition);
+        case PLY_UINT16:  case PLY_USHORT: return plyPropertyConverter<uint16_t>(destSpec, isPosition);
+        case PLY_UIN32:   case PLY_UINT:   return plyPropertyConverter<uint32_t>(destSpec, isPosition);
+        case PLY_FLOAT32: case PLY_FLOAT:  return plyPropertyConverter<float>   (destSpec, isPosition);
+        case PLY_FLOAT64: case PLY_DOUBLE: return plyPropertyConverter<double>  (destSpec, isPosition);
+        default: return nullptr;
+    }
+}
+
+
+/// Step in the plan for copying a ply property into a field component
+struct PlyPropertyCopy
+{
+    size_t srcOffset;               ///< Byte offset of property in ply record
+    GeomField* field;               ///< Destination field
+    int componentIndex;             ///< Destination component in field
+    e_ply_type plyType;
+    PlyPropertyConverter convert;
+};
+
+
 //------------------------------------------------------------------------------
 // Utilities for loading point fields from the "vertex" element
 
@@ -229,20 +482,109 @@ bool displazFieldComparison(const PlyPointField& a, const PlyPointField& b)
 }
 
 
+/// Load "vertex" element properties directly from a memory map of a binary
+/// ply file, bypassing rply.
+///
+/// `copyPlan` gives the destination of each property to be loaded.  Return
+/// false if this isn't possible for the given file.
+static bool loadPlyVertexMapped(const QString& fileName, p_ply ply,
+                                p_ply_element vertexElement,
+                                std::vector<PlyPropertyCopy>& copyPlan,
+                                const PointDecimator& decimator, V3d& offset)
+{
+    size_t npoints = decimator.outputCount();
+    PlyDataMap dataMap;
+    if (!dataMap.map(fileName, ply))
+        return false;
+    size_t recordSize = 0;
+    const uchar* data = dataMap.elementData(vertexElement, recordSize);
+    if (!data)
+        return false;
+    bool swapBytes = dataMap.swapBytes();
+    // Position offset is the position of the first point
+    offset = V3d(0);
+    for (PlyPropertyCopy& copy : copyPlan)
+    {
+        if (!copy.convert)
+            return false;
+        if (copy.field->name == "position" && npoints > 0)
+        {
+            double value = 0;
+            PlyPropertyConverter toDouble = plyPropertyConverter(copy.plyType,
+                                                TypeSpec(TypeSpec::Float, 8), false);
+            toDouble(data + decimator.inputIndex(0)*recordSize + copy.srcOffset,
+                     recordSize, (char*)&value, 0, 1, swapBytes, 0);
+            offset[copy.componentIndex] = value;
+        }
+    }
+    // Run the plan over blocks of points, so that each block of source data
+    // is read from memory once and stays in cache while each property is
+    // copied out.  When decimating, the records to be kept are first gathered
+    // into a contiguous block.
+    const size_t blockSize = 4096;
+    parallelFor(0, npoints, 16*blockSize, [&](size_t begin, size_t end)
+    {
+        std::vector<uchar> gathered;
+        if (decimator.factor() > 1)
+            gathered.resize(blockSize*recordSize);
+        for (size_t b = begin; b < end; b += blockSize)
+        {
+            size_t n = std::min(end, b + blockSize) - b;
+            const uchar* block = data + b*recordSize;
+            if (decimator.factor() > 1)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    memcpy(&gathered[i*recordSize],
+                           data + decimator.inputIndex(b + i)*recordSize, recordSize);
+                }
+                block = gathered.data();
+            }
+            for (const PlyPropertyCopy& copy : copyPlan)
+            {
+                const TypeSpec& spec = copy.field->spec;
+                size_t destStride = spec.size();
+                char* dest = copy.field->data.get() + b*destStride +
+                             copy.componentIndex*spec.elsize;
+                copy.convert(block + copy.srcOffset, recordSize, dest,
+                             destStride, n, swapBytes, offset[copy.componentIndex]);
+            }
+        }
+    });
+    return true;
+}
+
+
 bool loadPlyVertexProperties(QString fileName, p_ply ply, p_ply_element vertexElement,
-                             std::vector<GeomField>& fields, V3d& offset,
-                             size_t npoints)
+                             const PointDecimator& decimator,
+                             std::vector<GeomField>& fields, V3d& offset)
 {
+    size_t npoints = decimator.outputCount();
     // Create displaz GeomField for each property of the "vertex" element
     std::vector<PlyPointField> fieldInfo = parsePlyPointFields(vertexElement);
     std::sort(fieldInfo.begin(), fieldInfo.end(), &displazFieldComparison);
+    // Byte offset of each property within a binary vertex record
+    std::map<std::string, size_t> propOffsets;
+    size_t propOffset = 0;
+    for (p_ply_property prop = ply_get_next_property(vertexElement, NULL);
+         prop != NULL; prop = ply_get_next_property(vertexElement, prop))
+    {
+        const char* propName = 0;
+        e_ply_type propType;
+        ply_get_property_info(prop, &propName, &propType, NULL, NULL);
+        propOffsets[propName] = propOffset;
+        if (propType != PLY_LIST)
+            propOffset += plyTypeSize(propType);
+    }
     std::vector<PlyFieldLoader> fieldLoaders;
     // Hack: use reserve to avoid iterator invalidation in push_back()
-    fields.reserve(fieldInfo.size());
-    fieldLoaders.reserve(fieldInfo.size());
+    fields.reserve(fieldInfo.size() + 1);
+    fieldLoaders.reserve(fieldInfo.size() + 1);
+    // Plan for copying each property when reading the binary data directly
+    std::vector<PlyPropertyCopy> copyPlan;
     // Always add position field
     fields.push_back(GeomField(TypeSpec::vec3float32(), "position", npoints));
-    fieldLoaders.push_back(PlyFieldLoader(fields[0]));
+    fieldLoaders.push_back(PlyFieldLoader(fields[0], decimator));
     bool hasPosition = false;
     // Add all other fields, and connect fields to rply callbacks
     for (size_t i = 0; i < fieldInfo.size(); )
@@ -263,24 +605,32 @@ bool loadPlyVertexProperties(QString fileName, p_ply ply, p_ply_element vertexEl
         }
         size_t eltEnd = i;
         PlyFieldLoader* loader = 0;
+        GeomField* field = 0;
         if (fieldName == "position")
         {
             hasPosition = true;
             loader = &fieldLoaders[0];
+            field = &fields[0];
         }
         else
         {
             TypeSpec type(baseType, elsize, maxComponentIndex+1, semantics);
             //tfm::printf("%s: type %s\n", fieldName, type);
             fields.push_back(GeomField(type, fieldName, npoints));
-            fieldLoaders.push_back(PlyFieldLoader(fields.back()));
+            fieldLoaders.push_back(PlyFieldLoader(fields.back(), decimator));
             loader = &fieldLoaders.back();
+            field = &fields.back();
         }
         for (size_t j = eltBegin; j < eltEnd; ++j)
         {
             ply_set_read_cb(ply, "vertex", fieldInfo[j].plyName.c_str(),
                             &PlyFieldLoader::rplyCallback,
                             loader, fieldInfo[j].componentIndex);
+            PlyPropertyCopy copy = {propOffsets[fieldInfo[j].plyName], field,
+                                    fieldInfo[j].componentIndex, fieldInfo[j].plyType,
+                                    plyPropertyConverter(fieldInfo[j].plyType, field->spec,
+                                                         field == &fields[0])};
+            copyPlan.push_back(copy);
         }
     }
     if (!hasPosition)
@@ -289,6 +639,10 @@ bool loadPlyVertexProperties(QString fileName, p_ply ply, p_ply_element vertexEl
         return false;
     }
 
+    // Binary files can be read directly using the copy plan
+    if (loadPlyVertexMapped(fileName, ply, vertexElement, copyPlan, decimator, offset))
+        return true;
+
     // All setup is done; read ply file using the callbacks
     if (!ply_read(ply))
         return false;
@@ -335,13 +689,146 @@ bool findVertexElements(std::vector<p_ply_element>& vertexElements,
 }
 
 
-bool loadDisplazNativePly(QString fileName, p_ply ply,
+/// Convert position data of vectors of type T from ply data `src` into float
+/// positions relative to the first point, which is returned as `offset`.
+template<typename T>
+static void convertNativePlyPosition(float* dest, const uchar* src,
+                                     const PointDecimator& decimator,
+                                     bool swapBytes, V3d& offset)
+{
+    offset = V3d(0);
+    size_t npoints = decimator.outputCount();
+    if (npoints == 0)
+        return;
+    const size_t recordSize = 3*sizeof(T);
+    // Remove fixed offset using first value read.
+    const uchar* first = src + decimator.inputIndex(0)*recordSize;
+    for (int c = 0; c < 3; ++c)
+        offset[c] = readPlyValue<T>(first + c*sizeof(T), swapBytes);
+    const double off[3] = {offset.x, offset.y, offset.z};
+    parallelFor(0, npoints, 64*1024, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const uchar* s = src + decimator.inputIndex(i)*recordSize;
+            dest[3*i]   = (float)(readPlyValue<T>(s, swapBytes)               - off[0]);
+            dest[3*i+1] = (float)(readPlyValue<T>(s + sizeof(T), swapBytes)   - off[1]);
+            dest[3*i+2] = (float)(readPlyValue<T>(s + 2*sizeof(T), swapBytes) - off[2]);
+        }
+    });
+}
+
+
+/// Load data for displaz-native ply fields directly from a memory map of the
+/// file, bypassing rply.
+///
+/// `fields[i]` must have been set up from the ply element `vertexElements[i]`.
+/// Return false if this isn't possible for the given file, in which case the
+/// fields are untouched except possibly for the data of the first few.
+static bool loadNativePlyMapped(const QString& fileName, p_ply ply,
+                                const std::vector<p_ply_element>& vertexElements,
+                                const PointDecimator& decimator,
+                                std::vector<GeomField>& fields, V3d& offset)
+{
+    PlyDataMap dataMap;
+    if (!dataMap.map(fileName, ply))
+        return false;
+    // Check all properties of each element have the same type, so elements
+    // can be copied as blocks
+    std::vector<e_ply_type> elemTypes;
+    std::vector<const uchar*> elemData;
+    for (size_t i = 0; i < vertexElements.size(); ++i)
+    {
+        size_t recordSize = 0;
+        const uchar* data = dataMap.elementData(vertexElements[i], recordSize);
+        if (!data)
+            return false;
+        e_ply_type elemType = PLY_LIST;
+        for (p_ply_property prop = ply_get_next_property(vertexElements[i], NULL);
+             prop != NULL; prop = ply_get_next_property(vertexElements[i], prop))
+        {
+            e_ply_type propType;
+            ply_get_property_info(prop, NULL, &propType, NULL, NULL);
+            if (elemType == PLY_LIST)
+                elemType = propType;
+            TypeSpec::Type t1, t2;
+            int s1 = 0, s2 = 0;
+            plyTypeToPointFieldType(elemType, t1, s1);
+            plyTypeToPointFieldType(propType, t2, s2);
+            if (t1 != t2 || s1 != s2)
+                return false;
+        }
+        const GeomField& field = fields[i];
+        if (field.name != "position" &&
+            recordSize != (size_t)field.spec.size())
+            return false;
+        elemTypes.push_back(elemType);
+        elemData.push_back(data);
+    }
+    bool swapBytes = dataMap.swapBytes();
+    for (size_t i = 0; i < fields.size(); ++i)
+    {
+        GeomField& field = fields[i];
+        if (field.name == "position")
+        {
+            float* dest = field.as<float>();
+            const uchar* src = elemData[i];
+            switch (elemTypes[i])
+            {
+                case PLY_INT8:    case PLY_CHAR:   convertNativePlyPosition<int8_t>  (dest, src, decimator, swapBytes, offset); break;
+                case PLY_INT16:   case PLY_SHORT:  convertNativePlyPosition<int16_t> (dest, src, decimator, swapBytes, offset); break;
+                case PLY_INT32:   case PLY_INT:    convertNativePlyPosition<int32_t> (dest, src, decimator, swapBytes, offset); break;
+                case PLY_UINT8:   case PLY_UCHAR:  convertNativePlyPosition<uint8_t> (dest, src, decimator, swapBytes, offset); break;
+                case PLY_UINT16:  case PLY_USHORT: convertNativePlyPosition<uint16_t>(dest, src, decimator, swapBytes, offset); break;
+                case PLY_UIN32:   case PLY_UINT:   convertNativePlyPosition<uint32_t>(dest, src, decimator, swapBytes, offset); break;
+                case PLY_FLOAT32: case PLY_FLOAT:  convertNativePlyPosition<float>   (dest, src, decimator, swapBytes, offset); break;
+                case PLY_FLOAT64: case PLY_DOUBLE: convertNativePlyPosition<double>  (dest, src, decimator, swapBytes, offset); break;
+                default: return false;
+            }
+            continue;
+        }
+        // Other fields have the same type in memory as in the file
+        size_t recordSize = field.spec.size();
+        int elsize = field.spec.elsize;
+        char* dest = field.data.get();
+        const uchar* src = elemData[i];
+        parallelFor(0, field.size, 64*1024, [&](size_t begin, size_t end)
+        {
+            if (decimator.factor() == 1)
+            {
+                memcpy(dest + begin*recordSize, src + begin*recordSize,
+                       (end - begin)*recordSize);
+            }
+            else
+            {
+                for (size_t j = begin; j < end; ++j)
+                {
+                    memcpy(dest + j*recordSize,
+                           src + decimator.inputIndex(j)*recordSize, recordSize);
+                }
+            }
+            if (swapBytes && elsize > 1)
+            {
+                for (size_t j = begin*recordSize; j < end*recordSize; j += elsize)
+                    std::reverse(dest + j, dest + j + elsize);
+            }
+        });
+    }
+    return true;
+}
+
+
+bool loadDisplazNativePly(QString fileName, p_ply ply, size_t maxPointCount,
                           std::vector<GeomField>& fields, V3d& offset,
-                          size_t& npoints)
+                          size_t& npoints, uint64_t& totalPoints)
 {
     std::vector<p_ply_element> vertexElements;
-    if (!findVertexElements(vertexElements, ply, npoints))
+    size_t numVertices = 0;
+    if (!findVertexElements(vertexElements, ply, numVertices))
         return false;
+    totalPoints = numVertices;
+    PointDecimator decimator(totalPoints, maxPointCount);
+    npoints = decimator.outputCount();
 
     // Map each vertex element to the associated displaz type
     std::vector<PlyFieldLoader> fieldLoaders;
@@ -404,7 +891,7 @@ bool loadDisplazNativePly(QString fileName, p_ply ply,
         // Create loader callback object
         TypeSpec type(baseType, elsize, numProps, semantics);
         fields.push_back(GeomField(type, fieldName, npoints));
-        fieldLoaders.push_back(PlyFieldLoader(fields.back()));
+        fieldLoaders.push_back(PlyFieldLoader(fields.back(), decimator));
         // Connect callbacks for each property
         int propIdx = 0;
         for (p_ply_property prop = ply_get_next_property(*elem, NULL);
@@ -420,6 +907,10 @@ bool loadDisplazNativePly(QString fileName, p_ply ply,
         g_logger.info("%s: %s %s", fileName, type, fieldName);
     }
 
+    // Binary files can be copied directly into the fields
+    if (loadNativePlyMapped(fileName, ply, vertexElements, decimator, fields, offset))
+        return true;
+
     // All setup is done; read ply file using the callbacks
     if (!ply_read(ply))
     {
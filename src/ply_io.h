@@ -40,9 +40,13 @@ p_ply_element findVertexElement(p_ply ply, size_t& npoints);
 ///   propx, propy, propz     -> 3-element vector per point with name "prop"
 ///   prop_x, prop_y, prop_z  -> 3-element vector per point with name "prop"
 ///
+/// Binary files are read directly from a memory map of the file where
+/// possible, using a precomputed conversion for each property.
+///
+/// Only the vertices selected by `decimator` are loaded.
 bool loadPlyVertexProperties(QString fileName, p_ply ply, p_ply_element vertexElement,
-                             std::vector<GeomField>& fields, V3d& offset,
-                             size_t npoints);
+                             const PointDecimator& decimator,
+                             std::vector<GeomField>& fields, V3d& offset);
 
 /// Load native displaz ply format
 ///
@@ -73,16 +77,20 @@ bool loadPlyVertexProperties(QString fileName, p_ply ply, p_ply_element vertexEl
 ///   color uint8_t[3] mycolor
 ///   array float[2] myarray
 ///
+/// Binary files are read directly from a memory map of the file where
+/// possible, with each element copied as a block into the associated field.
 ///
 /// Parameters:
 ///   fileName - ply file name
 ///   ply - open ply file
+///   maxPointCount - points are decimated to keep at most this many
 ///   fields - returned point fields.
 ///   offset - offset to be applied to position field
-///   npoints - total number of points
-bool loadDisplazNativePly(QString fileName, p_ply ply,
+///   npoints - number of points loaded
+///   totalPoints - total number of points in the file
+bool loadDisplazNativePly(QString fileName, p_ply ply, size_t maxPointCount,
                           std::vector<GeomField>& fields, V3d& offset,
-                          size_t& npoints);
+                          size_t& npoints, uint64_t& totalPoints);
 
 
 /// Logging callback, logging all rply errors to g_logger
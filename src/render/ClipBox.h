@@ -3,8 +3,7 @@
 
 #pragma once
 
-#include <algorithm>
-
+#include "frustumcull.h"
 #include "glutil.h"
 
 //------------------------------------------------------------------------------
@@ -36,46 +35,35 @@ class ClipBox
             const V3f c2 = V3f(mvp[0][1], mvp[1][1], mvp[2][1]); const float d2 = mvp[3][1];
             const V3f c3 = V3f(mvp[0][2], mvp[1][2], mvp[2][2]); const float d3 = mvp[3][2];
             const V3f c4 = V3f(mvp[0][3], mvp[1][3], mvp[2][3]); const float d4 = mvp[3][3];
-            normal[0] = c4 + c1;  distance[0] = d4 + d1;
-            normal[1] = c4 - c1;  distance[1] = d4 - d1;
-            normal[2] = c4 + c2;  distance[2] = d4 + d2;
-            normal[3] = c4 - c2;  distance[3] = d4 - d2;
-            normal[4] = c4 + c3;  distance[4] = d4 + d3;
-            normal[5] = c4 - c3;  distance[5] = d4 - d3;
+            m_planes.setPlane(0, c4 + c1, d4 + d1);
+            m_planes.setPlane(1, c4 - c1, d4 - d1);
+            m_planes.setPlane(2, c4 + c2, d4 + d2);
+            m_planes.setPlane(3, c4 - c2, d4 - d2);
+            m_planes.setPlane(4, c4 + c3, d4 + d3);
+            m_planes.setPlane(5, c4 - c3, d4 - d3);
         }
 
         /// Determine whether `box` lies entirely outside the clipping volume
         /// and can therefore be discarded
+        ///
+        /// A box is culled if it's entirely outside any single clipping
+        /// plane.  This underestimates possible culling for some corner
+        /// cases, but is far simpler than the alternatives.
         bool canCull(const Imath::Box3f& box) const
         {
-            // Box corners
-            const V3f points[8] = {
-                V3f(box.min.x, box.min.y, box.min.z),
-                V3f(box.min.x, box.max.y, box.min.z),
-                V3f(box.max.x, box.max.y, box.min.z),
-                V3f(box.max.x, box.min.y, box.min.z),
-                V3f(box.min.x, box.min.y, box.max.z),
-                V3f(box.min.x, box.max.y, box.max.z),
-                V3f(box.max.x, box.max.y, box.max.z),
-                V3f(box.max.x, box.min.y, box.max.z),
-            };
+            return classifyBox(m_planes, box) == Cull_Outside;
+        }
 
-            // We can cull if all box vertices are outside any clipping plane.
-            // This underestimates possible culling for some corner cases,
-            // but is far simpler than the alternatives.
-            for (int j = 0; j < 6; ++j)
-            {
-                if (std::all_of(std::begin(points), std::end(points), [&](const auto& p)
-                    { return normal[j].dot(p) + distance[j] < 0.0; }))
-                {
-                    return true;
-                }
-            }
-            return false;
+        /// Classify `box` as outside, intersecting or inside the clipping
+        /// volume.  Children of a box which is inside need not be tested.
+        CullResult classify(const Imath::Box3f& box) const
+        {
+            return classifyBox(m_planes, box);
         }
 
+        /// Clipping planes, for classifying many boxes with classifyBoxes()
+        const FrustumPlanes& planes() const { return m_planes; }
+
     private:
-        // Plane equation coeffs:  normal[j].dot(v) + distance[j] == 0
-        Imath::V3f normal[6];
-        float distance[6];
+        FrustumPlanes m_planes;
 };
@@ -0,0 +1,35 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#ifndef DISPLAZ_DRAWCOUNT_H_INCLUDED
+#define DISPLAZ_DRAWCOUNT_H_INCLUDED
+
+/// Estimate of amount of geometry drawn in a frame
+///
+/// `numVertices` is the number of vertices
+/// `numDrawCalls` is the number of separately drawn pieces of geometry
+/// `uploadBytes` is the amount of vertex data sent to the GPU
+/// `moreToDraw` indicates whether the geometry is completely drawn
+struct DrawCount
+{
+    double numVertices;
+    double numDrawCalls;
+    double uploadBytes;
+    bool   moreToDraw;
+
+    DrawCount()
+        : numVertices(0), numDrawCalls(0), uploadBytes(0), moreToDraw(false)
+    { }
+
+    DrawCount& operator+=(const DrawCount& rhs)
+    {
+        numVertices += rhs.numVertices;
+        numDrawCalls += rhs.numDrawCalls;
+        uploadBytes += rhs.uploadBytes;
+        moreToDraw |= rhs.moreToDraw;
+        return *this;
+    }
+};
+
+
+#endif // DISPLAZ_DRAWCOUNT_H_INCLUDED
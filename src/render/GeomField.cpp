@@ -3,10 +3,13 @@
 
 #include "GeomField.h"
 
+#include <algorithm>
 #include <cstdint>
 
 #include <tinyformat.h>
 
+#include "parallel.h"
+
 
 void GeomField::format(std::ostream& out, size_t index) const
 {
@@ -84,43 +87,115 @@ void doReorder(char* dest, const char* src, const size_t* inds, size_t size, int
 }
 
 
-void reorder(GeomField& field, const size_t* inds, size_t indsSize)
+/// Gather `size` elements of size `typeSize` bytes, `dest[i] = src[inds[i]]`
+static void gatherElements(char* dest, const char* src, int typeSize,
+                           const size_t* inds, size_t size)
 {
-    size_t size = field.size;
-    if (size == 1)
-        return;
-    assert(size == indsSize);
-    int typeSize = field.spec.size();
-    std::unique_ptr<char[]> newData(new char[size*typeSize]);
-    const char* prevData = field.data.get();
     // Various options to do the reordering in larger chunks than a single byte at a time.
     switch (typeSize)
     {
-        case 1:  doReorder<uint8_t,  1>(newData.get(), prevData, inds, size); break;
-        case 2:  doReorder<uint16_t, 1>(newData.get(), prevData, inds, size); break;
-        case 3:  doReorder<uint8_t,  3>(newData.get(), prevData, inds, size); break;
-        case 4:  doReorder<uint32_t, 1>(newData.get(), prevData, inds, size); break;
-        case 6:  doReorder<uint16_t, 3>(newData.get(), prevData, inds, size); break;
-        case 8:  doReorder<uint64_t, 1>(newData.get(), prevData, inds, size); break;
-        case 12: doReorder<uint32_t, 3>(newData.get(), prevData, inds, size); break;
+        case 1:  doReorder<uint8_t,  1>(dest, src, inds, size); break;
+        case 2:  doReorder<uint16_t, 1>(dest, src, inds, size); break;
+        case 3:  doReorder<uint8_t,  3>(dest, src, inds, size); break;
+        case 4:  doReorder<uint32_t, 1>(dest, src, inds, size); break;
+        case 6:  doReorder<uint16_t, 3>(dest, src, inds, size); break;
+        case 8:  doReorder<uint64_t, 1>(dest, src, inds, size); break;
+        case 12: doReorder<uint32_t, 3>(dest, src, inds, size); break;
         default:
             switch (typeSize % 8)
             {
                 case 0:
-                    doReorder<uint64_t>(newData.get(), prevData, inds, size, typeSize/8);
+                    doReorder<uint64_t>(dest, src, inds, size, typeSize/8);
                     break;
                 case 4:
-                    doReorder<uint32_t>(newData.get(), prevData, inds, size, typeSize/4);
+                    doReorder<uint32_t>(dest, src, inds, size, typeSize/4);
                     break;
                 case 2: case 6:
-                    doReorder<uint16_t>(newData.get(), prevData, inds, size, typeSize/2);
+                    doReorder<uint16_t>(dest, src, inds, size, typeSize/2);
                     break;
                 default:
-                    doReorder<uint8_t>(newData.get(),  prevData, inds, size, typeSize);
+                    doReorder<uint8_t>(dest,  src, inds, size, typeSize);
                     break;
             }
     }
+}
+
+
+void reorder(GeomField& field, const size_t* inds, size_t indsSize)
+{
+    size_t size = field.size;
+    if (size == 1)
+        return;
+    assert(size == indsSize);
+    int typeSize = field.spec.size();
+    GeomField::Storage newData(new char[size*typeSize]);
+    gatherElements(newData.get(), field.data.get(), typeSize, inds, size);
     field.data.swap(newData);
 }
 
 
+void reorder(std::vector<GeomField>& fields, const size_t* inds, size_t indsSize,
+             const std::function<void(double)>& progress)
+{
+    std::vector<GeomField*> toReorder;
+    size_t maxFieldBytes = 0;
+    size_t totalBytes = 0;
+    for (GeomField& field : fields)
+    {
+        if (field.size == 1)
+            continue;
+        assert(field.size == indsSize);
+        toReorder.push_back(&field);
+        maxFieldBytes = std::max(maxFieldBytes, field.size*field.spec.size());
+        totalBytes += field.size*field.spec.size();
+    }
+    // Group fields into batches.  Each batch is reordered in a single pass,
+    // with the temporary storage for the batch no larger than the largest
+    // field (the peak memory overhead of reordering fields one at a time).
+    std::stable_sort(toReorder.begin(), toReorder.end(),
+                     [](const GeomField* a, const GeomField* b)
+                     { return a->spec.size() > b->spec.size(); });
+    size_t doneBytes = 0;
+    for (size_t batchBegin = 0; batchBegin < toReorder.size(); )
+    {
+        size_t batchEnd = batchBegin;
+        size_t batchBytes = 0;
+        while (batchEnd < toReorder.size())
+        {
+            size_t bytes = toReorder[batchEnd]->size*toReorder[batchEnd]->spec.size();
+            if (batchEnd > batchBegin && batchBytes + bytes > maxFieldBytes)
+                break;
+            batchBytes += bytes;
+            ++batchEnd;
+        }
+        std::vector<GeomField::Storage> newData;
+        for (size_t f = batchBegin; f < batchEnd; ++f)
+            newData.emplace_back(new char[toReorder[f]->size*toReorder[f]->spec.size()]);
+        // Gather in blocks of destination points: within a block, each
+        // field is written sequentially while the block of indices stays in
+        // cache for the next field.
+        const size_t blockSize = 16*1024;
+        parallelFor(0, indsSize, blockSize, [&](size_t chunkBegin, size_t chunkEnd)
+        {
+            for (size_t b = chunkBegin; b < chunkEnd; b += blockSize)
+            {
+                size_t e = std::min(chunkEnd, b + blockSize);
+                for (size_t f = batchBegin; f < batchEnd; ++f)
+                {
+                    const GeomField& field = *toReorder[f];
+                    int typeSize = field.spec.size();
+                    gatherElements(newData[f - batchBegin].get() + b*typeSize,
+                                   field.data.get(), typeSize, inds + b, e - b);
+                }
+            }
+        });
+        for (size_t f = batchBegin; f < batchEnd; ++f)
+            toReorder[f]->data.swap(newData[f - batchBegin]);
+        doneBytes += batchBytes;
+        if (progress)
+            progress(double(doneBytes)/totalBytes);
+        batchBegin = batchEnd;
+    }
+}
+
+
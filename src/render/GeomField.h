@@ -6,9 +6,20 @@
 
 #include "typespec.h"
 
+#include <functional>
+#include <memory>
 #include <numeric>
+#include <vector>
 
 //------------------------------------------------------------------------------
+/// Deleter for GeomField storage, which frees it only if owned by the field
+struct GeomFieldDeleter
+{
+    bool owned = true;
+    void operator()(char* p) const { if (owned) delete[] p; }
+};
+
+
 /// Storage array for scalar and vector fields on a geometry
 ///
 /// The data is stored as a packed contiguous array of the base type, with each
@@ -21,12 +32,16 @@
 ///   "numberOfReturns" - Total number of returns in pulse
 ///   "pointSourceId"   - Identifier for source of aquisition
 ///   "classification"  - Object type and other data
+/// Storage is usually owned by the field, but may also be a view of memory
+/// managed elsewhere, such as a memory mapped cache file.
 ///
 struct GeomField
 {
+    typedef std::unique_ptr<char[], GeomFieldDeleter> Storage;
+
     TypeSpec spec;                /// Field type
     std::string name;             /// Name of the field
-    std::unique_ptr<char[]> data; /// Storage array for values in the point field
+    Storage data;                 /// Storage array for values in the point field
     size_t size;                  /// Number of elements in array
 
     GeomField(const TypeSpec& spec, const std::string& name, size_t size)
@@ -36,6 +51,16 @@ struct GeomField
         size(size)
     { }
 
+    /// Construct field as a view of `size` elements of external storage at
+    /// `externalData`, which must outlive the field.
+    GeomField(const TypeSpec& spec, const std::string& name, size_t size,
+              char* externalData)
+        : spec(spec),
+        name(name),
+        data(externalData, GeomFieldDeleter{false}),
+        size(size)
+    { }
+
     /// Get pointer to the underlying data as array of the base spec
     template<typename T>
     T* as()
@@ -65,7 +90,7 @@ struct GeomField
     // Horrible hack: explicitly implement move constructor.  Required to
     // appease MSVC 2012 (broken move semantics for unique_ptr?)
     GeomField(GeomField&& f)
-        : spec(f.spec), name(f.name), data(f.data.release()), size(f.size)
+        : spec(f.spec), name(f.name), data(std::move(f.data)), size(f.size)
     { }
 };
 
@@ -78,6 +103,15 @@ T bytes(InputIt first, InputIt last)
 /// Reorder point field data according to the given indexing array
 void reorder(GeomField& field, const size_t* inds, size_t indsSize);
 
+/// Reorder all point fields according to the given indexing array
+///
+/// This is equivalent to calling reorder() on each field, but is done in
+/// parallel, with several fields gathered in a single pass over the indexing
+/// array.  Temporary memory use is bounded by the size of the largest field.
+/// `progress` is called with the fraction of the work done after each pass.
+void reorder(std::vector<GeomField>& fields, const size_t* inds, size_t indsSize,
+             const std::function<void(double)>& progress = nullptr);
+
 
 std::ostream& operator<<(std::ostream& out, const GeomField& field);
 
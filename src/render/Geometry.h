@@ -13,6 +13,7 @@
 #include <QString>
 #include <QMetaType>
 
+#include "DrawCount.h"
 #include "GeometryMutator.h"
 
 class ShaderProgram;
@@ -20,26 +21,6 @@ class QOpenGLShaderProgram;
 struct TransformState;
 
 
-/// Estimate of amount of geometry drawn in a frame
-///
-/// `numVertices` is the number of vertices
-/// `moreToDraw` indicates whether the geometry is completely drawn
-struct DrawCount
-{
-    double numVertices;
-    bool   moreToDraw;
-
-    DrawCount() : numVertices(0), moreToDraw(false) { }
-
-    DrawCount& operator+=(const DrawCount& rhs)
-    {
-        numVertices += rhs.numVertices;
-        moreToDraw |= rhs.moreToDraw;
-        return *this;
-    }
-};
-
-
 /// Shared interface for all displaz geometry types
 class Geometry : public QObject
 {
@@ -172,6 +153,9 @@ class Geometry : public QObject
         void loadStepStarted(QString stepDescription);
         /// Emitted as progress is made loading points
         void loadProgress(int percentLoaded);
+        /// Emitted, possibly from another thread, when data loaded in the
+        /// background is ready to be drawn
+        void redrawRequested();
 
     protected:
         void setFileName(const QString& fileName) { m_fileName = fileName; }
@@ -0,0 +1,79 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include "GpuFrameTimer.h"
+
+#include <algorithm>
+
+
+void GpuFrameTimer::init(int numQueries)
+{
+    destroy();
+    if (!GLEW_VERSION_3_3 && !GLEW_ARB_timer_query)
+        return;
+    std::vector<GLuint> queries(numQueries);
+    glGenQueries(numQueries, queries.data());
+    for (GLuint query : queries)
+    {
+        Slot slot = {query, false, Sample()};
+        m_slots.push_back(slot);
+    }
+}
+
+
+void GpuFrameTimer::destroy()
+{
+    for (const Slot& slot : m_slots)
+        glDeleteQueries(1, &slot.query);
+    m_slots.clear();
+    m_oldest = 0;
+    m_next = 0;
+    m_timing = false;
+}
+
+
+void GpuFrameTimer::beginFrame()
+{
+    assert(!m_timing);
+    if (m_slots.empty() || m_slots[m_next].pending)
+        return;
+    glBeginQuery(GL_TIME_ELAPSED, m_slots[m_next].query);
+    m_timing = true;
+}
+
+
+void GpuFrameTimer::endFrame(const DrawCount& drawCount, unsigned int shaderKey,
+                             double cpuMillisecs)
+{
+    if (!m_timing)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    Slot& slot = m_slots[m_next];
+    slot.pending = true;
+    slot.sample.drawCount = drawCount;
+    slot.sample.shaderKey = shaderKey;
+    slot.sample.frameMillisecs = cpuMillisecs;
+    m_next = (m_next + 1) % m_slots.size();
+    m_timing = false;
+}
+
+
+void GpuFrameTimer::collectSamples(std::vector<Sample>& samples)
+{
+    // Queries complete in order, so stop at the first one still in flight
+    while (!m_slots.empty() && m_slots[m_oldest].pending)
+    {
+        Slot& slot = m_slots[m_oldest];
+        GLint available = 0;
+        glGetQueryObjectiv(slot.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        GLuint64 gpuNanosecs = 0;
+        glGetQueryObjectui64v(slot.query, GL_QUERY_RESULT, &gpuNanosecs);
+        Sample sample = slot.sample;
+        sample.frameMillisecs = std::max(sample.frameMillisecs, 1e-6*gpuNanosecs);
+        samples.push_back(sample);
+        slot.pending = false;
+        m_oldest = (m_oldest + 1) % m_slots.size();
+    }
+}
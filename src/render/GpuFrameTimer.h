@@ -0,0 +1,74 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#ifndef DISPLAZ_GPUFRAMETIMER_H_INCLUDED
+#define DISPLAZ_GPUFRAMETIMER_H_INCLUDED
+
+#include <vector>
+
+#include "glutil.h"
+#include "DrawCount.h"
+
+//------------------------------------------------------------------------------
+/// Asynchronous frame time measurement with OpenGL timer queries
+///
+/// Measuring frame time on the CPU requires glFinish() to wait for the GPU,
+/// which stalls the pipeline every frame.  Instead, the GPU time of each
+/// frame is recorded with a GL_TIME_ELAPSED query and read back without
+/// blocking a frame or two later, from a small ring of query objects.  The
+/// frame time of a sample is the larger of the CPU time spent issuing the
+/// frame and the GPU time spent executing it, since whichever is larger
+/// limits the frame rate once the two overlap.
+///
+/// If the ring is full of queries which haven't completed, frames aren't
+/// timed until one completes.  Timer queries need OpenGL 3.3 or
+/// ARB_timer_query; check isAvailable() and fall back to glFinish() if not.
+class GpuFrameTimer
+{
+    public:
+        /// Measured frame, with the draw count and shader key passed to
+        /// endFrame()
+        struct Sample
+        {
+            DrawCount drawCount;
+            unsigned int shaderKey;
+            double frameMillisecs;
+        };
+
+        GpuFrameTimer() = default;
+        ~GpuFrameTimer() { destroy(); }
+
+        /// Create query objects.  Requires a current OpenGL context.
+        void init(int numQueries = 4);
+        void destroy();
+
+        bool isAvailable() const { return !m_slots.empty(); }
+
+        /// Start timing GPU commands for a frame
+        void beginFrame();
+
+        /// Finish timing the current frame, which took `cpuMillisecs` to
+        /// issue on the CPU
+        void endFrame(const DrawCount& drawCount, unsigned int shaderKey,
+                      double cpuMillisecs);
+
+        /// Append samples for frames whose queries have completed
+        void collectSamples(std::vector<Sample>& samples);
+
+    private:
+        struct Slot
+        {
+            GLuint query;
+            bool pending;
+            Sample sample;
+        };
+
+        std::vector<Slot> m_slots;
+        /// Slot of the oldest pending query, and of the next query to start
+        size_t m_oldest = 0;
+        size_t m_next = 0;
+        bool m_timing = false;
+};
+
+
+#endif // DISPLAZ_GPUFRAMETIMER_H_INCLUDED
@@ -23,14 +23,26 @@ struct HCloudNode
     NodeIndexData idata;
     bool isLeaf;
 
-    // List of non-empty voxels inside the node
-    std::unique_ptr<float[]> position;
-    std::unique_ptr<float[]> intensity;
-    std::unique_ptr<float[]> coverage;
+    uint64_t lastUsedFrame; ///< Frame in which node was last drawn or descended into
+    double priority;        ///< Angular size of node in lastUsedFrame
+
+    // List of non-empty voxels inside the node.  The arrays point either
+    // into the storage below, or directly into the memory mapped file.
+    const float* position;
+    const float* intensity;
+    const float* coverage;
+    std::unique_ptr<float[]> positionStorage;
+    std::unique_ptr<float[]> intensityStorage;
+    std::unique_ptr<float[]> coverageStorage;
 
     HCloudNode(const Box3f& bbox)
         : bbox(bbox),
-        isLeaf(false)
+        isLeaf(false),
+        lastUsedFrame(0),
+        priority(0),
+        position(nullptr),
+        intensity(nullptr),
+        coverage(nullptr)
     {
         for (int i = 0; i < 8; ++i)
             children[i] = 0;
@@ -42,26 +54,32 @@ struct HCloudNode
             delete children[i];
     }
 
-    bool isCached() const { return position.get() != 0; }
+    bool isCached() const { return position != 0; }
 
     float radius() const { return bbox.max.x - bbox.min.x; }
 
-    /// Allocate arrays for storing point data
-    ///
-    /// (TODO: need some sort of LRU cache)
-    void allocateArrays()
+    /// True if any point data array points into the memory mapped file
+    bool usesMappedData() const
     {
-        position.reset(new float[3*idata.numPoints]);
-        intensity.reset(new float[idata.numPoints]);
-        if (idata.flags == IndexFlags_Voxels)
-            coverage.reset(new float[idata.numPoints]);
+        return (position && !positionStorage) || (intensity && !intensityStorage) ||
+               (coverage && !coverageStorage);
+    }
+
+    /// Size of point data copied into the storage arrays, in bytes.  Arrays
+    /// pointing into the memory mapped file use page cache memory instead.
+    uint64_t storageBytes() const
+    {
+        int floatsPerPoint = (positionStorage ? 3 : 0) + (intensityStorage ? 1 : 0) +
+                             (coverageStorage ? 1 : 0);
+        return uint64_t(floatsPerPoint)*sizeof(float)*idata.numPoints;
     }
 
     void freeArrays()
     {
-        position.reset();
-        intensity.reset();
-        coverage.reset();
+        position = intensity = coverage = nullptr;
+        positionStorage.reset();
+        intensityStorage.reset();
+        coverageStorage.reset();
     }
 };
 
@@ -104,10 +122,20 @@ static HCloudNode* readHCloudIndex(std::istream& in, const Box3f& bbox)
 }
 
 
-HCloudView::HCloudView() : m_sizeBytes(0) { }
+HCloudView::HCloudView()
+    : m_sizeBytes(0),
+    m_frame(0),
+    m_havePrevModelView(false)
+{ }
 
 
-HCloudView::~HCloudView() { }
+HCloudView::~HCloudView()
+{
+    // The fetch threads call back into this object, so must be stopped
+    // before anything else is torn down.
+    if (m_inputCache)
+        m_inputCache->stopFetchThreads();
+}
 
 
 bool HCloudView::loadFile(QString fileName, size_t maxVertexCount)
@@ -120,7 +148,13 @@ bool HCloudView::loadFile(QString fileName, size_t maxVertexCount)
                     m_header.boundingBox.max - m_header.offset);
     m_input.seekg(m_header.indexOffset);
     m_rootNode.reset(readHCloudIndex(m_input, offsetBox));
-    m_inputCache.reset(new StreamPageCache(m_input));
+    // Fetch node data in the background so that draw() never waits on
+    // disk.  Memory mapping lets node arrays point directly at file data.
+    m_inputCache.reset(new StreamPageCache(fileName.toUtf8().constData(), 512*1024,
+                                           StreamPageCache::Access_MemoryMap));
+    const int numFetchThreads = 2;
+    m_inputCache->startFetchThreads(numFetchThreads, [this]() { emit redrawRequested(); });
+    m_inputCache->setMaxBytes(maxPageCacheBytes);
 
 //    fields.push_back(GeomField(TypeSpec::vec3float32(), "position", npoints));
 //    fields.push_back(GeomField(TypeSpec::float32(), "intensity", npoints));
@@ -158,14 +192,13 @@ static void drawBounds(QOpenGLShaderProgram& prog, HCloudNode* node, const Trans
 static bool readNodeData(HCloudNode* node, const HCloudHeader& header,
                          StreamPageCache& inputCache, double priority)
 {
-    node->allocateArrays();
     uint64_t offset = node->idata.dataOffset;
     PageCacheReader reader(inputCache, offset);
     int numPoints = node->idata.numPoints;
-    reader.read(node->position, 3*numPoints);
+    reader.read(node->position, node->positionStorage, 3*numPoints);
     if (node->idata.flags == IndexFlags_Voxels)
-        reader.read(node->coverage, numPoints);
-    reader.read(node->intensity, numPoints);
+        reader.read(node->coverage, node->coverageStorage, numPoints);
+    reader.read(node->intensity, node->intensityStorage, numPoints);
     if (reader.bad())
     {
         inputCache.prefetch(offset, reader.attemptedBytesRead(), priority);
@@ -176,6 +209,15 @@ static bool readNodeData(HCloudNode* node, const HCloudHeader& header,
 }
 
 
+/// Size of the hcloud point data for node, as read by readNodeData()
+static uint64_t nodeDataBytes(const HCloudNode* node)
+{
+    uint64_t numPoints = node->idata.numPoints;
+    uint64_t floatsPerPoint = (node->idata.flags == IndexFlags_Voxels) ? 5 : 4;
+    return floatsPerPoint*numPoints*sizeof(float);
+}
+
+
 void HCloudView::draw(const TransformState& transStateIn, double quality) const
 {
     TransformState transState = transStateIn.translate(offset());
@@ -206,8 +248,13 @@ void HCloudView::draw(const TransformState& transStateIn, double quality) const
     size_t nodesRendered = 0;
     size_t voxelsRendered = 0;
 
-    const size_t fetchQuota = 10;
-    size_t fetchedPages = m_inputCache->fetchNow(fetchQuota);
+    ++m_frame;
+    // Collect before starting the frame, so that newly fetched pages compete
+    // for space as part of the previous frame, rather than displacing the
+    // pages it used.
+    size_t fetchedPages = m_inputCache->collectFetched();
+    m_inputCache->beginFrame();
+    updateCameraMotion(transState.modelViewMatrix);
 
     ClipBox clipBox(transState);
 
@@ -215,7 +262,7 @@ void HCloudView::draw(const TransformState& transStateIn, double quality) const
     const double rootPriority = 1000;
     std::vector<HCloudNode*> nodeStack;
     std::vector<int> levelStack;
-    if (m_rootNode->isCached())
+    if (keepNodeData(m_rootNode.get(), rootPriority))
     {
         levelStack.push_back(0);
         nodeStack.push_back(m_rootNode.get());
@@ -224,7 +271,7 @@ void HCloudView::draw(const TransformState& transStateIn, double quality) const
     {
         nodeStack.push_back(m_rootNode.get());
         levelStack.push_back(0);
-        m_sizeBytes += 5*sizeof(float)*m_rootNode->idata.numPoints;
+        addCachedNode(m_rootNode.get());
     }
     while (!nodeStack.empty())
     {
@@ -237,6 +284,8 @@ void HCloudView::draw(const TransformState& transStateIn, double quality) const
             continue;
 
         double angularSize = node->radius()/(node->bbox.center() - cameraPos).length();
+        node->lastUsedFrame = m_frame;
+        node->priority = angularSize;
         bool drawNode = angularSize < angularSizeLimit || node->isLeaf;
         if (!drawNode)
         {
@@ -245,13 +294,18 @@ void HCloudView::draw(const TransformState& transStateIn, double quality) const
             for (int i = 0; i < 8; ++i)
             {
                 HCloudNode* n = node->children[i];
-                if (n && !n->isCached())
+                if (!n)
+                    continue;
+                if (keepNodeData(n, angularSize))
                 {
-                    if (readNodeData(n, m_header, *m_inputCache, angularSize))
-                        m_sizeBytes += 5*sizeof(float)*node->idata.numPoints;
-                    else
-                        drawNode = true;
+                    ++m_nodeStats.hits;
+                    continue;
                 }
+                ++m_nodeStats.misses;
+                if (readNodeData(n, m_header, *m_inputCache, angularSize))
+                    addCachedNode(n);
+                else
+                    drawNode = true;
             }
         }
         if (drawNode)
@@ -284,7 +338,7 @@ void HCloudView::draw(const TransformState& transStateIn, double quality) const
             else
             {
                 prog.setUniformValue("lodMultiplier", GLfloat(0.5*node->radius()/m_header.brickSize));
-                prog.setAttributeArray("coverage",  node->coverage.get(),  1);
+                prog.setAttributeArray("coverage",  node->coverage,  1);
                 // Draw voxels as billboards (not spheres) when drawing MIP
                 // levels: the point radius represents a screen coverage in
                 // this case, with no sensible interpreation as a radius toward
@@ -295,8 +349,8 @@ void HCloudView::draw(const TransformState& transStateIn, double quality) const
             }
             // Debug - draw octree levels
             // prog.setUniformValue("level", level);
-            prog.setAttributeArray("position",  node->position.get(),  3);
-            prog.setAttributeArray("intensity", node->intensity.get(), 1);
+            prog.setAttributeArray("position",  node->position,  3);
+            prog.setAttributeArray("intensity", node->intensity, 1);
             prog.setAttributeArray("simplifyThreshold", m_simplifyThreshold.data(), 1);
             glDrawArrays(GL_POINTS, 0, nvox);
             if (node->idata.flags == IndexFlags_Points)
@@ -326,9 +380,145 @@ void HCloudView::draw(const TransformState& transStateIn, double quality) const
     glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
     // prog.release();
 
-    g_logger.info("hcloud: %.1fMB, #nodes = %d, fetched pages = %d, mean voxel size = %.0f",
+    // Requests for nodes which are neither needed now nor predicted to be
+    // needed soon are dropped, so a moving camera doesn't leave a backlog
+    // of stale fetches.
+    size_t predictedNodes = prefetchPredicted(transState, angularSizeLimit);
+    size_t cancelledPages = m_inputCache->cancelUnrequested();
+
+    evictNodes();
+
+    const StreamPageCache::Stats& pageStats = m_inputCache->stats();
+    g_logger.info("hcloud: %.1fMB copied node data, #nodes = %d, fetched pages = %d, mean voxel size = %.0f",
                   m_sizeBytes/1e6, nodesRendered, fetchedPages,
                   nodesRendered ? double(voxelsRendered)/nodesRendered : 0.0);
+    g_logger.debug("hcloud cache: %d predicted nodes, %d cancelled pages; "
+                   "nodes %d hits, %d misses, %d evictions; "
+                   "pages %.1fMB, %d hits, %d misses, %d evictions",
+                   predictedNodes, cancelledPages,
+                   m_nodeStats.hits, m_nodeStats.misses, m_nodeStats.evictions,
+                   m_inputCache->cachedBytes()/1e6, pageStats.hits, pageStats.misses,
+                   pageStats.evictions);
+}
+
+
+void HCloudView::updateCameraMotion(const M44d& modelViewMatrix) const
+{
+    // Redraws without camera motion (eg, as fetched data arrives) mean the
+    // camera has stopped.
+    if (m_havePrevModelView && modelViewMatrix != m_prevModelView)
+        m_cameraMotion = m_prevModelView.inverse() * modelViewMatrix;
+    else
+        m_cameraMotion.makeIdentity();
+    m_prevModelView = modelViewMatrix;
+    m_havePrevModelView = true;
+}
+
+
+size_t HCloudView::prefetchPredicted(const TransformState& transState,
+                                     double angularSizeLimit) const
+{
+    if (m_cameraMotion == M44d())
+        return 0;
+    // Predicted requests rank below those for the current view, and below
+    // those for nearer predictions.
+    const double predictedPriorityScale = 0.1;
+    size_t numRequested = 0;
+    M44d stepMotion;
+    for (int i = 0; i < predictionStep; ++i)
+        stepMotion = stepMotion * m_cameraMotion;
+    TransformState predicted = transState;
+    std::vector<HCloudNode*> nodeStack;
+    for (int k = predictionStep; k <= predictionFrames; k += predictionStep)
+    {
+        predicted.modelViewMatrix = predicted.modelViewMatrix * stepMotion;
+        V3f cameraPos = predicted.cameraPos();
+        ClipBox clipBox(predicted);
+        double priorityScale = predictedPriorityScale/k;
+        nodeStack.push_back(m_rootNode.get());
+        while (!nodeStack.empty())
+        {
+            HCloudNode* node = nodeStack.back();
+            nodeStack.pop_back();
+            if (clipBox.canCull(node->bbox))
+                continue;
+            double angularSize = node->radius()/(node->bbox.center() - cameraPos).length();
+            if (angularSize < angularSizeLimit || node->isLeaf)
+                continue;
+            for (int i = 0; i < 8; ++i)
+            {
+                HCloudNode* n = node->children[i];
+                if (!n)
+                    continue;
+                if (!n->isCached() && nodeDataBytes(n) > 0 &&
+                    !m_inputCache->prefetch(n->idata.dataOffset, nodeDataBytes(n),
+                                            priorityScale*angularSize))
+                {
+                    ++numRequested;
+                }
+                nodeStack.push_back(n);
+            }
+        }
+    }
+    return numRequested;
+}
+
+
+void HCloudView::addCachedNode(HCloudNode* node) const
+{
+    node->lastUsedFrame = m_frame;
+    m_cachedNodes.push_back(node);
+    m_sizeBytes += node->storageBytes();
+}
+
+
+bool HCloudView::keepNodeData(HCloudNode* node, double priority) const
+{
+    if (!node->isCached())
+        return false;
+    // Mark the file pages of data used in place as used in this frame, so
+    // the page cache doesn't release them from under the node.
+    if (!node->usesMappedData() ||
+        m_inputCache->prefetch(node->idata.dataOffset, nodeDataBytes(node), priority))
+        return true;
+    // The pages were evicted while the node was unused, so reading the data
+    // would block on the file.
+    m_sizeBytes -= node->storageBytes();
+    node->freeArrays();
+    return false;
+}
+
+
+void HCloudView::evictNodes() const
+{
+    if (m_sizeBytes > maxNodeCacheBytes)
+    {
+        // Free point data of the least recently used nodes, and the smallest
+        // on screen among nodes last used in the same frame.  Nodes used in
+        // this frame and the root are always kept.
+        std::sort(m_cachedNodes.begin(), m_cachedNodes.end(),
+            [](const HCloudNode* a, const HCloudNode* b)
+            {
+                return a->lastUsedFrame < b->lastUsedFrame ||
+                       (a->lastUsedFrame == b->lastUsedFrame && a->priority < b->priority);
+            });
+        size_t numEvicted = 0;
+        for (HCloudNode* node : m_cachedNodes)
+        {
+            if (m_sizeBytes <= maxNodeCacheBytes || node->lastUsedFrame == m_frame)
+                break;
+            if (node == m_rootNode.get() || !node->isCached())
+                continue;
+            m_sizeBytes -= node->storageBytes();
+            node->freeArrays();
+            ++numEvicted;
+        }
+        m_nodeStats.evictions += numEvicted;
+    }
+    // Also drops nodes freed by keepNodeData()
+    m_cachedNodes.erase(std::remove_if(m_cachedNodes.begin(), m_cachedNodes.end(),
+                                       [](const HCloudNode* n) { return !n->isCached(); }),
+                        m_cachedNodes.end());
 }
 
 
@@ -386,7 +576,7 @@ bool HCloudView::pickVertex(const V3d& cameraPos,
         if (useNode)
         {
             double dist = DBL_MAX;
-            const V3f* P = reinterpret_cast<const V3f*>(node->position.get());
+            const V3f* P = reinterpret_cast<const V3f*>(node->position);
             size_t idx = distFunc.findNearest(offset(), P, node->idata.numPoints, &dist);
             if (dist < minDist)
             {
@@ -46,10 +46,57 @@ class HCloudView : public Geometry
 
 
     private:
+        /// Memory budgets for raw file pages and for node data copied out
+        /// of them.  Node data used in place in the memory mapped file
+        /// counts toward the page budget.
+        static const uint64_t maxPageCacheBytes = uint64_t(256)*1024*1024;
+        static const uint64_t maxNodeCacheBytes = uint64_t(1024)*1024*1024;
+
+        /// Camera motion is extrapolated this many frames ahead, in steps of
+        /// predictionStep frames, to prefetch nodes before they're needed
+        static const int predictionFrames = 12;
+        static const int predictionStep = 3;
+
+        /// Counts of node data lookups while drawing
+        struct NodeCacheStats
+        {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+        };
+
+        void addCachedNode(HCloudNode* node) const;
+
+        /// Return true if `node` has point data which can be drawn without
+        /// waiting on the file.  Keeps file pages used in place by the node
+        /// in the page cache, and frees the node data if they were evicted.
+        bool keepNodeData(HCloudNode* node, double priority) const;
+
+        /// Free node data beyond maxNodeCacheBytes
+        void evictNodes() const;
+
+        /// Update m_cameraMotion from the change in camera since the
+        /// previous frame
+        void updateCameraMotion(const M44d& modelViewMatrix) const;
+
+        /// Request data for nodes which would be drawn if the camera keeps
+        /// moving as it did in the last frame, at lower priority than for
+        /// the current view.  Return the number of nodes requested.
+        size_t prefetchPredicted(const TransformState& transState,
+                                 double angularSizeLimit) const;
+
         HCloudHeader m_header; // TODO: Put in HCloudInput class
         // TODO: Do we really want all this mutable state?
         // Should draw() be logically non-const?
         mutable uint64_t m_sizeBytes;
+        mutable uint64_t m_frame;
+        mutable std::vector<HCloudNode*> m_cachedNodes;
+        mutable NodeCacheStats m_nodeStats;
+        /// Model view matrix of the previous frame, and the eye space motion
+        /// from there to the current frame
+        mutable bool m_havePrevModelView;
+        mutable M44d m_prevModelView;
+        mutable M44d m_cameraMotion;
         mutable std::ifstream m_input;
         mutable std::unique_ptr<StreamPageCache> m_inputCache;
         std::unique_ptr<HCloudNode> m_rootNode;
@@ -0,0 +1,267 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include "LeafBufferCache.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+LeafBufferCache::LeafBufferCache(std::unique_ptr<LeafBufferStorage> storage)
+    : m_storage(std::move(storage)),
+    m_budget(size_t(1024)*1024*1024)
+{ }
+
+
+size_t LeafBufferCache::fieldOffset(const std::vector<GeomField>& fields, size_t i)
+{
+    size_t offset = 0;
+    for (size_t j = 0; j < i; ++j)
+        offset += fields[j].spec.size();
+    return offset;
+}
+
+
+size_t LeafBufferCache::poolCount(const void* owner) const
+{
+    return std::count_if(m_pools.begin(), m_pools.end(),
+                         [owner](const Pool& pool) { return pool.owner == owner; });
+}
+
+
+LeafBufferCache::EntryList::iterator
+LeafBufferCache::prepareEntry(const void* owner, const void* leaf, size_t recordBytes,
+                              size_t leafSize, size_t count)
+{
+    assert(count <= leafSize);
+    EntryList::iterator entry;
+    auto found = m_leafEntries.find(leaf);
+    if (found != m_leafEntries.end())
+    {
+        entry = found->second;
+        m_entries.splice(m_entries.begin(), m_entries, entry);
+    }
+    else
+    {
+        Entry newEntry = {owner, leaf, m_pools.end(), 0, 0, 0, m_frame};
+        m_entries.push_front(newEntry);
+        entry = m_entries.begin();
+        m_leafEntries[leaf] = entry;
+    }
+    entry->lastUsedFrame = m_frame;
+    if (count > entry->capacity)
+    {
+        // Grow geometrically so that drawing a leaf at slowly increasing
+        // quality doesn't reallocate every frame.  Growing discards the
+        // existing contents, but the total upload is still linear in the
+        // final size.
+        const size_t minCapacity = 4096;
+        size_t capacity = std::min(leafSize, std::max(std::max(count, minCapacity),
+                                                      2*entry->capacity));
+        Entry oldRange = *entry;
+        allocateRange(*entry, recordBytes, capacity);
+        freeRange(oldRange);
+        entry->resident = 0;
+    }
+    entry->pool->lastUsedFrame = m_frame;
+    m_storage->bind(entry->pool->buffer);
+    return entry;
+}
+
+
+LeafBufferCache::LeafRange LeafBufferCache::makeResident(
+        const void* owner, const void* leaf, const std::vector<GeomField>& fields,
+        size_t leafBegin, size_t leafSize, size_t count)
+{
+    const size_t perVertexBytes = bytes<size_t>(fields.begin(), fields.end());
+    EntryList::iterator entry = prepareEntry(owner, leaf, perVertexBytes, leafSize, count);
+    const size_t poolCapacity = entry->pool->capacity;
+    if (count > entry->resident)
+    {
+        size_t fieldOffset = 0;
+        for (const GeomField& field : fields)
+        {
+            size_t elemSize = field.spec.size();
+            m_storage->upload(fieldOffset*poolCapacity + (entry->first + entry->resident)*elemSize,
+                              (count - entry->resident)*elemSize,
+                              field.data.get() + (leafBegin + entry->resident)*elemSize);
+            fieldOffset += elemSize;
+        }
+        m_uploadedBytes += (count - entry->resident)*perVertexBytes;
+        entry->resident = count;
+    }
+    LeafRange range = {entry->pool->buffer, poolCapacity, entry->first};
+    evict();
+    return range;
+}
+
+
+LeafBufferCache::LeafRange LeafBufferCache::makeResident(
+        const void* owner, const void* leaf, const char* interleavedData, size_t stride,
+        size_t leafBegin, size_t leafSize, size_t count)
+{
+    EntryList::iterator entry = prepareEntry(owner, leaf, stride, leafSize, count);
+    if (count > entry->resident)
+    {
+        m_storage->upload((entry->first + entry->resident)*stride,
+                          (count - entry->resident)*stride,
+                          interleavedData + (leafBegin + entry->resident)*stride);
+        m_uploadedBytes += (count - entry->resident)*stride;
+        entry->resident = count;
+    }
+    LeafRange range = {entry->pool->buffer, entry->pool->capacity, entry->first};
+    evict();
+    return range;
+}
+
+
+void LeafBufferCache::allocateRange(Entry& entry, size_t recordBytes, size_t numRecords)
+{
+    // First fit within the owner's pools
+    for (auto pool = m_pools.begin(); pool != m_pools.end(); ++pool)
+    {
+        if (pool->owner != entry.owner)
+            continue;
+        for (auto range = pool->freeRanges.begin(); range != pool->freeRanges.end(); ++range)
+        {
+            if (range->second < numRecords)
+                continue;
+            entry.pool = pool;
+            entry.first = range->first;
+            if (range->second > numRecords)
+                pool->freeRanges[range->first + numRecords] = range->second - numRecords;
+            pool->freeRanges.erase(range);
+            pool->usedRecords += numRecords;
+            entry.capacity = numRecords;
+            return;
+        }
+    }
+    // Otherwise start a new pool.  Doubling the owner's total pool size
+    // keeps the number of pools logarithmic in the size of the geometry,
+    // while the last pool is no larger than needed; pools are also limited
+    // to the space left in the budget.
+    const size_t maxPoolBytes = 64*1024*1024;
+    size_t ownerBytes = 0;
+    for (const Pool& pool : m_pools)
+    {
+        if (pool.owner == entry.owner)
+            ownerBytes += pool.bytes;
+    }
+    size_t poolBytes = std::min(ownerBytes, maxPoolBytes);
+    poolBytes = std::min(poolBytes, m_budget > m_totalBytes ? m_budget - m_totalBytes : 0);
+    Pool newPool;
+    newPool.owner = entry.owner;
+    newPool.capacity = std::max(numRecords, poolBytes/recordBytes);
+    newPool.bytes = newPool.capacity*recordBytes;
+    newPool.usedRecords = numRecords;
+    newPool.lastUsedFrame = m_frame;
+    if (newPool.capacity > numRecords)
+        newPool.freeRanges[numRecords] = newPool.capacity - numRecords;
+    newPool.buffer = m_storage->create(newPool.bytes);
+    m_totalBytes += newPool.bytes;
+    m_pools.push_back(std::move(newPool));
+    entry.pool = std::prev(m_pools.end());
+    entry.first = 0;
+    entry.capacity = numRecords;
+}
+
+
+void LeafBufferCache::freeRange(Entry& entry)
+{
+    if (entry.capacity == 0)
+        return;
+    Pool& pool = *entry.pool;
+    // Return range to the free list, merging with adjacent free ranges
+    size_t begin = entry.first;
+    size_t length = entry.capacity;
+    auto next = pool.freeRanges.lower_bound(begin);
+    if (next != pool.freeRanges.begin())
+    {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == begin)
+        {
+            begin = prev->first;
+            length += prev->second;
+            pool.freeRanges.erase(prev);
+        }
+    }
+    if (next != pool.freeRanges.end() && begin + length == next->first)
+    {
+        length += next->second;
+        pool.freeRanges.erase(next);
+    }
+    pool.freeRanges[begin] = length;
+    pool.usedRecords -= entry.capacity;
+    if (pool.usedRecords == 0)
+    {
+        m_storage->destroy(pool.buffer);
+        m_totalBytes -= pool.bytes;
+        m_pools.erase(entry.pool);
+    }
+    entry.pool = m_pools.end();
+    entry.capacity = 0;
+}
+
+
+void LeafBufferCache::invalidate(const void* owner)
+{
+    for (Entry& entry : m_entries)
+    {
+        if (entry.owner == owner)
+            entry.resident = 0;
+    }
+}
+
+
+void LeafBufferCache::release(const void* owner)
+{
+    for (auto entry = m_entries.begin(); entry != m_entries.end(); )
+    {
+        auto next = std::next(entry);
+        if (entry->owner == owner)
+            freeEntry(entry);
+        entry = next;
+    }
+}
+
+
+void LeafBufferCache::freeEntry(EntryList::iterator entry)
+{
+    freeRange(*entry);
+    m_leafEntries.erase(entry->leaf);
+    m_entries.erase(entry);
+}
+
+
+void LeafBufferCache::evict()
+{
+    // Space is only reclaimed once a pool is empty, so free whole pools,
+    // least recently used first.  Freeing single leaf ranges instead could
+    // discard many leaves without reducing the total.
+    while (m_totalBytes > m_budget)
+    {
+        PoolList::iterator victim = m_pools.end();
+        for (auto pool = m_pools.begin(); pool != m_pools.end(); ++pool)
+        {
+            if (pool->lastUsedFrame != m_frame &&
+                (victim == m_pools.end() || pool->lastUsedFrame < victim->lastUsedFrame))
+                victim = pool;
+        }
+        if (victim == m_pools.end())
+            break;
+        // The last range freed deletes the pool
+        size_t numRanges = 0;
+        for (const Entry& entry : m_entries)
+            numRanges += entry.pool == victim;
+        for (auto entry = m_entries.begin(); numRanges > 0; )
+        {
+            auto next = std::next(entry);
+            if (entry->pool == victim)
+            {
+                --numRanges;
+                freeEntry(entry);
+            }
+            entry = next;
+        }
+    }
+}
@@ -0,0 +1,198 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#ifndef DISPLAZ_LEAFBUFFERCACHE_H_INCLUDED
+#define DISPLAZ_LEAFBUFFERCACHE_H_INCLUDED
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "GeomField.h"
+
+//------------------------------------------------------------------------------
+/// Vertex buffer operations used by LeafBufferCache
+///
+/// The cache only allocates and fills buffers through this interface, so that
+/// its bookkeeping can be tested without an OpenGL context.
+class LeafBufferStorage
+{
+    public:
+        virtual ~LeafBufferStorage() {}
+
+        /// Create a buffer of `bytes` bytes, leaving it bound
+        virtual GLuint create(size_t bytes) = 0;
+
+        /// Bind `buffer` for following calls to upload()
+        virtual void bind(GLuint buffer) = 0;
+
+        /// Copy `bytes` bytes of `data` to `offset` in the bound buffer
+        virtual void upload(size_t offset, size_t bytes, const void* data) = 0;
+
+        /// Delete a buffer made by create()
+        virtual void destroy(GLuint buffer) = 0;
+};
+
+
+//------------------------------------------------------------------------------
+/// Cache of GPU vertex buffers holding the point data of octree leaves
+///
+/// Each leaf has a range of records in a large pooled vertex buffer, holding
+/// a prefix of the points in the leaf.  Since points are shuffled within
+/// leaves, drawing a leaf at reduced quality draws a prefix, so a range only
+/// needs extending when a leaf is drawn with more points than before.  Points
+/// already resident on the GPU are never uploaded again, which avoids
+/// resending the whole visible cloud every frame when the camera is static or
+/// orbiting.
+///
+/// Each pool belongs to a single geometry, and holds either the point fields
+/// one after another (field `i` of record `r` at byte offset
+/// `fieldOffset(fields,i)*capacity + r*fields[i].spec.size()`), or
+/// interleaved records of a fixed stride.  Either way, the vertex attribute
+/// setup is the same for all leaves in a pool, so they can be drawn together
+/// with glMultiDrawArrays().
+///
+/// The budget applies to the total size of the pool buffers, including free
+/// space within them.  New pools grow with the total size of the owner's
+/// pools, up to a fixed maximum, but no larger than the space left in the
+/// budget.  A small geometry therefore doesn't take a whole large pool.
+/// Whole pools are freed in least recently used order while the pools
+/// exceed the budget.  Pools used in the current frame are never freed, so
+/// the budget is exceeded if the points drawn in a single frame don't fit.
+///
+/// A single cache is shared by all geometry so that the budget applies to the
+/// total GPU memory used.  All functions must be called with the OpenGL
+/// context current, except where noted.
+class LeafBufferCache
+{
+    public:
+        /// Location of the resident points of a leaf
+        struct LeafRange
+        {
+            GLuint buffer;    ///< Pool vertex buffer
+            size_t capacity;  ///< Number of records in the pool
+            size_t first;     ///< Index of the leaf's first record in the pool
+        };
+
+        /// Get the cache shared by all geometry, which stores leaves in
+        /// OpenGL vertex buffers
+        static LeafBufferCache& instance();
+
+        /// Create a cache using `storage` for its buffers
+        explicit LeafBufferCache(std::unique_ptr<LeafBufferStorage> storage);
+
+        /// Set total size of cached buffers in bytes.  Takes effect as
+        /// leaves are next drawn; does not require an OpenGL context.
+        void setBudget(size_t budgetBytes) { m_budget = budgetBytes; }
+        size_t budget() const { return m_budget; }
+
+        /// Total size of pool buffers in bytes
+        size_t totalBytes() const { return m_totalBytes; }
+
+        /// Number of pool buffers
+        size_t poolCount() const { return m_pools.size(); }
+
+        /// Number of pool buffers of `owner`.  Does not require an OpenGL
+        /// context.
+        size_t poolCount(const void* owner) const;
+
+        /// Total bytes uploaded by makeResident() since startup, for
+        /// measuring the upload cost of drawing
+        uint64_t uploadedBytes() const { return m_uploadedBytes; }
+
+        /// Number of leading points of `leaf` already resident.  Does not
+        /// require an OpenGL context.
+        size_t residentCount(const void* leaf) const
+        {
+            auto found = m_leafEntries.find(leaf);
+            return found == m_leafEntries.end() ? 0 : found->second->resident;
+        }
+
+        /// Start a new frame.  Ranges used before this call become
+        /// candidates for eviction.
+        void beginFrame() { ++m_frame; }
+
+        /// Make the first `count` points of a leaf resident, uploading any
+        /// which aren't already.
+        ///
+        /// `owner` and `leaf` identify the leaf; the leaf points are
+        /// `fields[i]` elements [leafBegin, leafBegin + leafSize).  The pool
+        /// buffer is left bound to GL_ARRAY_BUFFER.
+        LeafRange makeResident(const void* owner, const void* leaf,
+                               const std::vector<GeomField>& fields,
+                               size_t leafBegin, size_t leafSize, size_t count);
+
+        /// Make points of a leaf of interleaved point data resident, as
+        /// above.
+        ///
+        /// The leaf points are the `stride` byte records [leafBegin,
+        /// leafBegin + leafSize) of `interleavedData`.
+        LeafRange makeResident(const void* owner, const void* leaf,
+                               const char* interleavedData, size_t stride,
+                               size_t leafBegin, size_t leafSize, size_t count);
+
+        /// Return per-record byte offset of field `i` in a non-interleaved
+        /// pool buffer
+        static size_t fieldOffset(const std::vector<GeomField>& fields, size_t i);
+
+        /// Mark all leaves of `owner` out of date, for use when the point
+        /// data changes.  Does not require an OpenGL context.
+        void invalidate(const void* owner);
+
+        /// Free all buffers of `owner`
+        void release(const void* owner);
+
+    private:
+        struct Pool
+        {
+            const void* owner;
+            GLuint buffer;
+            size_t capacity;        ///< Number of records
+            size_t bytes;           ///< Size of the buffer
+            size_t usedRecords;
+            uint64_t lastUsedFrame; ///< Last frame any range was used
+            /// Free record ranges, as a map from begin index to length
+            std::map<size_t,size_t> freeRanges;
+        };
+        typedef std::list<Pool> PoolList;
+
+        struct Entry
+        {
+            const void* owner;
+            const void* leaf;
+            PoolList::iterator pool;
+            size_t first;     ///< First record of the leaf range in the pool
+            size_t capacity;  ///< Number of records allocated for the leaf
+            size_t resident;  ///< Number of leading points uploaded
+            uint64_t lastUsedFrame;
+        };
+        typedef std::list<Entry> EntryList;
+
+        /// Find or create the entry for a leaf, make sure it has space for
+        /// `count` points and bind its pool buffer.
+        EntryList::iterator prepareEntry(const void* owner, const void* leaf,
+                                         size_t recordBytes, size_t leafSize,
+                                         size_t count);
+        void allocateRange(Entry& entry, size_t recordBytes, size_t numRecords);
+        void freeRange(Entry& entry);
+        void freeEntry(EntryList::iterator entry);
+        void evict();
+
+        std::unique_ptr<LeafBufferStorage> m_storage;
+        size_t m_budget;
+        size_t m_totalBytes = 0;
+        uint64_t m_frame = 0;
+        uint64_t m_uploadedBytes = 0;
+        /// Entries in most recently used order
+        EntryList m_entries;
+        std::unordered_map<const void*, EntryList::iterator> m_leafEntries;
+        PoolList m_pools;
+};
+
+
+#endif // DISPLAZ_LEAFBUFFERCACHE_H_INCLUDED
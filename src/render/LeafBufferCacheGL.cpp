@@ -0,0 +1,45 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include "LeafBufferCache.h"
+
+#include "glutil.h"
+
+/// Leaf buffer storage in OpenGL vertex buffers
+class GLLeafBufferStorage : public LeafBufferStorage
+{
+    public:
+        GLuint create(size_t bytes) override
+        {
+            GLuint buffer = 0;
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+            return buffer;
+        }
+
+        void bind(GLuint buffer) override
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        }
+
+        void upload(size_t offset, size_t bytes, const void* data) override
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data);
+        }
+
+        void destroy(GLuint buffer) override
+        {
+            glDeleteBuffers(1, &buffer);
+        }
+};
+
+
+LeafBufferCache& LeafBufferCache::instance()
+{
+    // Intentionally leaked: buffers can't be freed after the OpenGL context
+    // is gone at program exit.
+    static LeafBufferCache* cache = new LeafBufferCache(
+        std::unique_ptr<LeafBufferStorage>(new GLLeafBufferStorage()));
+    return *cache;
+}
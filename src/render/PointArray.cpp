@@ -7,24 +7,36 @@
 
 #include "util.h"
 #include "glutil.h"
+#include "parallel.h"
 
 #include <QOpenGLShaderProgram>
 #include <QElapsedTimer>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
 
 #include <functional>
 #include <algorithm>
 #include <numeric>
+#include <limits>
 #include <unordered_map>
 #include <fstream>
 #include <random>
 #include <queue>
 #include <array>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include <cfloat>
+#include <cstring>
 
 #include "ply_io.h"
+#include "text_io.h"
 
 #include "ClipBox.h"
+#include "LeafBufferCache.h"
+#include "octreelod.h"
 
 //------------------------------------------------------------------------------
 /// Functor to compute octree child node index with respect to some given split
@@ -41,10 +53,65 @@ struct OctreeChildIdx
                  (p.x >= m_center.x);
     }
 
+    /// Compute child indices `classes[i] = (*this)(inds[i])` for a block of
+    /// indices.
+    ///
+    /// Positions are gathered into small SoA blocks first so that the
+    /// comparisons can be vectorized by the compiler.
+    void classify(const size_t* inds, size_t n, uint8_t* classes) const
+    {
+        const size_t blockSize = 256;
+        float x[blockSize], y[blockSize], z[blockSize];
+        for (size_t b = 0; b < n; b += blockSize)
+        {
+            size_t m = std::min(blockSize, n - b);
+            for (size_t i = 0; i < m; ++i)
+            {
+                const V3f& p = m_P[inds[b+i]];
+                x[i] = p.x;
+                y[i] = p.y;
+                z[i] = p.z;
+            }
+            const float cx = m_center.x, cy = m_center.y, cz = m_center.z;
+            uint8_t* c = classes + b;
+            for (size_t i = 0; i < m; ++i)
+                c[i] = uint8_t(((z[i] >= cz) << 2) | ((y[i] >= cy) << 1) | (x[i] >= cx));
+        }
+    }
+
     OctreeChildIdx(const V3f* P, const V3f& center) : m_P(P), m_center(center) {}
 };
 
 
+/// Screen space level of detail metric for a view
+///
+/// A length `s` at distance `d` from the camera appears on screen about
+/// `s*pixelScale/(d*wPerDist + wOffset)` pixels long, where the denominator
+/// approximates the clip space w coordinate.  Nodes are drawn with enough
+/// points to give `pointsPerPixel` points per pixel of screen area at unit
+/// quality, so quality means the same thing for data of any scale.
+struct ScreenLod
+{
+    double pixelScale;
+    double wPerDist;
+    double wOffset;
+    double pointsPerPixel;
+
+    ScreenLod(const TransformState& transState, double pointsPerPixel)
+        : pixelScale(0.5*transState.viewSize.y*transState.projMatrix[1][1]),
+        wPerDist(-transState.projMatrix[2][3]),
+        wOffset(transState.projMatrix[3][3]),
+        pointsPerPixel(pointsPerPixel)
+    { }
+};
+
+
+/// Node of the point hierarchy
+///
+/// Every node holds a range of points.  Those of an interior node are a
+/// coarse representative subset of its subtree, selected by selectLodPoints()
+/// and not repeated in the children, so the points of a node and all its
+/// ancestors together give the subtree at the detail of the node.
 struct OctreeNode
 {
     OctreeNode* children[8]; ///< Child nodes - order (x + 2*y + 4*z)
@@ -54,12 +121,23 @@ struct OctreeNode
     Imath::Box3f bbox;       ///< Actual bounding box of points in node
     V3f center;              ///< center of the node
     float halfWidth;         ///< Half the axis-aligned width of the node.
+    /// Bounding boxes of the children as arrays of minX, minY, minZ, maxX,
+    /// maxY and maxZ, for culling all children at once.  Filled in by
+    /// computeChildBounds().
+    float childBounds[6][8];
+    /// Total number of points in the subtree, filled in by
+    /// computeChildBounds().
+    size_t numPoints;
+    /// Estimated distance between neighbouring points of the node, filled
+    /// in by computeChildBounds().
+    float pointSpacing;
 
     OctreeNode(const V3f& center, float halfWidth)
         : beginIndex(0), endIndex(0), nextBeginIndex(0),
-        center(center), halfWidth(halfWidth)
+        center(center), halfWidth(halfWidth), numPoints(0), pointSpacing(0)
     {
         std::fill(children, children + 8, nullptr);
+        std::fill(&childBounds[0][0], &childBounds[0][0] + 6*8, 0.0f);
     }
 
     ~OctreeNode()
@@ -78,25 +156,43 @@ struct OctreeNode
 
     size_t size() const { return endIndex - beginIndex; }
 
-    bool isLeaf() const { return beginIndex != endIndex; }
+    bool isLeaf() const
+    {
+        return std::all_of(children, children + 8, [](const OctreeNode* c) { return !c; });
+    }
 
-    /// Estimate cost of drawing a single leaf node with to given camera
-    /// position, quality, and incremental settings.
-    ///
-    /// Returns estimate of primitive draw count and whether there's anything
-    /// more to draw.
-    DrawCount drawCount(const V3f& relCamera,
-                        double quality, bool incrementalDraw) const
+    BoxArrays childBoxes() const
+    {
+        BoxArrays boxes = {childBounds[0], childBounds[1], childBounds[2],
+                           childBounds[3], childBounds[4], childBounds[5]};
+        return boxes;
+    }
+
+    /// Return the fraction of the node points to draw at unit quality from
+    /// the given camera position, before clamping to 1.
+    double drawWeight(const V3f& relCamera, const ScreenLod& lod) const
     {
-        assert(isLeaf());
-        const double drawAllDist = 100;
         double dist = (this->bbox.center() - relCamera).length();
         double diagRadius = this->bbox.size().length()/2;
         // Subtract bucket diagonal dist, since we really want an approx
         // distance to closest point in the bucket, rather than dist to center.
-        dist = std::max(10.0, dist - diagRadius);
-        double desiredFraction = std::min(1.0, quality*pow(drawAllDist/dist, 2));
-        size_t chunkSize = (size_t)ceil(this->size()*desiredFraction);
+        double w = lod.wPerDist*(dist - diagRadius) + lod.wOffset;
+        if (w <= 0)
+            return DBL_MAX;  // Camera inside or right next to the node
+        return lodDrawWeight(this->pointSpacing, lod.pixelScale/w, lod.pointsPerPixel);
+    }
+
+    /// Estimate cost of drawing the points of a single node with draw weight
+    /// from drawWeight(), quality, and incremental settings.
+    ///
+    /// Returns estimate of primitive draw count and whether there's anything
+    /// more to draw.
+    DrawCount drawCount(double weight, double quality, bool incrementalDraw) const
+    {
+        double desiredFraction = std::min(1.0, quality*weight);
+        // Always draw at least one point so that distant nodes don't vanish
+        size_t chunkSize = this->size() == 0 ? 0 :
+            std::max<size_t>(1, (size_t)ceil(this->size()*desiredFraction));
         DrawCount drawCount;
         drawCount.numVertices = chunkSize;
         if (incrementalDraw)
@@ -110,20 +206,146 @@ struct OctreeNode
 };
 
 
+/// Threadsafe progress reporting for octree construction
 struct ProgressFunc
 {
     PointArray& points;
-    size_t totProcessed;
+    std::atomic<size_t> totProcessed;
+    std::mutex emitMutex;
+    int prevPercent;
 
-    ProgressFunc(PointArray& points) : points(points), totProcessed(0) {}
+    ProgressFunc(PointArray& points) : points(points), totProcessed(0), prevPercent(-1) {}
 
     void operator()(size_t additionalProcessed)
     {
-        totProcessed += additionalProcessed;
-        emit points.loadProgress(int(100*totProcessed/points.pointCount()));
+        size_t processed = (totProcessed += additionalProcessed);
+        int percent = int(100*processed/points.pointCount());
+        // Only emit when the percentage changes, and never out of order
+        std::lock_guard<std::mutex> lock(emitMutex);
+        if (percent > prevPercent)
+        {
+            prevPercent = percent;
+            emit points.loadProgress(percent);
+        }
     }
 };
 
+
+/// Shared state for building an octree in parallel
+struct OctreeBuildContext
+{
+    size_t* inds;           ///< Index array being sorted into octree order
+    size_t* scratch;        ///< Scratch space for partitioning inds
+    uint8_t* classes;       ///< Scratch space for child indices of points
+    const V3f* P;           ///< Point positions
+    ProgressFunc& progressFunc;
+    TaskGroup& tasks;
+    unsigned int shuffleSeed;
+
+    /// Max points in a leaf node
+    static constexpr size_t pointsPerNode = 100000;
+    /// Limit max depth of tree to prevent infinite recursion when greater than
+    /// pointsPerNode points lie at the same position in space.  floats
+    /// effectively have 24 bit of precision in the mantissa, so there's never
+    /// any point splitting more than 24 times.
+    static constexpr int maxDepth = 24;
+    /// Nodes with more points than this are partitioned in parallel
+    static constexpr size_t parallelPartitionSize = 4*1024*1024;
+    /// Resolution of the grid used to select the points of interior nodes;
+    /// at most one point is kept per grid cell.
+    static constexpr int lodGridSize = 64;
+    /// Child subtrees with more points than this are built as separate tasks
+    static constexpr size_t taskSize = 2*pointsPerNode;
+};
+
+
+/// Partition `inds[0..n)` by `classes`, as for counting_partition(), using
+/// the threads of `pool`
+///
+/// Each chunk of the range counts its classes, the counts are prefix summed
+/// to give each chunk a disjoint output range per class, then indices are
+/// scattered into scratch space and copied back.  Like counting_partition(),
+/// this is stable.
+static void parallelCountingPartition(size_t* inds, size_t n, const uint8_t* classes,
+                                      size_t* scratch, size_t** classEnds,
+                                      int numClasses, ThreadPool& pool)
+{
+    assert(numClasses <= 8);
+    size_t numChunks = 4*(size_t)pool.concurrency();
+    size_t chunkSize = (n + numChunks - 1)/numChunks;
+    numChunks = (n + chunkSize - 1)/chunkSize;
+    std::vector<std::array<size_t,8>> counts(numChunks);
+    parallelFor(0, numChunks, 1, [&](size_t chunkBegin, size_t chunkEnd)
+    {
+        for (size_t c = chunkBegin; c < chunkEnd; ++c)
+        {
+            size_t e = std::min(n, (c+1)*chunkSize);
+            std::array<size_t,8>& chunkCounts = counts[c];
+            chunkCounts.fill(0);
+            for (size_t i = c*chunkSize; i < e; ++i)
+                ++chunkCounts[classes[i]];
+        }
+    }, pool);
+    // Exclusive prefix sum over (class, chunk), so counts[c][k] becomes the
+    // output offset for class k in chunk c.
+    size_t offset = 0;
+    for (int k = 0; k < numClasses; ++k)
+    {
+        for (size_t c = 0; c < numChunks; ++c)
+        {
+            size_t count = counts[c][k];
+            counts[c][k] = offset;
+            offset += count;
+        }
+        classEnds[k] = inds + offset;
+    }
+    parallelFor(0, numChunks, 1, [&](size_t chunkBegin, size_t chunkEnd)
+    {
+        for (size_t c = chunkBegin; c < chunkEnd; ++c)
+        {
+            std::array<size_t,8>& out = counts[c];
+            size_t e = std::min(n, (c+1)*chunkSize);
+            for (size_t i = c*chunkSize; i < e; ++i)
+                scratch[out[classes[i]]++] = inds[i];
+        }
+    }, pool);
+    parallelFor(0, n, 1024*1024, [&](size_t b, size_t e)
+    {
+        std::copy(scratch + b, scratch + e, inds + b);
+    }, pool);
+}
+
+
+/// Partition inds[beginIndex..endIndex) into the eight octants about
+/// `center`, as for counting_partition().
+///
+/// For large nodes, this uses all available threads: child indices are
+/// computed in parallel, then partitioned with parallelCountingPartition().
+static void octantPartition(OctreeBuildContext& ctx, size_t beginIndex,
+                            size_t endIndex, const V3f& center,
+                            size_t* childRanges[9])
+{
+    size_t n = endIndex - beginIndex;
+    size_t* inds = ctx.inds + beginIndex;
+    size_t* scratch = ctx.scratch + beginIndex;
+    uint8_t* classes = ctx.classes + beginIndex;
+    OctreeChildIdx classify(ctx.P, center);
+    childRanges[0] = inds;
+    if (n <= OctreeBuildContext::parallelPartitionSize)
+    {
+        classify.classify(inds, n, classes);
+        counting_partition(inds, inds + n, classes, scratch, &childRanges[1], 8);
+        return;
+    }
+    ThreadPool& pool = ctx.tasks.pool();
+    parallelFor(0, n, 64*1024, [&](size_t b, size_t e)
+    {
+        classify.classify(inds + b, e - b, classes + b);
+    }, pool);
+    parallelCountingPartition(inds, n, classes, scratch, &childRanges[1], 8, pool);
+}
+
+
 /// Create an octree over the given set of points with position P
 ///
 /// The points for consideration in the current node are the set
@@ -132,57 +354,574 @@ struct ProgressFunc
 /// the range P[inds[node.beginIndex, node.endIndex)]].  center is the central
 /// split point for splitting children of the current node; radius is the
 /// current node radius measured along one of the axes.
-static OctreeNode* makeTree(int depth, size_t* inds,
+///
+/// Large child subtrees are spawned as tasks in `ctx.tasks`, so the caller
+/// must wait on these before using the tree.  Bounding boxes of interior
+/// nodes are filled in afterward by computeInteriorBounds().
+static OctreeNode* makeTree(OctreeBuildContext& ctx, int depth,
                             size_t beginIndex, size_t endIndex,
-                            const V3f* P, const V3f& center,
-                            float halfWidth, ProgressFunc& progressFunc)
+                            const V3f& center, float halfWidth)
 {
     OctreeNode* node = new OctreeNode(center, halfWidth);
-    const size_t pointsPerNode = 100000;
-    // Limit max depth of tree to prevent infinite recursion when
-    // greater than pointsPerNode points lie at the same position in
-    // space.  floats effectively have 24 bit of precision in the
-    // mantissa, so there's never any point splitting more than 24 times.
-    const int maxDepth = 24;
-    size_t* beginPtr = inds + beginIndex;
-    size_t* endPtr = inds + endIndex;
-    if (endIndex - beginIndex <= pointsPerNode || depth >= maxDepth)
-    {
-        static std::random_device rd;
-        static std::mt19937 g(rd());
+    size_t* beginPtr = ctx.inds + beginIndex;
+    size_t* endPtr = ctx.inds + endIndex;
+    if (endIndex - beginIndex <= OctreeBuildContext::pointsPerNode ||
+        depth >= OctreeBuildContext::maxDepth)
+    {
+        // Seed per leaf rather than sharing a generator so that leaves may be
+        // shuffled concurrently.
+        std::seed_seq seq{ctx.shuffleSeed, (unsigned int)beginIndex,
+                          (unsigned int)(uint64_t(beginIndex) >> 32)};
+        std::mt19937 g(seq);
         std::shuffle(beginPtr, endPtr, g);
 
-        // Leaf node: set up indices into point list 
+        // Leaf node: set up indices into point list
         for (size_t i = beginIndex; i < endIndex; ++i)
-            node->bbox.extendBy(P[inds[i]]);
+            node->bbox.extendBy(ctx.P[ctx.inds[i]]);
         node->beginIndex = beginIndex;
         node->endIndex = endIndex;
-        progressFunc(endIndex - beginIndex);
+        ctx.progressFunc(endIndex - beginIndex);
         return node;
     }
     // Partition points into the 8 child nodes
     size_t* childRanges[9] = {0};
-    multi_partition(beginPtr, endPtr, OctreeChildIdx(P, center), &childRanges[1], 8);
-    childRanges[0] = beginPtr;
+    octantPartition(ctx, beginIndex, endIndex, center, childRanges);
     // Recursively generate child nodes
     float h = halfWidth/2;
     for (int i = 0; i < 8; ++i)
     {
-        size_t childBeginIndex = childRanges[i]   - inds;
-        size_t childEndIndex   = childRanges[i+1] - inds;
+        size_t childBeginIndex = childRanges[i]   - ctx.inds;
+        size_t childEndIndex   = childRanges[i+1] - ctx.inds;
         if (childEndIndex == childBeginIndex)
             continue;
         V3f c = center + V3f((i     % 2 == 0) ? -h : h,
                              ((i/2) % 2 == 0) ? -h : h,
                              ((i/4) % 2 == 0) ? -h : h);
-        node->children[i] = makeTree(depth+1, inds, childBeginIndex,
-                                     childEndIndex, P, c, h, progressFunc);
-        node->bbox.extendBy(node->children[i]->bbox);
+        OctreeNode** child = &node->children[i];
+        if (childEndIndex - childBeginIndex > OctreeBuildContext::taskSize)
+        {
+            ctx.tasks.run([&ctx,child,depth,childBeginIndex,childEndIndex,c,h]()
+            {
+                *child = makeTree(ctx, depth+1, childBeginIndex, childEndIndex, c, h);
+            });
+        }
+        else
+        {
+            *child = makeTree(ctx, depth+1, childBeginIndex, childEndIndex, c, h);
+        }
     }
     return node;
 }
 
 
+/// Count the points in each subtree into OctreeNode::numPoints
+static void countSubtreePoints(OctreeNode* node)
+{
+    node->numPoints = node->size();
+    for (OctreeNode* child : node->children)
+    {
+        if (child)
+        {
+            countSubtreePoints(child);
+            node->numPoints += child->numPoints;
+        }
+    }
+}
+
+
+/// Subtract the points at the sorted positions [selFirst,selLast) of the
+/// subtree range starting at `beginIndex` from OctreeNode::numPoints of the
+/// descendants of `node` holding them
+///
+/// The range is in the depth first order produced by makeTree(), so the
+/// descendant holding each point follows from its position.
+static void removeSelectedPoints(OctreeNode* node, size_t beginIndex,
+                                 const size_t* selFirst, const size_t* selLast)
+{
+    size_t childPoints = 0;
+    for (const OctreeNode* child : node->children)
+        childPoints += child ? child->numPoints : 0;
+    size_t childBeginIndex = beginIndex + node->numPoints - childPoints;
+    for (OctreeNode* child : node->children)
+    {
+        if (!child)
+            continue;
+        size_t childEndIndex = childBeginIndex + child->numPoints;
+        const size_t* childSelFirst = std::lower_bound(selFirst, selLast, childBeginIndex);
+        const size_t* childSelLast = std::lower_bound(childSelFirst, selLast, childEndIndex);
+        if (childSelFirst != childSelLast)
+        {
+            removeSelectedPoints(child, childBeginIndex, childSelFirst, childSelLast);
+            child->numPoints -= childSelLast - childSelFirst;
+        }
+        childBeginIndex = childEndIndex;
+    }
+}
+
+
+/// Move a representative subset of the points in the subtree of each
+/// interior node into the node itself
+///
+/// On entry inds[beginIndex..endIndex) holds the node->numPoints points of
+/// the subtree in the depth first order produced by makeTree().  One point is
+/// chosen at random from each occupied cell of a regular grid over the node
+/// and moved to the front of the range, in shuffled order, to become the
+/// points of the node.  The rest keep their order, so the children are
+/// processed recursively on consecutive subranges of the remainder.
+///
+/// Large nodes are processed using all available threads, as for
+/// octantPartition().
+static void selectLodPoints(OctreeBuildContext& ctx, OctreeNode* node,
+                            size_t beginIndex, size_t endIndex)
+{
+    assert(endIndex - beginIndex == node->numPoints);
+    if (node->isLeaf())
+    {
+        // Leaf points were shuffled in makeTree(), and stay shuffled after
+        // removing the points selected for ancestors.
+        node->beginIndex = beginIndex;
+        node->endIndex = endIndex;
+        return;
+    }
+    size_t n = endIndex - beginIndex;
+    size_t* inds = ctx.inds + beginIndex;
+    size_t* scratch = ctx.scratch + beginIndex;
+    uint8_t* selected = ctx.classes + beginIndex;
+    ThreadPool& pool = ctx.tasks.pool();
+    size_t numSelected = selectGridPoints(ctx.P, inds, n, node->center, node->halfWidth,
+                                          OctreeBuildContext::lodGridSize, selected, pool);
+    // Find positions of the selected points in order, and make selected
+    // points class zero so that partitioning moves them to the front.
+    bool parallel = n > OctreeBuildContext::parallelPartitionSize;
+    size_t numChunks = parallel ? 4*(size_t)pool.concurrency() : 1;
+    size_t chunkSize = (n + numChunks - 1)/numChunks;
+    std::vector<std::vector<size_t>> chunkSelected(numChunks);
+    parallelFor(0, numChunks, 1, [&](size_t chunkBegin, size_t chunkEnd)
+    {
+        for (size_t c = chunkBegin; c < chunkEnd; ++c)
+        {
+            size_t e = std::min(n, (c+1)*chunkSize);
+            for (size_t i = c*chunkSize; i < e; ++i)
+            {
+                if (selected[i])
+                    chunkSelected[c].push_back(i);
+                selected[i] ^= 1;
+            }
+        }
+    }, pool);
+    std::vector<size_t> selectedPos;
+    selectedPos.reserve(numSelected);
+    for (const std::vector<size_t>& pos : chunkSelected)
+        selectedPos.insert(selectedPos.end(), pos.begin(), pos.end());
+    assert(selectedPos.size() == numSelected);
+    // Selected points no longer belong to the descendants they came from
+    removeSelectedPoints(node, 0, selectedPos.data(), selectedPos.data() + numSelected);
+    size_t* classEnds[2];
+    if (parallel)
+        parallelCountingPartition(inds, n, selected, scratch, classEnds, 2, pool);
+    else
+        counting_partition(inds, inds + n, selected, scratch, classEnds, 2);
+    std::seed_seq seq{ctx.shuffleSeed, (unsigned int)beginIndex,
+                      (unsigned int)(uint64_t(beginIndex) >> 32)};
+    std::mt19937 g(seq);
+    std::shuffle(inds, inds + numSelected, g);
+    node->beginIndex = beginIndex;
+    node->endIndex = beginIndex + numSelected;
+
+    size_t childBeginIndex = node->endIndex;
+    for (OctreeNode* child : node->children)
+    {
+        if (!child)
+            continue;
+        size_t childEndIndex = childBeginIndex + child->numPoints;
+        if (child->numPoints > OctreeBuildContext::taskSize)
+        {
+            ctx.tasks.run([&ctx,child,childBeginIndex,childEndIndex]()
+            {
+                selectLodPoints(ctx, child, childBeginIndex, childEndIndex);
+            });
+        }
+        else
+        {
+            selectLodPoints(ctx, child, childBeginIndex, childEndIndex);
+        }
+        childBeginIndex = childEndIndex;
+    }
+    assert(childBeginIndex == endIndex);
+}
+
+
+/// Fill in bounding boxes of interior nodes from those of the leaves
+static void computeInteriorBounds(OctreeNode* node)
+{
+    if (node->isLeaf())
+        return;
+    for (int i = 0; i < 8; ++i)
+    {
+        if (node->children[i])
+        {
+            computeInteriorBounds(node->children[i]);
+            node->bbox.extendBy(node->children[i]->bbox);
+        }
+    }
+}
+
+
+/// Estimate the spacing between neighbouring points of a node
+///
+/// Lidar points mostly lie on surfaces, so assume the points are spread
+/// evenly over the two largest dimensions of the bounding box, or along a
+/// line for very elongated nodes.
+static float estimatePointSpacing(const OctreeNode* node)
+{
+    V3f size = node->bbox.size();
+    float dims[3] = {size.x, size.y, size.z};
+    std::sort(dims, dims + 3);
+    double n = std::max<double>(1, (double)node->size());
+    return (float)std::max(std::sqrt(double(dims[2])*dims[1]/n), dims[2]/n);
+}
+
+
+/// Fill in the child bounds arrays, point counts and point spacing of nodes
+static void computeChildBounds(OctreeNode* node)
+{
+    node->numPoints = node->size();
+    node->pointSpacing = estimatePointSpacing(node);
+    for (int i = 0; i < 8; ++i)
+    {
+        const OctreeNode* child = node->children[i];
+        if (!child)
+            continue;
+        computeChildBounds(node->children[i]);
+        node->numPoints += child->numPoints;
+        node->childBounds[0][i] = child->bbox.min.x;
+        node->childBounds[1][i] = child->bbox.min.y;
+        node->childBounds[2][i] = child->bbox.min.z;
+        node->childBounds[3][i] = child->bbox.max.x;
+        node->childBounds[4][i] = child->bbox.max.y;
+        node->childBounds[5][i] = child->bbox.max.z;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Octree cache file
+//
+// After a point file is sorted into octree order, the reordered fields and the
+// octree are written to a sidecar cache file next to the source.  When the
+// same file is loaded again, the cache is memory mapped and the fields are
+// used directly from the mapping, so loading is nearly instant and point data
+// is only paged in by the OS as leaves are drawn.
+//
+// Layout (little endian).  Field data is used in place from the mapping, so
+// the byte order mark rejects the cache on big endian hosts:
+//
+//   magic, version, byte order mark
+//   source file size, modification time, decimation factor
+//   npoints, totalPoints, offset, bounding box, centroid
+//   number of fields, then for each: name, TypeSpec, data offset
+//   number of nodes, then nodes in depth first order
+//   data offset of inverse permutation
+//   page aligned field data and inverse permutation
+
+#define OCTREE_CACHE_MAGIC "DisplazOctreeCache\n\x0c"
+#define OCTREE_CACHE_MAGIC_SIZE 20
+#define OCTREE_CACHE_VERSION 2
+
+static const uint32_t octreeCacheByteOrderMark = 0x01020304;
+static const uint64_t octreeCacheAlignment = 4096;
+
+
+static QString octreeCacheFileName(QString fileName)
+{
+    return fileName + ".dzoctree";
+}
+
+
+/// Bounds checked reader for the header of a memory mapped cache file
+struct OctreeCacheReader
+{
+    const char* p;
+    const char* end;
+
+    template<typename T>
+    T read()
+    {
+        if (end - p < (ptrdiff_t)sizeof(T))
+            throw DisplazError("Octree cache file is truncated");
+        T val;
+        memcpy(&val, p, sizeof(T));
+        p += sizeof(T);
+        return val;
+    }
+};
+
+
+/// Flatten the tree under `node` into `nodes` in depth first order
+static void flattenOctree(const OctreeNode* node, std::vector<const OctreeNode*>& nodes)
+{
+    nodes.push_back(node);
+    for (int i = 0; i < 8; ++i)
+    {
+        if (node->children[i])
+            flattenOctree(node->children[i], nodes);
+    }
+}
+
+
+static void writeOctreeNode(std::ostream& out, const OctreeNode* node,
+                            const std::unordered_map<const OctreeNode*,uint32_t>& nodeIndex)
+{
+    // Child index zero is the root, so can never be a child and means "none"
+    for (int i = 0; i < 8; ++i)
+        writeLE<uint32_t>(out, node->children[i] ? nodeIndex.at(node->children[i]) : 0);
+    writeLE<uint64_t>(out, node->beginIndex);
+    writeLE<uint64_t>(out, node->endIndex);
+    writeLE<Imath::Box3f>(out, node->bbox);
+    writeLE<V3f>(out, node->center);
+    writeLE<float>(out, node->halfWidth);
+}
+
+
+static uint64_t alignOctreeCacheOffset(uint64_t offset)
+{
+    return (offset + octreeCacheAlignment - 1) / octreeCacheAlignment * octreeCacheAlignment;
+}
+
+
+/// Pad output with zeros to the next aligned offset
+static void padOctreeCache(std::ostream& out)
+{
+    uint64_t pos = out.tellp();
+    for (uint64_t end = alignOctreeCacheOffset(pos); pos < end; ++pos)
+        out.put(0);
+}
+
+
+bool PointArray::loadOctreeCache(QString cacheFileName, QString fileName,
+                                 size_t maxPointCount, uint64_t& totalPoints)
+{
+    QFileInfo sourceInfo(fileName);
+    if (!QFileInfo(cacheFileName).exists())
+        return false;
+    std::unique_ptr<QFile> cacheFile(new QFile(cacheFileName));
+    if (!cacheFile->open(QIODevice::ReadOnly))
+        return false;
+    const uint64_t cacheSize = cacheFile->size();
+    // Private mapping so that mutate() can modify the fields without writing
+    // back to the cache.
+    char* data = (char*)cacheFile->map(0, cacheSize, QFileDevice::MapPrivateOption);
+    if (!data)
+        return false;
+    OctreeCacheReader in = {data, data + cacheSize};
+    try
+    {
+        if (cacheSize < OCTREE_CACHE_MAGIC_SIZE ||
+            memcmp(data, OCTREE_CACHE_MAGIC, OCTREE_CACHE_MAGIC_SIZE) != 0)
+            return false;
+        in.p += OCTREE_CACHE_MAGIC_SIZE;
+        if (in.read<uint32_t>() != OCTREE_CACHE_VERSION ||
+            in.read<uint32_t>() != octreeCacheByteOrderMark)
+            return false;
+        uint64_t sourceSize = in.read<uint64_t>();
+        int64_t sourceModTime = in.read<int64_t>();
+        uint64_t decimationFactor = in.read<uint64_t>();
+        uint64_t npoints = in.read<uint64_t>();
+        totalPoints = in.read<uint64_t>();
+        if (sourceSize != (uint64_t)sourceInfo.size() ||
+            sourceModTime != sourceInfo.lastModified().toMSecsSinceEpoch() ||
+            decimationFactor != PointDecimator(totalPoints, maxPointCount).factor())
+        {
+            g_logger.info("Ignoring out of date octree cache %s", cacheFileName);
+            return false;
+        }
+        V3d offset = in.read<V3d>();
+        Imath::Box3d bbox = in.read<Imath::Box3d>();
+        V3d centroid = in.read<V3d>();
+
+        std::vector<GeomField> fields;
+        uint32_t numFields = in.read<uint32_t>();
+        for (uint32_t i = 0; i < numFields; ++i)
+        {
+            uint32_t nameSize = in.read<uint32_t>();
+            if ((uint64_t)(in.end - in.p) < nameSize)
+                throw DisplazError("Octree cache file is truncated");
+            std::string name(in.p, nameSize);
+            in.p += nameSize;
+            TypeSpec spec;
+            spec.type       = (TypeSpec::Type)in.read<int32_t>();
+            spec.elsize     = in.read<int32_t>();
+            spec.count      = in.read<int32_t>();
+            spec.semantics  = (TypeSpec::Semantics)in.read<int32_t>();
+            spec.fixedPoint = in.read<uint8_t>() != 0;
+            uint64_t size = in.read<uint64_t>();
+            uint64_t dataOffset = in.read<uint64_t>();
+            if ((spec.type != TypeSpec::Float && spec.type != TypeSpec::Int &&
+                 spec.type != TypeSpec::Uint) || spec.elsize <= 0 || spec.count <= 0)
+                throw DisplazError("Octree cache has invalid type for field %s", name);
+            // Compute in 64 bits, since TypeSpec::size() may overflow int
+            uint64_t elementSize = (uint64_t)spec.elsize * (uint64_t)spec.count;
+            if (elementSize > (uint64_t)std::numeric_limits<int>::max() ||
+                size > std::numeric_limits<uint64_t>::max() / elementSize)
+                throw DisplazError("Octree cache has invalid size for field %s", name);
+            if (size != npoints && size != 1)
+                throw DisplazError("Octree cache field %s has wrong number of points", name);
+            if (dataOffset > cacheSize || size*elementSize > cacheSize - dataOffset)
+                throw DisplazError("Octree cache file is truncated");
+            fields.push_back(GeomField(spec, name, size, data + dataOffset));
+        }
+
+        uint64_t numNodes = in.read<uint64_t>();
+        if (numNodes == 0 || numNodes > npoints + 1)
+            throw DisplazError("Octree cache has invalid node count");
+        std::vector<std::unique_ptr<OctreeNode>> nodes(numNodes);
+        for (auto& node : nodes)
+            node.reset(new OctreeNode(V3f(0), 1));
+        for (uint64_t n = 0; n < numNodes; ++n)
+        {
+            OctreeNode* node = nodes[n].get();
+            for (int i = 0; i < 8; ++i)
+            {
+                uint32_t child = in.read<uint32_t>();
+                if (child >= numNodes || (child != 0 && child <= n))
+                    throw DisplazError("Octree cache has invalid node index");
+                if (child != 0)
+                    node->children[i] = nodes[child].release();
+            }
+            node->beginIndex = in.read<uint64_t>();
+            node->endIndex = in.read<uint64_t>();
+            node->bbox = in.read<Imath::Box3f>();
+            node->center = in.read<V3f>();
+            node->halfWidth = in.read<float>();
+            if (node->beginIndex > node->endIndex || node->endIndex > npoints)
+                throw DisplazError("Octree cache has invalid node range");
+        }
+        uint64_t indsOffset = in.read<uint64_t>();
+        if (indsOffset > cacheSize || npoints*sizeof(uint32_t) > cacheSize - indsOffset)
+            throw DisplazError("Octree cache file is truncated");
+
+        int positionFieldIdx = -1;
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            if (fields[i].name == "position" && fields[i].spec == TypeSpec::vec3float32() &&
+                fields[i].size == npoints)
+                positionFieldIdx = (int)i;
+        }
+        if (positionFieldIdx == -1)
+            throw DisplazError("No position field in octree cache");
+
+        m_fields = std::move(fields);
+        m_positionFieldIdx = positionFieldIdx;
+        m_P = (V3f*)m_fields[m_positionFieldIdx].as<float>();
+        m_npoints = npoints;
+        m_rootNode.reset(nodes[0].release());
+        computeChildBounds(m_rootNode.get());
+        m_indsStorage.reset();
+        m_inds = (const uint32_t*)(data + indsOffset);
+        m_cacheFile = std::move(cacheFile);
+        setBoundingBox(bbox);
+        setOffset(offset);
+        setCentroid(centroid);
+    }
+    catch (DisplazError& e)
+    {
+        g_logger.warning("Ignoring octree cache %s: %s", cacheFileName, e.what());
+        return false;
+    }
+    return true;
+}
+
+
+void PointArray::writeOctreeCache(QString cacheFileName, QString fileName,
+                                  size_t maxPointCount, uint64_t totalPoints) const
+{
+    QFileInfo sourceInfo(fileName);
+    // Write to a temporary file first so that a partially written cache is
+    // never used.
+    QString tmpFileName = cacheFileName + ".tmp";
+    std::ofstream out(tmpFileName.toUtf8(), std::ios::binary);
+    if (!out)
+    {
+        g_logger.warning("Could not open octree cache file %s for writing", cacheFileName);
+        return;
+    }
+    std::vector<const OctreeNode*> nodes;
+    flattenOctree(m_rootNode.get(), nodes);
+    std::unordered_map<const OctreeNode*,uint32_t> nodeIndex;
+    for (size_t i = 0; i < nodes.size(); ++i)
+        nodeIndex[nodes[i]] = (uint32_t)i;
+
+    // Data offsets are known once the size of the header is, so write the
+    // header twice.
+    std::vector<uint64_t> dataOffsets(m_fields.size(), 0);
+    uint64_t indsOffset = 0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        out.seekp(0);
+        out.write(OCTREE_CACHE_MAGIC, OCTREE_CACHE_MAGIC_SIZE);
+        writeLE<uint32_t>(out, OCTREE_CACHE_VERSION);
+        writeLE<uint32_t>(out, octreeCacheByteOrderMark);
+        writeLE<uint64_t>(out, sourceInfo.size());
+        writeLE<int64_t>(out, sourceInfo.lastModified().toMSecsSinceEpoch());
+        writeLE<uint64_t>(out, PointDecimator(totalPoints, maxPointCount).factor());
+        writeLE<uint64_t>(out, m_npoints);
+        writeLE<uint64_t>(out, totalPoints);
+        writeLE<V3d>(out, offset());
+        writeLE<Imath::Box3d>(out, boundingBox());
+        writeLE<V3d>(out, centroid());
+        writeLE<uint32_t>(out, (uint32_t)m_fields.size());
+        for (size_t i = 0; i < m_fields.size(); ++i)
+        {
+            const GeomField& field = m_fields[i];
+            writeLE<uint32_t>(out, (uint32_t)field.name.size());
+            out.write(field.name.data(), field.name.size());
+            writeLE<int32_t>(out, field.spec.type);
+            writeLE<int32_t>(out, field.spec.elsize);
+            writeLE<int32_t>(out, field.spec.count);
+            writeLE<int32_t>(out, field.spec.semantics);
+            writeLE<uint8_t>(out, field.spec.fixedPoint);
+            writeLE<uint64_t>(out, field.size);
+            writeLE<uint64_t>(out, dataOffsets[i]);
+        }
+        writeLE<uint64_t>(out, nodes.size());
+        for (const OctreeNode* node : nodes)
+            writeOctreeNode(out, node, nodeIndex);
+        writeLE<uint64_t>(out, indsOffset);
+        // Compute data layout
+        uint64_t pos = out.tellp();
+        for (size_t i = 0; i < m_fields.size(); ++i)
+        {
+            dataOffsets[i] = pos = alignOctreeCacheOffset(pos);
+            pos += m_fields[i].size*m_fields[i].spec.size();
+        }
+        indsOffset = alignOctreeCacheOffset(pos);
+    }
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        padOctreeCache(out);
+        const GeomField& field = m_fields[i];
+        out.write(field.data.get(), field.size*field.spec.size());
+    }
+    padOctreeCache(out);
+    out.write((const char*)m_inds, m_npoints*sizeof(uint32_t));
+    out.close();
+    if (!out)
+    {
+        g_logger.warning("Could not write octree cache file %s", cacheFileName);
+        QFile::remove(tmpFileName);
+        return;
+    }
+    QFile::remove(cacheFileName);
+    if (!QFile::rename(tmpFileName, cacheFileName))
+    {
+        g_logger.warning("Could not write octree cache file %s", cacheFileName);
+        QFile::remove(tmpFileName);
+        return;
+    }
+    g_logger.info("Wrote octree cache %s", cacheFileName);
+}
+
+
 //------------------------------------------------------------------------------
 // PointArray implementation
 
@@ -192,44 +931,204 @@ PointArray::PointArray()
 
 PointArray::~PointArray()
 {
+    // The shared cache may only be used from the GL thread, but a geometry
+    // which failed to load is destroyed on the loader thread.  Such geometry
+    // was never drawn, so has no leaf buffers to release.
+    if (m_hasLeafBuffers)
+        LeafBufferCache::instance().release(this);
 }
 
+/// Extra point field stored from columns of a text file
+struct TextColumnField
+{
+    std::string name;
+    int firstColumn;
+    int numColumns;
+    bool isColor;
+};
+
+
+/// Determine fields for columns beyond the position in a text file, using
+/// names from the `header` row where available.
+static std::vector<TextColumnField> textColumnFields(std::vector<std::string> header,
+                                                     int numColumns)
+{
+    // Allow the header to be commented out
+    if (!header.empty())
+    {
+        std::string& first = header[0];
+        size_t prefixLen = first.find_first_not_of("#/");
+        first = first.substr(std::min(prefixLen, first.size()));
+        if (first.empty())
+            header.erase(header.begin());
+    }
+    std::vector<std::string> names = header;
+    if ((int)names.size() != numColumns)
+    {
+        // Guess at common layouts
+        names.assign({"x", "y", "z"});
+        if (numColumns == 4 || numColumns == 7)
+            names.push_back("intensity");
+        if (numColumns == 6 || numColumns == 7)
+            names.insert(names.end(), {"r", "g", "b"});
+        for (int i = (int)names.size(); i < numColumns; ++i)
+            names.push_back(tfm::format("column%d", i));
+    }
+    std::vector<TextColumnField> fields;
+    for (int i = 3; i < numColumns; )
+    {
+        if (i + 3 <= numColumns &&
+            ((iequals(names[i], "r") && iequals(names[i+1], "g") && iequals(names[i+2], "b")) ||
+             (iequals(names[i], "red") && iequals(names[i+1], "green") && iequals(names[i+2], "blue"))))
+        {
+            fields.push_back(TextColumnField{"color", i, 3, true});
+            i += 3;
+        }
+        else
+        {
+            fields.push_back(TextColumnField{names[i], i, 1, false});
+            i += 1;
+        }
+    }
+    return fields;
+}
+
+
+/// Convert float color field to the smallest integer type which represents
+/// it exactly, if any.  Text files commonly contain 8 or 16 bit integer
+/// colors.
+static void narrowTextColorField(GeomField& field)
+{
+    const float* color = field.as<float>();
+    size_t n = field.size*field.spec.count;
+    float maxVal = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (color[i] < 0 || color[i] != std::floor(color[i]))
+            return;
+        maxVal = std::max(maxVal, color[i]);
+    }
+    if (maxVal > 65535)
+        return;
+    int elsize = maxVal > 255 ? 2 : 1;
+    GeomField newField(TypeSpec(TypeSpec::Uint, elsize, 3, TypeSpec::Color),
+                       field.name, field.size);
+    if (elsize == 1)
+        std::copy(color, color + n, newField.as<uint8_t>());
+    else
+        std::copy(color, color + n, newField.as<uint16_t>());
+    field.spec = newField.spec;
+    field.data.swap(newField.data);
+}
+
+
 /// Load point cloud in text format, assuming fields XYZ
 bool PointArray::loadText(QString fileName, size_t maxPointCount,
                           std::vector<GeomField>& fields, V3d& offset,
                           size_t& npoints, uint64_t& totalPoints)
 {
-    V3d Psum(0);
-    // Use C file IO here, since it's about 40% faster than C++ streams for
-    // large text files (tested on linux x86_64, gcc 4.6.3).
-    File inFile = fopen(fileName.toUtf8(), "r");
-    if (!inFile)
+    // Parse directly from a memory map of the file, on several threads
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const size_t numBytes = file.size();
+    totalPoints = 0;
+    npoints = 0;
+    if (numBytes == 0)
+    {
+        fields.push_back(GeomField(TypeSpec::vec3float32(), "position", 0));
+        return true;
+    }
+    const char* data = (const char*)file.map(0, numBytes);
+    if (!data)
+    {
+        g_logger.error("Could not map file %s", fileName);
         return false;
-    fseek(inFile, 0, SEEK_END);
-    const size_t numBytes = ftell(inFile);
-    fseek(inFile, 0, SEEK_SET);
-    std::vector<Imath::V3d> points;
-    Imath::V3d p;
-    size_t readCount = 0;
-    // Read three doubles; "%*[^\n]" discards up to just before end of line
-    while (fscanf(inFile, " %lf %lf %lf%*[^\n]", &p.x, &p.y, &p.z) == 3)
-    {
-        points.push_back(p);
-        ++readCount;
-        if (readCount % 10000 == 0)
-            emit loadProgress(int(100*ftell(inFile)/numBytes));
-    }
-    totalPoints = points.size();
-    npoints = points.size();
+    }
+    const char* end = data + numBytes;
+    // The first row with at least three numbers determines the columns; the
+    // line before it is assumed to be a header if it has the right length.
+    const int maxColumns = 64;
+    double firstRow[maxColumns];
+    int numColumns = 0;
+    std::vector<std::string> header;
+    for (const char* p = data; p < end; )
+    {
+        const char* lineStart = p;
+        numColumns = parseTextRow(p, end, firstRow, maxColumns);
+        if (numColumns >= 3)
+            break;
+        header = splitTextRow(lineStart, end);
+    }
     // Zero points + nonzero bytes => bad text file
-    if (totalPoints == 0 && numBytes != 0)
+    if (numColumns < 3)
         return false;
-    if (totalPoints > 0)
-        offset = points[0];
+    offset = V3d(firstRow[0], firstRow[1], firstRow[2]);
+
+    // Like the original fscanf loader, accept any row with at least the three
+    // position columns.
+    TextTableParser parser(data, numBytes, numColumns, 4*1024*1024, 3);
+    // Chunks are parsed on several threads, but progress is only emitted
+    // from the loading thread, using the total bytes parsed by all threads.
+    // Counting rows is the first half of the work and parsing the second.
+    std::atomic<uint64_t> bytesDone(0);
+    const std::thread::id loaderThread = std::this_thread::get_id();
+    auto chunkDone = [&](size_t chunkBytes)
+    {
+        uint64_t done = (bytesDone += chunkBytes);
+        if (std::this_thread::get_id() == loaderThread)
+            emit loadProgress(int(50*done/numBytes));
+    };
+    totalPoints = parser.countRows(chunkDone);
+    if (parser.numShortRows() > 0)
+    {
+        g_logger.warning("%d rows of \"%s\" have fewer than %d columns; "
+                         "missing values set to zero",
+                         parser.numShortRows(), fileName, numColumns);
+    }
+    PointDecimator decimator(totalPoints, maxPointCount);
+    if (decimator.factor() > 1)
+    {
+        g_logger.info("Decimating \"%s\" by factor of %d",
+                      fileName, decimator.factor());
+    }
+    npoints = decimator.outputCount();
+    emit loadProgress(50);
+
+    std::vector<TextColumnField> columnFields = textColumnFields(header, numColumns);
     fields.push_back(GeomField(TypeSpec::vec3float32(), "position", npoints));
+    for (const TextColumnField& col: columnFields)
+    {
+        TypeSpec type = col.isColor ? TypeSpec(TypeSpec::Float, 4, 3, TypeSpec::Color)
+                                    : TypeSpec::float32();
+        fields.push_back(GeomField(type, col.name, npoints));
+    }
     V3f* position = (V3f*)fields[0].as<float>();
-    for (size_t i = 0; i < npoints; ++i)
-        position[i] = points[i] - offset;
+    std::vector<float*> columnData;
+    for (size_t i = 0; i < columnFields.size(); ++i)
+        columnData.push_back(fields[i+1].as<float>());
+    const uint64_t decimate = decimator.factor();
+    parser.parseRows([&](size_t inputRow, const double* values)
+    {
+        if (!decimator.keep(inputRow))
+            return;
+        size_t row = inputRow / decimate;
+        position[row] = V3f(values[0] - offset.x,
+                            values[1] - offset.y,
+                            values[2] - offset.z);
+        for (size_t i = 0; i < columnFields.size(); ++i)
+        {
+            const TextColumnField& col = columnFields[i];
+            float* dest = columnData[i] + row*col.numColumns;
+            for (int j = 0; j < col.numColumns; ++j)
+                dest[j] = (float)values[col.firstColumn + j];
+        }
+    }, chunkDone);
+    for (size_t i = 0; i < columnFields.size(); ++i)
+    {
+        if (columnFields[i].isColor)
+            narrowTextColorField(fields[i+1]);
+    }
     return true;
 }
 
@@ -244,18 +1143,27 @@ bool PointArray::loadPly(QString fileName, size_t maxPointCount,
     if (!ply || !ply_read_header(ply.get()))
         return false;
     // Parse out header data
-    p_ply_element vertexElement = findVertexElement(ply.get(), npoints);
+    size_t numVertices = 0;
+    p_ply_element vertexElement = findVertexElement(ply.get(), numVertices);
     if (vertexElement)
     {
-        if (!loadPlyVertexProperties(fileName, ply.get(), vertexElement, fields, offset, npoints))
+        PointDecimator decimator(numVertices, maxPointCount);
+        if (!loadPlyVertexProperties(fileName, ply.get(), vertexElement, decimator, fields, offset))
             return false;
+        npoints = decimator.outputCount();
+        totalPoints = numVertices;
     }
     else
     {
-        if (!loadDisplazNativePly(fileName, ply.get(), fields, offset, npoints))
+        if (!loadDisplazNativePly(fileName, ply.get(), maxPointCount, fields, offset,
+                                  npoints, totalPoints))
             return false;
     }
-    totalPoints = npoints;
+    if (npoints < totalPoints)
+    {
+        g_logger.info("Decimated \"%s\" by factor of %d",
+                      fileName, PointDecimator(totalPoints, maxPointCount).factor());
+    }
     return true;
 }
 
@@ -265,9 +1173,24 @@ bool PointArray::loadFile(QString fileName, size_t maxPointCount)
     QElapsedTimer loadTimer;
     loadTimer.start();
     setFileName(fileName);
+    m_visibleNodesValid = false;
+    uint64_t totalPoints = 0;
+    QString cacheFileName = octreeCacheFileName(fileName);
+    if (m_useOctreeCache)
+    {
+        emit loadStepStarted("Reading octree cache");
+        if (loadOctreeCache(cacheFileName, fileName, maxPointCount, totalPoints))
+        {
+            if (m_interleaveFields)
+                buildInterleavedFields();
+            emit loadProgress(100);
+            g_logger.info("Loaded %d of %d points from octree cache %s in %.2f seconds",
+                          m_npoints, totalPoints, cacheFileName, loadTimer.elapsed()/1000.0);
+            return true;
+        }
+    }
     // Read file into point data fields.  Use very basic file type detection
     // based on extension.
-    uint64_t totalPoints = 0;
     V3d offset(0);
     emit loadStepStarted("Reading file");
     if (fileName.toLower().endsWith(".las") || fileName.toLower().endsWith(".laz"))
@@ -366,28 +1289,87 @@ bool PointArray::loadFile(QString fileName, size_t maxPointCount)
     V3f diag = rootBound.size();
     float rootRadius = std::max(std::max(diag.x, diag.y), diag.z) / 2;
     ProgressFunc progressFunc(*this);
-    m_rootNode.reset(makeTree(0, &inds[0], 0, m_npoints, &m_P[0],
-                              rootBound.center(), rootRadius, progressFunc));
+    std::unique_ptr<size_t[]> scratch(new size_t[m_npoints]);
+    std::unique_ptr<uint8_t[]> classes(new uint8_t[m_npoints]);
+    TaskGroup tasks;
+    std::random_device rd;
+    OctreeBuildContext ctx = {inds.get(), scratch.get(), classes.get(), m_P,
+                              progressFunc, tasks, rd()};
+    m_rootNode.reset(makeTree(ctx, 0, 0, m_npoints, rootBound.center(), rootRadius));
+    tasks.wait();
+    countSubtreePoints(m_rootNode.get());
+    selectLodPoints(ctx, m_rootNode.get(), 0, m_npoints);
+    tasks.wait();
+    scratch.reset();
+    classes.reset();
+    computeInteriorBounds(m_rootNode.get());
+    computeChildBounds(m_rootNode.get());
     // Reorder point fields into octree order
     emit loadStepStarted("Reordering fields");
-    for (size_t i = 0; i < m_fields.size(); ++i)
+    reorder(m_fields, inds.get(), m_npoints, [this](double fractionDone)
     {
-        g_logger.debug("Reordering field %d: %s", i, m_fields[i]);
-        reorder(m_fields[i], inds.get(), m_npoints);
-        emit loadProgress(int(100*(i+1)/(m_fields.size()+1))); // denominator +1 for permutation reorder below
-    }
+        emit loadProgress(int(100*fractionDone*m_fields.size()/(m_fields.size()+1))); // denominator +1 for permutation reorder below
+    });
     m_P = (V3f*)m_fields[m_positionFieldIdx].as<float>();
 
     // The index we want to store is the reverse permutation of the index above
     // This is necessary if we want to mutate the data later
-    m_inds = std::unique_ptr<uint32_t[]>(new uint32_t[m_npoints]);
-    for (size_t i = 0; i < m_npoints; ++i) m_inds[inds[i]] = static_cast<uint32_t>(i); // Works for m_npoints < UINT32_MAX
+    m_indsStorage.reset(new uint32_t[m_npoints]);
+    uint32_t* invInds = m_indsStorage.get();
+    parallelFor(0, m_npoints, 1024*1024, [&](size_t b, size_t e)
+    {
+        for (size_t i = b; i < e; ++i)
+            invInds[inds[i]] = static_cast<uint32_t>(i); // Works for m_npoints < UINT32_MAX
+    });
+    m_inds = invInds;
+    if (m_interleaveFields)
+        buildInterleavedFields();
     emit loadProgress(int(100));
 
+    if (m_useOctreeCache)
+    {
+        emit loadStepStarted("Writing octree cache");
+        writeOctreeCache(cacheFileName, fileName, maxPointCount, totalPoints);
+    }
+
     return true;
 }
 
 
+void PointArray::buildInterleavedFields()
+{
+    // Align each field to its element size, and records to the largest
+    // element size, and at least four bytes as preferred by OpenGL for
+    // vertex attributes.
+    m_interleavedOffsets.resize(m_fields.size());
+    size_t offset = 0;
+    size_t recordAlign = 4;
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        size_t align = m_fields[i].spec.elsize;
+        recordAlign = std::max(recordAlign, align);
+        offset = (offset + align - 1) / align * align;
+        m_interleavedOffsets[i] = offset;
+        offset += m_fields[i].spec.size();
+    }
+    const size_t stride = (offset + recordAlign - 1) / recordAlign * recordAlign;
+    m_interleavedStride = stride;
+    m_interleaved.reset(new char[m_npoints*stride]);
+    char* interleaved = m_interleaved.get();
+    parallelFor(0, m_npoints, 64*1024, [&](size_t b, size_t e)
+    {
+        for (size_t i = 0; i < m_fields.size(); ++i)
+        {
+            const size_t size = m_fields[i].spec.size();
+            const char* src = m_fields[i].data.get() + b*size;
+            char* dest = interleaved + b*stride + m_interleavedOffsets[i];
+            for (size_t j = b; j < e; ++j, src += size, dest += stride)
+                memcpy(dest, src, size);
+        }
+    });
+}
+
+
 void PointArray::mutate(std::shared_ptr<GeometryMutator> mutator)
 {
     // Now we need to find the matching columns
@@ -470,6 +1452,22 @@ void PointArray::mutate(std::shared_ptr<GeometryMutator> mutator)
             }
         }
     }
+    if (m_interleaved)
+    {
+        for (size_t j = 0; j < npoints; ++j)
+        {
+            size_t idx = m_inds[mutIdx[j]];
+            for (size_t i = 0; i < m_fields.size(); ++i)
+            {
+                size_t size = m_fields[i].spec.size();
+                memcpy(m_interleaved.get() + idx*m_interleavedStride + m_interleavedOffsets[i],
+                       m_fields[i].data.get() + idx*size, size);
+            }
+        }
+    }
+    // Points on the GPU are now stale
+    if (m_hasLeafBuffers)
+        LeafBufferCache::instance().invalidate(this);
 }
 
 
@@ -511,16 +1509,13 @@ bool PointArray::pickVertex(const V3d& cameraPos,
         const OctreeNode* node = nextNode.second;
         pendingNodes.pop();
 
-        if (!node->isLeaf())
+        for (int i = 0; i < 8; ++i)
         {
-            for (int i = 0; i < 8; ++i)
-            {
-                OctreeNode* n = node->children[i];
-                if (n)
-                    pendingNodes.push(makePriortyNode(n));
-            }
+            OctreeNode* n = node->children[i];
+            if (n)
+                pendingNodes.push(makePriortyNode(n));
         }
-        else
+        if (node->size() != 0)
         {
             double dist = 0;
             size_t idx = node->findNearest(distFunc, offset(), m_P, dist);
@@ -567,37 +1562,133 @@ bool PointArray::pickVertex(const V3d& cameraPos,
 }
 
 
+void PointArray::updateVisibleNodes(const TransformState& relativeTrans) const
+{
+    if (m_visibleNodesValid &&
+        m_visibleViewSize == relativeTrans.viewSize &&
+        m_visibleProjMatrix == relativeTrans.projMatrix &&
+        m_visibleModelViewMatrix == relativeTrans.modelViewMatrix)
+    {
+        return;
+    }
+    m_visibleNodesValid = true;
+    m_visibleViewSize = relativeTrans.viewSize;
+    m_visibleProjMatrix = relativeTrans.projMatrix;
+    m_visibleModelViewMatrix = relativeTrans.modelViewMatrix;
+    m_visibleNodes.clear();
+
+    ClipBox clipBox(relativeTrans);
+    // At unit quality, aim to fill the screen with one point per pixel
+    const double pointsPerPixel = 1;
+    ScreenLod lod(relativeTrans, pointsPerPixel);
+    const OctreeNode* root = m_rootNode.get();
+    CullResult rootClass = clipBox.classify(root->bbox);
+    if (rootClass != Cull_Outside)
+    {
+        appendVisibleNodes(root, rootClass == Cull_Inside, clipBox,
+                           relativeTrans.cameraPos(), lod);
+    }
+    m_visibleDrawCalls.assign(m_visibleNodes.size() + 1, 0);
+    for (size_t j = 0; j < m_visibleNodes.size(); ++j)
+        m_visibleDrawCalls[j+1] = m_visibleDrawCalls[j] + (m_visibleNodes[j].node->size() != 0);
+}
+
+
+double PointArray::appendVisibleNodes(const OctreeNode* node, bool inside,
+                                      const ClipBox& clipBox, const V3f& relCamera,
+                                      const ScreenLod& lod) const
+{
+    size_t j = m_visibleNodes.size();
+    VisibleNode visNode = {node, node->drawWeight(relCamera, lod), 0, 0};
+    m_visibleNodes.push_back(visNode);
+    double minWeight = visNode.weight;
+    if (!node->isLeaf())
+    {
+        // Children of a node inside the frustum need no further culling tests
+        uint8_t childClass[8];
+        if (inside)
+            std::fill(childClass, childClass + 8, (uint8_t)Cull_Inside);
+        else
+            classifyBoxes(clipBox.planes(), node->childBoxes(), 8, childClass);
+        for (int i = 0; i < 8; ++i)
+        {
+            const OctreeNode* child = node->children[i];
+            if (!child || childClass[i] == Cull_Outside)
+                continue;
+            minWeight = std::min(minWeight,
+                appendVisibleNodes(child, childClass[i] == Cull_Inside,
+                                   clipBox, relCamera, lod));
+        }
+    }
+    m_visibleNodes[j].subtreeEnd = m_visibleNodes.size();
+    if (inside)
+        m_visibleNodes[j].subtreeMinWeight = minWeight;
+    return minWeight;
+}
+
+
 void PointArray::estimateCost(const TransformState& transState,
                               bool incrementalDraw, const double* qualities,
                               DrawCount* drawCounts, int numEstimates) const
 {
-    TransformState relativeTrans = transState.translate(offset());
-    V3f relCamera = relativeTrans.cameraPos();
-    ClipBox clipBox(relativeTrans);
+    updateVisibleNodes(transState.translate(offset()));
+
+    // Points of each node already on the GPU, and whether there's more to
+    // draw, don't depend on the quality.  Resident counts are stored as
+    // prefix sums for totalling whole subtrees.
+    const LeafBufferCache& leafBuffers = LeafBufferCache::instance();
+    double pointBytes = m_interleaved ? (double)m_interleavedStride :
+                        (double)bytes<size_t>(m_fields.begin(), m_fields.end());
+    const size_t numNodes = m_visibleNodes.size();
+    bool moreToDraw = false;
+    m_visibleResident.assign(numNodes + 1, 0);
+    for (size_t j = 0; j < numNodes; ++j)
+    {
+        const OctreeNode* node = m_visibleNodes[j].node;
+        moreToDraw |= node->nextBeginIndex < node->endIndex;
+        m_visibleResident[j+1] = m_visibleResident[j] +
+            std::min(leafBuffers.residentCount(node), node->size());
+    }
 
-    std::vector<const OctreeNode*> nodeStack;
-    nodeStack.push_back(m_rootNode.get());
-    while (!nodeStack.empty())
+    // Leaves sharing a pool buffer are drawn with a single call, so there
+    // are no more calls than pools, and at least one if anything is drawn.
+    const double numPools = (double)std::max<size_t>(1, leafBuffers.poolCount(this));
+
+    for (int i = 0; i < numEstimates; ++i)
     {
-        const OctreeNode* node = nodeStack.back();
-        nodeStack.pop_back();
-        if (clipBox.canCull(node->bbox))
-            continue;
-        if (!node->isLeaf())
+        DrawCount count;
+        count.moreToDraw = moreToDraw;
+        for (size_t j = 0; j < numNodes; )
         {
-            for (int i = 0; i < 8; ++i)
+            const VisibleNode& visNode = m_visibleNodes[j];
+            const OctreeNode* node = visNode.node;
+            // Subtrees which would be drawn completely don't need descending
+            if (!incrementalDraw && qualities[i]*visNode.subtreeMinWeight >= 1)
             {
-                OctreeNode* n = node->children[i];
-                if (n)
-                    nodeStack.push_back(n);
+                size_t end = visNode.subtreeEnd;
+                count.numVertices += node->numPoints;
+                count.numDrawCalls += m_visibleDrawCalls[end] - m_visibleDrawCalls[j];
+                count.uploadBytes += pointBytes*(node->numPoints -
+                                     (m_visibleResident[end] - m_visibleResident[j]));
+                j = end;
+                continue;
             }
-            continue;
-        }
-        for (int i = 0; i < numEstimates; ++i)
-        {
-            drawCounts[i] += node->drawCount(relCamera, qualities[i],
-                                             incrementalDraw);
+            size_t drawBegin = incrementalDraw ? node->nextBeginIndex - node->beginIndex : 0;
+            size_t numVertices = (size_t)node->drawCount(visNode.weight, qualities[i],
+                                                         incrementalDraw).numVertices;
+            size_t drawEnd = drawBegin + numVertices;
+            if (numVertices != 0)
+            {
+                size_t resident = m_visibleResident[j+1] - m_visibleResident[j];
+                count.numVertices += numVertices;
+                count.numDrawCalls += 1;
+                if (drawEnd > resident)
+                    count.uploadBytes += pointBytes*(drawEnd - resident);
+            }
+            j = (drawEnd >= node->size()) ? j + 1 : visNode.subtreeEnd;
         }
+        count.numDrawCalls = std::min(count.numDrawCalls, numPools);
+        drawCounts[i] += count;
     }
 }
 
@@ -626,9 +1717,8 @@ void PointArray::initializeGL()
     glGenVertexArrays(1, &vao);
     setVAO("points", vao);
 
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    setVBO("point_buffer", vbo);
+    LeafBufferCache::instance().release(this);
+    m_hasLeafBuffers = false;
 }
 
 void PointArray::draw(const TransformState& transState, double quality) const
@@ -641,40 +1731,34 @@ DrawCount PointArray::drawPoints(QOpenGLShaderProgram& prog, const TransformStat
     GLuint vao = getVAO("points");
     glBindVertexArray(vao);
 
-    GLuint vbo = getVBO("point_buffer");
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
     TransformState relativeTrans = transState.translate(offset());
     relativeTrans.setUniforms(prog.programId());
     //printActiveShaderAttributes(prog.programId());
-    std::vector<ShaderAttribute> activeAttrs = activeShaderAttributes(prog.programId());
-    // Figure out shader locations for each point field
-    // TODO: attributeLocation() forces the OpenGL usage here to be
-    // synchronous.  Does this matter?  (Alternative: bind them ourselves.)
-    std::vector<const ShaderAttribute*> attributes;
-    for (size_t i = 0; i < m_fields.size(); ++i)
+    // Figure out shader locations for each point field.  Querying the shader
+    // is synchronous, so the result is cached until the shader changes.
+    if (m_attributeNames.empty())
     {
-        const GeomField& field = m_fields[i];
-        if (field.spec.isArray())
+        for (const GeomField& field : m_fields)
         {
-            for (int j = 0; j < field.spec.count; ++j)
+            if (field.spec.isArray())
             {
-                std::string name = tfm::format("%s[%d]", field.name, j);
-                attributes.push_back(findAttr(name, activeAttrs));
+                for (int j = 0; j < field.spec.count; ++j)
+                    m_attributeNames.push_back(tfm::format("%s[%d]", field.name, j));
+            }
+            else
+            {
+                m_attributeNames.push_back(field.name);
             }
         }
-        else
-        {
-            attributes.push_back(findAttr(field.name, activeAttrs));
-        }
+        m_attributeLayout = ShaderAttributeCache::instance().layoutId(m_attributeNames);
     }
+    const ShaderAttributeBinding& binding =
+        ShaderAttributeCache::instance().binding(prog.programId(), m_attributeLayout);
+    const std::vector<const ShaderAttribute*>& attributes = binding.attrs;
     // Zero out active attributes in case they don't have associated fields
     GLfloat zeros[16] = {0};
-    for (size_t i = 0; i < activeAttrs.size(); ++i)
-    {
-        prog.setAttributeValue((int)i, zeros, activeAttrs[i].rows,
-                               activeAttrs[i].cols);
-    }
+    for (const ShaderAttribute* attr : binding.unboundAttrs)
+        prog.setAttributeValue(attr->location, zeros, attr->rows, attr->cols);
     // Enable attributes which have associated fields
     for (size_t i = 0; i < attributes.size(); ++i)
     {
@@ -682,80 +1766,104 @@ DrawCount PointArray::drawPoints(QOpenGLShaderProgram& prog, const TransformStat
             glEnableVertexAttribArray(attributes[i]->location);
     }
 
-    // Compute number of bytes required to store all attributes of a vertex, in bytes.
-    const size_t perVertexBytes = bytes<size_t>(m_fields.begin(), m_fields.end());
-
     DrawCount drawCount;
-    ClipBox clipBox(relativeTrans);
-
-    std::array<size_t, 8> nodeOrder;
-    std::iota(nodeOrder.begin(), nodeOrder.end(), 0);  // Order does not matter
-
-    // Draw points in each bucket, with total number drawn depending on how far
-    // away the bucket is.  Since the points are shuffled, this corresponds to
-    // a stochastic simplification of the full point cloud.
-    V3f relCamera = relativeTrans.cameraPos();
-    std::vector<const OctreeNode*> nodeStack;
-    nodeStack.push_back(m_rootNode.get());
-    while (!nodeStack.empty())
+    updateVisibleNodes(relativeTrans);
+
+    // Choose points to draw in each node, with total number drawn depending
+    // on how far away the node is.  Since the points are shuffled, this
+    // corresponds to a stochastic simplification of the full point cloud.
+    // Descendants are skipped until all points of a node are drawn, so
+    // coarse views stop at shallow depths of the tree.
+    if (!incrementalDraw)
     {
-        const OctreeNode* node = nodeStack.back();
-        nodeStack.pop_back();
-        if (clipBox.canCull(node->bbox))
-            continue;
-        if (!node->isLeaf())
-        {
-            std::for_each(std::begin(nodeOrder), std::end(nodeOrder), [&](const auto& i) { if (node->children[i]) nodeStack.push_back(node->children[i]); });
-            continue;
-        }
-        if (!incrementalDraw)
-            node->nextBeginIndex = node->beginIndex;
-
-        DrawCount nodeDrawCount = node->drawCount(relCamera, quality, incrementalDraw);
+        for (const VisibleNode& visNode : m_visibleNodes)
+            visNode.node->nextBeginIndex = visNode.node->beginIndex;
+    }
+    struct LeafDraw
+    {
+        const OctreeNode* node;
+        size_t numVertices;
+    };
+    std::vector<LeafDraw> leafDraws;
+    for (size_t j = 0; j < m_visibleNodes.size(); )
+    {
+        const VisibleNode& visNode = m_visibleNodes[j];
+        const OctreeNode* node = visNode.node;
+        DrawCount nodeDrawCount = node->drawCount(visNode.weight, quality, incrementalDraw);
         drawCount += nodeDrawCount;
+        size_t numVertices = (size_t)nodeDrawCount.numVertices;
+        j = (node->nextBeginIndex + numVertices >= node->endIndex) ? j + 1 : visNode.subtreeEnd;
 
-        if (nodeDrawCount.numVertices == 0)
+        if (numVertices == 0)
             continue;
 
-        if (m_fields.size() < 1)
-            continue;
+        LeafDraw leafDraw = {node, numVertices};
+        leafDraws.push_back(leafDraw);
+    }
+
+    // Make the chosen points resident on the GPU, uploading only those points
+    // which weren't already resident from previous frames, and batch nodes
+    // sharing a buffer pool into a single draw call.
+    struct PoolDraw
+    {
+        LeafBufferCache::LeafRange pool;
+        std::vector<GLint> first;
+        std::vector<GLsizei> count;
+    };
+    std::vector<PoolDraw> poolDraws;
+    LeafBufferCache& leafBuffers = LeafBufferCache::instance();
+    uint64_t initialUploadedBytes = leafBuffers.uploadedBytes();
+    if (!leafDraws.empty() && !m_fields.empty())
+        m_hasLeafBuffers = true;
+    for (size_t n = 0; n < leafDraws.size() && !m_fields.empty(); ++n)
+    {
+        const OctreeNode* node = leafDraws[n].node;
+        size_t numVertices = leafDraws[n].numVertices;
+        size_t firstVertex = node->nextBeginIndex - node->beginIndex;
+        size_t drawEnd = firstVertex + numVertices;
+        LeafBufferCache::LeafRange range = m_interleaved ?
+            leafBuffers.makeResident(this, node, m_interleaved.get(), m_interleavedStride,
+                                     node->beginIndex, node->size(), drawEnd) :
+            leafBuffers.makeResident(this, node, m_fields, node->beginIndex,
+                                     node->size(), drawEnd);
+        size_t p = 0;
+        while (p < poolDraws.size() && poolDraws[p].pool.buffer != range.buffer)
+            ++p;
+        if (p == poolDraws.size())
+            poolDraws.push_back(PoolDraw{range, {}, {}});
+        poolDraws[p].first.push_back((GLint)(range.first + firstVertex));
+        poolDraws[p].count.push_back((GLsizei)numVertices);
+        node->nextBeginIndex += numVertices;
+    }
+    drawCount.numDrawCalls = (double)poolDraws.size();
+    drawCount.uploadBytes = (double)(leafBuffers.uploadedBytes() - initialUploadedBytes);
 
-        // Create a new uninitialized buffer for the current node, reserving
-        // enough space for the entire set of vertex attributes which will be
-        // passed to the shader.
-        //
-        // (This new memory area will be bound to the "point_buffer" VBO until
-        // the memory is orphaned by calling glBufferData() next time through
-        // the loop.  The orphaned memory should be cleaned up by the driver,
-        // and this may actually be quite efficient, see
-        // http://stackoverflow.com/questions/25111565/how-to-deallocate-glbufferdata-memory
-        // http://hacksoflife.blogspot.com.au/2015/06/glmapbuffer-no-longer-cool.html )
-        GLsizeiptr nodeBufferSize = perVertexBytes * nodeDrawCount.numVertices;
-        glBufferData(GL_ARRAY_BUFFER, nodeBufferSize, NULL, GL_STREAM_DRAW);
-
-        GLintptr bufferOffset = 0;
+    for (const PoolDraw& poolDraw : poolDraws)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, poolDraw.pool.buffer);
+        GLintptr fieldOffset = 0;
         for (size_t i = 0, k = 0; i < m_fields.size(); k += m_fields[i].spec.arraySize(), ++i)
         {
             const GeomField& field = m_fields[i];
             const int arraySize = field.spec.arraySize();
             const int vecSize = field.spec.vectorSize();
 
-            // TODO?: Could use a single data-array that isn't split into
-            // vertex / normal / color / etc. sections, but has interleaved
-            // data ?  OpenGL has a stride value in glVertexAttribPointer for
-            // exactly this purpose, which should be used for better efficiency
-            // here we write only the current attribute data into this the
-            // buffer (e.g. all positions, then all colors)
-            GLsizeiptr fieldBufferSize = arraySize * vecSize * field.spec.elsize * nodeDrawCount.numVertices;
-
-            // Upload raw data for `field` to the appropriate part of the buffer.
-            char* bufferData = field.data.get() + node->nextBeginIndex*field.spec.size();
-            glBufferSubData(GL_ARRAY_BUFFER, bufferOffset, fieldBufferSize, bufferData);
-
-            // Tell OpenGL how to interpret the buffer of raw data which was
-            // just uploaded.  This should be a single call, but OpenGL spec
-            // insanity says we need `arraySize` calls (though arraySize=1
-            // for most usage.)
+            // The pool buffer either holds all data for each attribute in
+            // turn (e.g. all positions, then all colors), or interleaved
+            // per-point records.
+            GLintptr bufferOffset = fieldOffset*poolDraw.pool.capacity;
+            GLsizei stride = 0;
+            if (m_interleaved)
+            {
+                bufferOffset = m_interleavedOffsets[i];
+                stride = (GLsizei)m_interleavedStride;
+            }
+            fieldOffset += field.spec.size();
+
+            // Tell OpenGL how to interpret the buffer of raw data for the
+            // field.  This should be a single call, but OpenGL spec insanity
+            // says we need `arraySize` calls (though arraySize=1 for most
+            // usage.)
             for (int j = 0; j < arraySize; ++j)
             {
                 const ShaderAttribute* attr = attributes[k+j];
@@ -769,20 +1877,18 @@ DrawCount PointArray::drawPoints(QOpenGLShaderProgram& prog, const TransformStat
                 if (attr->baseType == TypeSpec::Int || attr->baseType == TypeSpec::Uint)
                 {
                     glVertexAttribIPointer(attr->location, vecSize, glBaseType(field.spec),
-                                           0, (const GLvoid *)arrayElementOffset);
+                                           stride, (const GLvoid *)arrayElementOffset);
                 }
                 else
                 {
                     glVertexAttribPointer(attr->location, vecSize, glBaseType(field.spec),
-                                          field.spec.fixedPoint, 0, (const GLvoid *)arrayElementOffset);
+                                          field.spec.fixedPoint, stride, (const GLvoid *)arrayElementOffset);
                 }
             }
-
-            bufferOffset += fieldBufferSize;
         }
 
-        glDrawArrays(GL_POINTS, 0, (GLsizei)nodeDrawCount.numVertices);
-        node->nextBeginIndex += nodeDrawCount.numVertices;
+        glMultiDrawArrays(GL_POINTS, poolDraw.first.data(), poolDraw.count.data(),
+                          (GLsizei)poolDraw.first.size());
     }
     //tfm::printf("Drew %d of total points %d, quality %f\n", totDraw, m_npoints, quality);
 
@@ -14,9 +14,12 @@
 #include "GeomField.h"
 #include "GeometryMutator.h"
 
+class QFile;
 class QOpenGLShaderProgram;
 
+class ClipBox;
 struct OctreeNode;
+struct ScreenLod;
 struct TransformState;
 
 //------------------------------------------------------------------------------
@@ -59,6 +62,22 @@ class PointArray : public Geometry
         /// Probably only useful for debugging.
         void drawTree(QOpenGLShaderProgram& prog, const TransformState& transState) const;
 
+        /// Use an on-disk octree cache when loading files
+        ///
+        /// When enabled, the sorted point fields and octree are written to
+        /// the sidecar file `<fileName>.dzoctree` after loading.  Later loads
+        /// of the unchanged file memory map the cache instead of reading and
+        /// sorting the points, so point data is paged in only as needed.
+        void setUseOctreeCache(bool useCache) { m_useOctreeCache = useCache; }
+
+        /// Keep an interleaved copy of the point fields for drawing
+        ///
+        /// When enabled, all fields are also packed into a single array of
+        /// per-point records after loading, so that each leaf is uploaded to
+        /// the GPU as one contiguous block.  The separate field arrays are
+        /// kept for picking and mutation, so this roughly doubles memory use.
+        void setInterleaveFields(bool interleave) { m_interleaveFields = interleave; }
+
     private:
         bool loadLas(QString fileName, size_t maxPointCount,
                      std::vector<GeomField>& fields, V3d& offset,
@@ -72,8 +91,32 @@ class PointArray : public Geometry
                      std::vector<GeomField>& fields, V3d& offset,
                      size_t& npoints, uint64_t& totalPoints);
 
+        bool loadOctreeCache(QString cacheFileName, QString fileName,
+                             size_t maxPointCount, uint64_t& totalPoints);
+
+        void writeOctreeCache(QString cacheFileName, QString fileName,
+                              size_t maxPointCount, uint64_t totalPoints) const;
+
+        void buildInterleavedFields();
+
+        /// Find the nodes visible with the given model relative transform,
+        /// reusing the previous result if the transform is unchanged.
+        void updateVisibleNodes(const TransformState& relativeTrans) const;
+
+        /// Append `node` and its descendants which aren't culled by
+        /// `clipBox` to m_visibleNodes.  Returns the minimum draw weight of
+        /// the appended nodes.
+        double appendVisibleNodes(const OctreeNode* node, bool inside,
+                                  const ClipBox& clipBox, const V3f& relCamera,
+                                  const ScreenLod& lod) const;
+
         friend struct ProgressFunc;
 
+        bool m_useOctreeCache = false;
+        bool m_interleaveFields = false;
+        /// Memory mapped octree cache holding the field data, if any
+        std::unique_ptr<QFile> m_cacheFile;
+
         /// Total number of loaded points
         size_t m_npoints = 0;
         /// Spatial hierarchy
@@ -83,7 +126,53 @@ class PointArray : public Geometry
         /// A position field is required.  Alias for convenience:
         int m_positionFieldIdx = -1;
         V3f* m_P = nullptr;
-        std::unique_ptr<uint32_t[]> m_inds;
+        /// Inverse of the octree sort permutation, used by mutate().  Points
+        /// either to m_indsStorage or into the octree cache.
+        const uint32_t* m_inds = nullptr;
+        std::unique_ptr<uint32_t[]> m_indsStorage;
+        /// Optional interleaved copy of m_fields, with field `i` of point `j`
+        /// at byte offset `j*m_interleavedStride + m_interleavedOffsets[i]`
+        std::unique_ptr<char[]> m_interleaved;
+        size_t m_interleavedStride = 0;
+        std::vector<size_t> m_interleavedOffsets;
+        /// Shader attribute name for each field array element, and id of
+        /// the names from ShaderAttributeCache::layoutId(), filled in on
+        /// first draw
+        mutable std::vector<std::string> m_attributeNames;
+        mutable size_t m_attributeLayout = 0;
+        /// True once drawPoints() may have stored leaves in LeafBufferCache,
+        /// which is only used from the GL thread.  Geometry which was never
+        /// drawn can be destroyed on any thread.
+        mutable bool m_hasLeafBuffers = false;
+
+        /// Visible node with the draw weight from OctreeNode::drawWeight()
+        ///
+        /// Nodes are stored in depth first order, so the descendants of a
+        /// node are the entries following it up to `subtreeEnd`.  The points
+        /// of descendants only add detail to those of the node, so are drawn
+        /// once all points of the node are.
+        struct VisibleNode
+        {
+            const OctreeNode* node;
+            double weight;
+            size_t subtreeEnd;
+            /// For a subtree entirely inside the view frustum, the minimum
+            /// weight of its nodes: if `quality*subtreeMinWeight >= 1`, all
+            /// points of the subtree are drawn.  Zero otherwise.
+            double subtreeMinWeight;
+        };
+        /// Visible nodes for the most recent transform, shared between
+        /// estimateCost() and drawPoints() and across frames while the
+        /// camera is still.
+        mutable bool m_visibleNodesValid = false;
+        mutable Imath::V2i m_visibleViewSize;
+        mutable Imath::M44d m_visibleProjMatrix;
+        mutable Imath::M44d m_visibleModelViewMatrix;
+        mutable std::vector<VisibleNode> m_visibleNodes;
+        /// Prefix sums over m_visibleNodes of the number of nodes with points
+        mutable std::vector<size_t> m_visibleDrawCalls;
+        /// Scratch space for estimateCost()
+        mutable std::vector<size_t> m_visibleResident;
 };
 
 
@@ -0,0 +1,54 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#ifndef DISPLAZ_RENDERPOLICY_H_INCLUDED
+#define DISPLAZ_RENDERPOLICY_H_INCLUDED
+
+#include <string>
+
+/// Frame time budgets and refinement behaviour for progressive rendering
+///
+/// After the view changes, a frame is drawn at whatever quality
+/// DrawCostModel predicts will fit in `interactiveMillisecs`.  While there is
+/// more to draw, incremental refinement frames follow every
+/// `refineIntervalMillisecs`, each aiming for `refineMillisecs`.
+///
+/// If `maxRefineMillisecs` is positive, refinement stops that long after the
+/// view last changed, leaving the view partially drawn to save power.  With
+/// `settle` enabled, a single final frame then draws all remaining points
+/// regardless of the time it takes, so the view always ends at full quality.
+///
+/// The defaults give the traditional 40 ms frames with unlimited refinement.
+struct RenderPolicy
+{
+    double interactiveMillisecs = 40;
+    double refineMillisecs = 40;
+    int refineIntervalMillisecs = 10;
+    double maxRefineMillisecs = 0;
+    bool settle = false;
+
+    /// Set parameter by name, as used in the SET_RENDER_POLICY message:
+    /// "interactive", "refine", "interval", "refinecap" or "settle".
+    /// Return false if the name or value isn't valid.
+    bool setParameter(const std::string& name, double value)
+    {
+        if (value < 0)
+            return false;
+        if (name == "interactive" && value > 0)
+            interactiveMillisecs = value;
+        else if (name == "refine" && value > 0)
+            refineMillisecs = value;
+        else if (name == "interval")
+            refineIntervalMillisecs = (int)value;
+        else if (name == "refinecap")
+            maxRefineMillisecs = value;
+        else if (name == "settle")
+            settle = value != 0;
+        else
+            return false;
+        return true;
+    }
+};
+
+
+#endif // DISPLAZ_RENDERPOLICY_H_INCLUDED
@@ -18,12 +18,14 @@
 #include <QItemSelectionModel>
 #include <QMessageBox>
 #include <QGLFormat>
+#include <QHash>
 
 #include "config.h"
 #include "fileloader.h"
 #include "QtLogger.h"
 #include "MainWindow.h"
 #include "TriMesh.h"
+#include "LeafBufferCache.h"
 #include "Enable.h"
 #include "Shader.h"
 #include "ShaderProgram.h"
@@ -49,6 +51,8 @@ View3D::View3D(GeometryCollection* geometries, const QGLFormat& format, QWidget
     m_shaderParamsUI(0),
     m_incrementalFrameTimer(0),
     m_incrementalDraw(false),
+    m_redrawGeometry(false),
+    m_settleFrame(false),
     m_devicePixelRatio(1.0)
 {
     connect(m_geometries, SIGNAL(layoutChanged()),                      this, SLOT(geometryChanged()));
@@ -72,7 +76,7 @@ View3D::View3D(GeometryCollection* geometries, const QGLFormat& format, QWidget
     connect(m_shaderProgram.get(), SIGNAL(uniformValuesChanged()),
             this, SLOT(restartRender()));
     connect(m_shaderProgram.get(), SIGNAL(shaderChanged()),
-            this, SLOT(restartRender()));
+            this, SLOT(shaderChanged()));
     connect(m_shaderProgram.get(), SIGNAL(paramsChanged()),
             this, SLOT(setupShaderParamUI()));
     m_enable = std::make_unique<Enable>();
@@ -85,9 +89,33 @@ View3D::View3D(GeometryCollection* geometries, const QGLFormat& format, QWidget
 void View3D::restartRender()
 {
     m_incrementalDraw = false;
+    m_settleFrame = false;
     update();
 }
 
+void View3D::redrawGeometry()
+{
+    m_redrawGeometry = true;
+    update();
+}
+
+void View3D::setRenderPolicy(const RenderPolicy& policy)
+{
+    m_renderPolicy = policy;
+    restartRender();
+}
+
+void View3D::shaderChanged()
+{
+    // Attribute locations may differ in the new shader
+    ShaderAttributeCache::instance().clear();
+    // Per vertex cost depends strongly on the shader, so fit each
+    // separately.  Key by source rather than GL program id, since ids are
+    // recycled when the shader is replaced.
+    m_drawCostModel.setShaderKey(qHash(m_shaderProgram->shaderSource()));
+    restartRender();
+}
+
 void View3D::geometryChanged()
 {
     restartRender();
@@ -108,6 +136,10 @@ void View3D::initializeGLGeometry(int begin, int end)
             geoms[i]->setShaderId("annotation", m_annotationShader->shaderProgram().programId());
             geoms[i]->initializeGL();
         }
+        // Only draw the generic geometry again, so that data arriving in
+        // the background doesn't restart progressive refinement.
+        connect(geoms[i].get(), SIGNAL(redrawRequested()),
+                this, SLOT(redrawGeometry()), Qt::UniqueConnection);
     }
 }
 
@@ -318,6 +350,10 @@ void View3D::initializeGL()
 
     m_incrementalFramebuffer.init(w, h);
 
+    m_gpuFrameTimer.init();
+    if (!m_gpuFrameTimer.isAvailable())
+        g_logger.info("OpenGL timer queries unavailable; using glFinish() for frame timing");
+
     initializeGLGeometry(0, m_geometries->get().size());
 
     // FIXME: Do something about this mess.  The shader editor widget needs to
@@ -400,36 +436,65 @@ void View3D::paintGL()
 
     std::vector<const Geometry*> geoms = selectedGeometry();
 
-    // Aim for 40ms frame time - an ok tradeoff for desktop usage
-    const double targetMillisecs = 40;
-    double quality = m_drawCostModel.quality(targetMillisecs, geoms, transState,
+    if (!m_incrementalDraw)
+        m_refineTimer.start();
+    const double targetMillisecs = m_incrementalDraw ? m_renderPolicy.refineMillisecs :
+                                                       m_renderPolicy.interactiveMillisecs;
+    bool timeFrame = !geoms.empty();
+    if (timeFrame)
+        m_gpuFrameTimer.beginFrame();
+    bool settleFrame = m_settleFrame && m_incrementalDraw;
+    // A settle frame draws everything remaining, however long it takes
+    double quality = settleFrame ? DBL_MAX :
+                     m_drawCostModel.quality(targetMillisecs, geoms, transState,
                                              m_incrementalDraw);
 
     // Render points
+    LeafBufferCache::instance().beginFrame();
     DrawCount drawCount = drawPoints(transState, geoms, quality, m_incrementalDraw);
 
     // Draw meshes and lines
     if (!m_incrementalDraw)
-    {
         drawMeshes(transState, geoms);
-        // Generic draw for any other geometry
-        // (TODO: make all geometries use this interface, or something similar)
-        // FIXME - Do generic quality scaling
+    // Generic draw for any other geometry, also on top of an incremental
+    // frame when geometry has new data to show.
+    // (TODO: make all geometries use this interface, or something similar)
+    // FIXME - Do generic quality scaling
+    if (!m_incrementalDraw || m_redrawGeometry)
+    {
         const double quality = 1;
         for (size_t i = 0; i < geoms.size(); ++i)
             geoms[i]->draw(transState, quality);
     }
+    m_redrawGeometry = false;
 
     // Measure frame time to update estimate for how much geometry we can draw
-    // with a reasonable frame rate
-    glFinish();
-    int frameTime = frameTimer.elapsed();
+    // with a reasonable frame rate.  Timer query results arrive a frame or
+    // two late, but avoid stalling the pipeline with glFinish().
+    if (m_gpuFrameTimer.isAvailable())
+    {
+        if (timeFrame)
+        {
+            m_gpuFrameTimer.endFrame(drawCount, m_drawCostModel.shaderKey(),
+                                     frameTimer.nsecsElapsed()*1e-6);
+        }
+        std::vector<GpuFrameTimer::Sample> samples;
+        m_gpuFrameTimer.collectSamples(samples);
+        for (const GpuFrameTimer::Sample& sample : samples)
+        {
+            m_drawCostModel.addSample(sample.drawCount, sample.frameMillisecs,
+                                      sample.shaderKey);
+        }
+    }
+    else if (timeFrame)
+    {
+        glFinish();
+        m_drawCostModel.addSample(drawCount, frameTimer.elapsed(),
+                                  m_drawCostModel.shaderKey());
+    }
 
     glCheckError();
 
-    if (!geoms.empty())
-        m_drawCostModel.addSample(drawCount, frameTime);
-
     // Debug: print bar showing how well we're sticking to the frame time
 //    int barSize = 40;
 //    std::string s = std::string(barSize*frameTime/targetMillisecs, '=');
@@ -490,10 +555,18 @@ void View3D::paintGL()
     }
 
     // Set up timer to draw a high quality frame if necessary
-    if (!drawCount.moreToDraw)
+    bool refine = drawCount.moreToDraw && !settleFrame;
+    if (refine && m_renderPolicy.maxRefineMillisecs > 0 &&
+        m_refineTimer.elapsed() > m_renderPolicy.maxRefineMillisecs)
+    {
+        // Out of refinement time: stop, or finish with a settle frame
+        refine = m_renderPolicy.settle;
+        m_settleFrame = m_renderPolicy.settle;
+    }
+    if (!refine)
         m_incrementalFrameTimer->stop();
     else
-        m_incrementalFrameTimer->start(10);
+        m_incrementalFrameTimer->start(m_renderPolicy.refineIntervalMillisecs);
 
     m_incrementalDraw = true;
 }
@@ -13,10 +13,13 @@
 
 
 #include <QVector>
+#include <QElapsedTimer>
 #include <QGLWidget>
 #include <QModelIndex>
 
 #include "DrawCostModel.h"
+#include "GpuFrameTimer.h"
+#include "RenderPolicy.h"
 #include "InteractiveCamera.h"
 #include "geometrycollection.h"
 #include "Annotation.h"
@@ -50,6 +53,13 @@ class View3D : public QGLWidget
 
         InteractiveCamera& camera() { return m_camera; }
 
+        /// Return model used to choose the draw quality for each frame
+        DrawCostModel& drawCostModel() { return m_drawCostModel; }
+
+        /// Frame time budgets and refinement behaviour
+        const RenderPolicy& renderPolicy() const { return m_renderPolicy; }
+        void setRenderPolicy(const RenderPolicy& policy);
+
         QColor background() const { return m_backgroundColor; }
 
         Imath::V3d cursorPos() const { return m_cursorPos; }
@@ -94,7 +104,11 @@ class View3D : public QGLWidget
 
     private slots:
         void restartRender();
+        /// Draw generic geometry again in the next frame, without restarting
+        /// progressive refinement
+        void redrawGeometry();
         void setupShaderParamUI();
+        void shaderChanged();
 
         void geometryChanged();
         void dataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
@@ -169,8 +183,18 @@ class View3D : public QGLWidget
         QTimer* m_incrementalFrameTimer;
         Framebuffer m_incrementalFramebuffer;
         bool m_incrementalDraw;
+        /// Geometry has new data to draw in the next frame, even if
+        /// incremental
+        bool m_redrawGeometry;
+        /// Time since the last non-incremental frame
+        QElapsedTimer m_refineTimer;
+        /// Draw everything remaining in the next incremental frame
+        bool m_settleFrame;
+        RenderPolicy m_renderPolicy;
         /// Controller for amount of geometry to draw
         DrawCostModel m_drawCostModel;
+        /// Frame time measurement for m_drawCostModel
+        GpuFrameTimer m_gpuFrameTimer;
         /// GL textures
         std::unique_ptr<QOpenGLTexture> m_drawAxesBackground;
         std::unique_ptr<QOpenGLTexture> m_drawAxesLabelX;
@@ -274,6 +274,51 @@ const ShaderAttribute* findAttr(const std::string& name,
 
 
 
+ShaderAttributeCache& ShaderAttributeCache::instance()
+{
+    static ShaderAttributeCache cache;
+    return cache;
+}
+
+
+size_t ShaderAttributeCache::layoutId(const std::vector<std::string>& attrNames)
+{
+    auto found = m_layoutIds.find(attrNames);
+    if (found != m_layoutIds.end())
+        return found->second;
+    size_t id = m_layouts.size();
+    m_layouts.push_back(attrNames);
+    m_layoutIds[attrNames] = id;
+    return id;
+}
+
+
+const ShaderAttributeBinding& ShaderAttributeCache::binding(GLuint prog, size_t layout)
+{
+    auto key = std::make_pair(prog, layout);
+    auto found = m_bindings.find(key);
+    if (found != m_bindings.end())
+        return found->second;
+    // Fill in place so that pointers into activeAttrs stay valid
+    ShaderAttributeBinding& binding = m_bindings[key];
+    binding.activeAttrs = activeShaderAttributes(prog);
+    std::vector<bool> isBound(binding.activeAttrs.size(), false);
+    for (const std::string& name : m_layouts.at(layout))
+    {
+        const ShaderAttribute* attr = findAttr(name, binding.activeAttrs);
+        binding.attrs.push_back(attr);
+        if (attr)
+            isBound[attr - binding.activeAttrs.data()] = true;
+    }
+    for (size_t i = 0; i < binding.activeAttrs.size(); ++i)
+    {
+        if (!isBound[i])
+            binding.unboundAttrs.push_back(&binding.activeAttrs[i]);
+    }
+    return binding;
+}
+
+
 void printActiveShaderAttributes(GLuint prog)
 {
     std::vector<ShaderAttribute> attrs = activeShaderAttributes(prog);
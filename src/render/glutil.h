@@ -18,6 +18,7 @@
 #include <QImage>
 #include <QGLWidget>
 
+#include <map>
 #include <vector>
 #include <cassert>
 
@@ -264,4 +265,51 @@ const ShaderAttribute* findAttr(const std::string& name,
                                 const std::vector<ShaderAttribute>& attrs);
 
 
+/// Matching of named vertex attributes against the active attributes of a
+/// shader program
+struct ShaderAttributeBinding
+{
+    /// All active attributes of the shader
+    std::vector<ShaderAttribute> activeAttrs;
+    /// Attribute matching each of the requested names, or null if inactive
+    std::vector<const ShaderAttribute*> attrs;
+    /// Active attributes which don't match any of the requested names
+    std::vector<const ShaderAttribute*> unboundAttrs;
+};
+
+
+/// Cache of ShaderAttributeBinding for each shader program and list of
+/// attribute names
+///
+/// Querying the active attributes of a shader forces a round trip to the
+/// OpenGL driver, so this should be done once per shader rather than each
+/// time geometry is drawn.  Lists of names are registered once with
+/// layoutId(), so that looking up a binding while drawing only compares
+/// integers.  The cache must be cleared whenever a shader program is
+/// relinked or deleted, since program ids may be reused.
+class ShaderAttributeCache
+{
+    public:
+        /// Get the cache shared by all geometry
+        static ShaderAttributeCache& instance();
+
+        /// Get id of the attribute names `attrNames`, for use with
+        /// binding().  Equal lists of names have the same id, which remains
+        /// valid after clear().
+        size_t layoutId(const std::vector<std::string>& attrNames);
+
+        /// Get binding of the attributes named by layout `layout` to the
+        /// shader program `prog`.  The result is valid until clear() is
+        /// called.
+        const ShaderAttributeBinding& binding(GLuint prog, size_t layout);
+
+        void clear() { m_bindings.clear(); }
+
+    private:
+        std::map<std::vector<std::string>, size_t> m_layoutIds;
+        std::vector<std::vector<std::string>> m_layouts;
+        std::map<std::pair<GLuint, size_t>, ShaderAttributeBinding> m_bindings;
+};
+
+
 #endif // GLUTIL_H_INCLUDED
@@ -0,0 +1,532 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include "streampagecache.h"
+
+#include "config.h"
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <cerrno>
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <sys/uio.h>
+#   include <unistd.h>
+#endif
+
+
+static const intptr_t invalidFile = -1;
+
+
+#ifdef _WIN32
+
+static intptr_t openFile(const std::string& fileName, uint64_t& fileSize)
+{
+    // Convert UTF-8 file name to windows-native UTF-16
+    std::wstring wideName(MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), -1, NULL, 0), 0);
+    MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), -1, &wideName[0], (int)wideName.size());
+    HANDLE file = CreateFileW(wideName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if (file == INVALID_HANDLE_VALUE)
+        return invalidFile;
+    if (!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        return invalidFile;
+    }
+    fileSize = size.QuadPart;
+    return (intptr_t)file;
+}
+
+static void closeFile(intptr_t file)
+{
+    CloseHandle((HANDLE)file);
+}
+
+/// Read up to `length` bytes at `offset` into consecutive buffers of
+/// `bufSize` bytes each, returning the number read
+static uint64_t readFileAt(intptr_t file, char* const* bufs, uint64_t bufSize,
+                           uint64_t offset, uint64_t length)
+{
+    uint64_t totRead = 0;
+    while (totRead < length)
+    {
+        // Overlapped offsets make the read positional, so concurrent reads
+        // don't interfere.
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = (DWORD)(offset + totRead);
+        overlapped.OffsetHigh = (DWORD)((offset + totRead) >> 32);
+        uint64_t bufOffset = totRead % bufSize;
+        DWORD toRead = (DWORD)std::min(bufSize - bufOffset, length - totRead);
+        DWORD nread = 0;
+        if (!ReadFile((HANDLE)file, bufs[totRead/bufSize] + bufOffset, toRead,
+                      &nread, &overlapped) || nread == 0)
+            break;
+        totRead += nread;
+    }
+    return totRead;
+}
+
+static const char* mapFile(intptr_t file, intptr_t& mapping)
+{
+    HANDLE m = CreateFileMappingW((HANDLE)file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m)
+        return nullptr;
+    const char* data = (const char*)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+    {
+        CloseHandle(m);
+        return nullptr;
+    }
+    mapping = (intptr_t)m;
+    return data;
+}
+
+static void unmapFile(const char* data, uint64_t /*size*/, intptr_t mapping)
+{
+    UnmapViewOfFile(data);
+    CloseHandle((HANDLE)mapping);
+}
+
+static void adviseWillNeed(const char* /*data*/, uint64_t /*length*/)
+{
+    // Nothing portable before windows 8; touching the pages is enough.
+}
+
+static void adviseDontNeed(const char* data, uint64_t length)
+{
+    // Only release whole pages within the range, which no other cache page
+    // shares.  Unlocking pages which aren't locked removes them from the
+    // working set; they're read from the file again if touched later.
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    uintptr_t pageMask = (uintptr_t)info.dwPageSize - 1;
+    uintptr_t begin = ((uintptr_t)data + pageMask) & ~pageMask;
+    uintptr_t end = ((uintptr_t)data + length) & ~pageMask;
+    if (begin < end)
+        VirtualUnlock((void*)begin, end - begin);
+}
+
+#else
+
+static intptr_t openFile(const std::string& fileName, uint64_t& fileSize)
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0)
+        return invalidFile;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return invalidFile;
+    }
+    fileSize = st.st_size;
+    return fd;
+}
+
+static void closeFile(intptr_t file)
+{
+    close((int)file);
+}
+
+/// Read up to `length` bytes at `offset` into consecutive buffers of
+/// `bufSize` bytes each, returning the number read
+static uint64_t readFileAt(intptr_t file, char* const* bufs, uint64_t bufSize,
+                           uint64_t offset, uint64_t length)
+{
+    uint64_t totRead = 0;
+    while (totRead < length)
+    {
+#ifdef DISPLAZ_HAVE_PREADV
+        // Scatter into the remaining buffers with a single call.  POSIX
+        // guarantees at least 16 iovecs.
+        const int maxIov = 16;
+        struct iovec iov[maxIov];
+        int numIov = 0;
+        for (uint64_t pos = totRead; pos < length && numIov < maxIov; ++numIov)
+        {
+            uint64_t bufOffset = pos % bufSize;
+            uint64_t n = std::min(bufSize - bufOffset, length - pos);
+            iov[numIov].iov_base = bufs[pos/bufSize] + bufOffset;
+            iov[numIov].iov_len = n;
+            pos += n;
+        }
+        ssize_t nread = preadv((int)file, iov, numIov, offset + totRead);
+#else
+        uint64_t bufOffset = totRead % bufSize;
+        ssize_t nread = pread((int)file, bufs[totRead/bufSize] + bufOffset,
+                              std::min(bufSize - bufOffset, length - totRead),
+                              offset + totRead);
+#endif
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            break;
+        totRead += nread;
+    }
+    return totRead;
+}
+
+static const char* mapFile(intptr_t file, intptr_t& /*mapping*/)
+{
+    struct stat st;
+    if (fstat((int)file, &st) != 0 || st.st_size == 0)
+        return nullptr;
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, (int)file, 0);
+    return data == MAP_FAILED ? nullptr : (const char*)data;
+}
+
+static void unmapFile(const char* data, uint64_t size, intptr_t /*mapping*/)
+{
+    munmap((void*)data, size);
+}
+
+static void adviseWillNeed(const char* data, uint64_t length)
+{
+    uintptr_t pageMask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t begin = (uintptr_t)data & ~pageMask;
+    madvise((void*)begin, (uintptr_t)data + length - begin, MADV_WILLNEED);
+}
+
+static void adviseDontNeed(const char* data, uint64_t length)
+{
+    // Only release whole pages within the range, which no other cache page
+    // shares.  The mapping is read only, so released pages are read from the
+    // file again if touched later.
+    uintptr_t pageMask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t begin = ((uintptr_t)data + pageMask) & ~pageMask;
+    uintptr_t end = ((uintptr_t)data + length) & ~pageMask;
+    if (begin < end)
+        madvise((void*)begin, end - begin, MADV_DONTNEED);
+}
+
+#endif
+
+
+//------------------------------------------------------------------------------
+StreamPageCache::StreamPageCache(std::istream& input, PosType pageSize)
+    : m_input(&input),
+    m_file(invalidFile),
+    m_mapped(nullptr),
+    m_mapping(invalidFile),
+    m_pageSize(pageSize),
+    m_fileSize(0),
+    m_maxBytes(UINT64_MAX),
+    m_maxReadBytes(4*1024*1024),
+    m_frame(0),
+    m_stopFetch(false),
+    m_fetchedPages(nullptr)
+{
+    m_input->seekg(0, std::ios::end);
+    m_fileSize = static_cast<PosType>(m_input->tellg());
+    m_input->seekg(0);
+    if (!*m_input)
+        throw DisplazError("Page cache could not open file");
+}
+
+
+StreamPageCache::StreamPageCache(const std::string& fileName, PosType pageSize,
+                                 FileAccess access)
+    : m_input(nullptr),
+    m_file(invalidFile),
+    m_mapped(nullptr),
+    m_mapping(invalidFile),
+    m_pageSize(pageSize),
+    m_fileSize(0),
+    m_maxBytes(UINT64_MAX),
+    m_maxReadBytes(4*1024*1024),
+    m_frame(0),
+    m_stopFetch(false),
+    m_fetchedPages(nullptr)
+{
+    m_file = openFile(fileName, m_fileSize);
+    if (m_file == invalidFile)
+        throw DisplazError("Page cache could not open file %s", fileName);
+    if (access == Access_MemoryMap)
+        m_mapped = mapFile(m_file, m_mapping);
+}
+
+
+StreamPageCache::~StreamPageCache()
+{
+    stopFetchThreads();
+    collectFetched();
+    if (m_mapped)
+        unmapFile(m_mapped, m_fileSize, m_mapping);
+    if (m_file != invalidFile)
+        closeFile(m_file);
+}
+
+
+std::vector<std::unique_ptr<char[]>> StreamPageCache::readPages(PosType firstPage,
+                                                               PosType numPages)
+{
+    PosType offset = firstPage*m_pageSize;
+    PosType length = std::min(numPages*m_pageSize, m_fileSize - offset);
+    std::vector<std::unique_ptr<char[]>> pages(numPages);
+    if (m_mapped)
+    {
+        // Fault the pages in now, so that reading them later won't block
+        const volatile char* data = m_mapped + offset;
+        adviseWillNeed(m_mapped + offset, length);
+        char touched = 0;
+        for (PosType i = 0; i < length; i += 4096)
+            touched ^= data[i];
+        (void)touched;
+        return pages;
+    }
+    std::vector<char*> bufs(numPages);
+    for (PosType i = 0; i < numPages; ++i)
+    {
+        pages[i].reset(new char[m_pageSize]);
+        bufs[i] = pages[i].get();
+    }
+    PosType nread = 0;
+    if (m_input)
+    {
+        // Adjacent pages need only a single seek
+        std::lock_guard<std::mutex> lock(m_inputMutex);
+        m_input->clear();
+        m_input->seekg(offset);
+        for (PosType i = 0; i < numPages && nread == i*m_pageSize; ++i)
+        {
+            m_input->read(bufs[i], std::min(m_pageSize, length - i*m_pageSize));
+            nread += m_input->gcount();
+        }
+    }
+    else
+    {
+        nread = readFileAt(m_file, bufs.data(), m_pageSize, offset, length);
+    }
+    for (PosType i = 0; i < numPages; ++i)
+    {
+        PosType pageRead = (nread > i*m_pageSize) ? std::min(m_pageSize, nread - i*m_pageSize) : 0;
+        std::fill(bufs[i] + pageRead, bufs[i] + m_pageSize, 0);
+    }
+    return pages;
+}
+
+
+double StreamPageCache::takePendingPage(PosType pageIdx)
+{
+    auto page = m_pendingPages.find(pageIdx);
+    double priority = page->second.priority;
+    m_pendingPages.erase(page);
+    m_fetchingPages.insert(pageIdx);
+    return priority;
+}
+
+
+void StreamPageCache::takePendingRun(std::vector<std::pair<PosType, double>>& run)
+{
+    // Start with the highest priority page, and extend to adjacent pending
+    // pages on either side.
+    auto best = std::max_element(m_pendingPages.begin(), m_pendingPages.end(),
+        [](const std::pair<const PosType, PendingRequest>& a,
+           const std::pair<const PosType, PendingRequest>& b)
+        { return a.second.priority < b.second.priority; });
+    PosType maxPages = std::max<PosType>(1, m_maxReadBytes/m_pageSize);
+    PosType first = best->first;
+    PosType end = first + 1;
+    while (end - first < maxPages)
+    {
+        if (m_pendingPages.count(end))
+            ++end;
+        else if (first > 0 && m_pendingPages.count(first - 1))
+            --first;
+        else
+            break;
+    }
+    run.clear();
+    for (PosType pageIdx = first; pageIdx < end; ++pageIdx)
+        run.push_back(std::make_pair(pageIdx, takePendingPage(pageIdx)));
+}
+
+
+void StreamPageCache::addPage(PosType pageIdx, std::unique_ptr<char[]> data, double priority)
+{
+    assert(m_pages.find(pageIdx) == m_pages.end());
+    CachedPage& page = m_pages[pageIdx];
+    page.data = std::move(data);
+    page.lastUsedFrame = m_frame;
+    page.priority = priority;
+    ++m_stats.fetches;
+}
+
+
+void StreamPageCache::evict()
+{
+    if (cachedBytes() <= m_maxBytes)
+        return;
+    typedef std::pair<std::pair<uint64_t, double>, PosType> EvictOrder;
+    std::vector<EvictOrder> candidates;
+    for (const auto& page : m_pages)
+    {
+        if (page.second.lastUsedFrame != m_frame)
+        {
+            candidates.push_back(EvictOrder(std::make_pair(page.second.lastUsedFrame,
+                                                           page.second.priority), page.first));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    for (size_t i = 0; i < candidates.size() && cachedBytes() > m_maxBytes; ++i)
+    {
+        PosType pageIdx = candidates[i].second;
+        m_pages.erase(pageIdx);
+        ++m_stats.evictions;
+        // Release the memory of mapped pages too, as for pages read into
+        // buffers
+        if (m_mapped)
+        {
+            PosType offset = pageIdx*m_pageSize;
+            adviseDontNeed(m_mapped + offset, std::min(m_pageSize, m_fileSize - offset));
+        }
+    }
+}
+
+
+size_t StreamPageCache::fetchNow(PosType maxBytes)
+{
+    // Choose the highest priority pages, then read them in file order with
+    // runs of adjacent pages merged into single reads.
+    std::vector<std::pair<PosType, double>> fetchPages;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        typedef std::pair<double, PosType> PendingPage;
+        std::vector<PendingPage> priorityPages;
+        for (auto p = m_pendingPages.begin(); p != m_pendingPages.end(); ++p)
+            priorityPages.push_back(PendingPage(p->second.priority, p->first));
+        size_t numFetch = std::min<PosType>((maxBytes + m_pageSize - 1)/m_pageSize,
+                                            priorityPages.size());
+        std::nth_element(priorityPages.begin(), priorityPages.begin() + numFetch,
+                         priorityPages.end(), std::greater<PendingPage>());
+        for (size_t i = 0; i < numFetch; ++i)
+        {
+            PosType pageIdx = priorityPages[i].second;
+            fetchPages.push_back(std::make_pair(pageIdx, takePendingPage(pageIdx)));
+        }
+    }
+    std::sort(fetchPages.begin(), fetchPages.end());
+    PosType maxRunPages = std::max<PosType>(1, m_maxReadBytes/m_pageSize);
+    for (size_t begin = 0, end = 0; begin < fetchPages.size(); begin = end)
+    {
+        end = begin + 1;
+        while (end < fetchPages.size() && end - begin < maxRunPages &&
+               fetchPages[end].first == fetchPages[end-1].first + 1)
+            ++end;
+        std::vector<std::unique_ptr<char[]>> pages =
+            readPages(fetchPages[begin].first, end - begin);
+        for (size_t i = begin; i < end; ++i)
+            addPage(fetchPages[i].first, std::move(pages[i - begin]), fetchPages[i].second);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        for (const auto& page : fetchPages)
+            m_fetchingPages.erase(page.first);
+    }
+    evict();
+    return fetchPages.size();
+}
+
+
+size_t StreamPageCache::cancelUnrequested()
+{
+    std::lock_guard<std::mutex> lock(m_pendingMutex);
+    size_t numCancelled = 0;
+    for (auto page = m_pendingPages.begin(); page != m_pendingPages.end(); )
+    {
+        if (page->second.lastRequestFrame != m_frame)
+        {
+            page = m_pendingPages.erase(page);
+            ++numCancelled;
+        }
+        else
+            ++page;
+    }
+    m_stats.cancelled += numCancelled;
+    return numCancelled;
+}
+
+
+void StreamPageCache::startFetchThreads(int numThreads, std::function<void()> pageFetched)
+{
+    assert(m_fetchThreads.empty());
+    m_pageFetched = pageFetched;
+    for (int i = 0; i < numThreads; ++i)
+        m_fetchThreads.emplace_back(&StreamPageCache::fetchThreadLoop, this);
+}
+
+
+void StreamPageCache::stopFetchThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        m_stopFetch = true;
+    }
+    m_fetchWakeup.notify_all();
+    for (std::thread& thread : m_fetchThreads)
+        thread.join();
+    m_fetchThreads.clear();
+}
+
+
+void StreamPageCache::fetchThreadLoop()
+{
+    std::vector<std::pair<PosType, double>> run;
+    std::unique_lock<std::mutex> lock(m_pendingMutex);
+    while (true)
+    {
+        m_fetchWakeup.wait(lock, [this]() { return m_stopFetch || !m_pendingPages.empty(); });
+        if (m_stopFetch)
+            return;
+        takePendingRun(run);
+        lock.unlock();
+        std::vector<std::unique_ptr<char[]>> pages = readPages(run[0].first, run.size());
+        for (size_t i = 0; i < run.size(); ++i)
+        {
+            FetchedPage* page = new FetchedPage{run[i].first, run[i].second,
+                                                std::move(pages[i]), nullptr};
+            // Push onto the list of fetched pages
+            page->next = m_fetchedPages.load(std::memory_order_relaxed);
+            while (!m_fetchedPages.compare_exchange_weak(page->next, page,
+                                                         std::memory_order_release,
+                                                         std::memory_order_relaxed))
+            { }
+        }
+        if (m_pageFetched)
+            m_pageFetched();
+        lock.lock();
+    }
+}
+
+
+size_t StreamPageCache::collectFetched()
+{
+    FetchedPage* page = m_fetchedPages.exchange(nullptr, std::memory_order_acquire);
+    if (!page)
+        return 0;
+    std::vector<PosType> fetchedIndices;
+    while (page)
+    {
+        std::unique_ptr<FetchedPage> fetched(page);
+        page = page->next;
+        fetchedIndices.push_back(fetched->pageIdx);
+        addPage(fetched->pageIdx, std::move(fetched->data), fetched->priority);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        for (PosType pageIdx : fetchedIndices)
+            m_fetchingPages.erase(pageIdx);
+    }
+    evict();
+    return fetchedIndices.size();
+}
@@ -5,13 +5,17 @@
 #define STREAM_PAGE_CACHE_H_INCLUDED
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstdint>
 #include <fstream>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string.h>
 #include <stdexcept>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -22,26 +26,83 @@
 ///
 /// This interface allows the application to specify data to be fetched, along
 /// with a priority for the data.
+///
+/// Pages may be fetched synchronously with fetchNow(), or in the background
+/// by threads started with startFetchThreads().  Except for these threads,
+/// the cache should only be used from a single thread.
+///
+/// Adjacent pages waiting to be fetched are read together with a single
+/// (vectored, where available) read, up to a size set by setMaxReadBytes().
+///
+/// Requests which are no longer wanted may be dropped with
+/// cancelUnrequested() before they're fetched.
+///
+/// The size of the cache may be limited with setMaxBytes().  Pages not used
+/// since the start of the current frame (see beginFrame()) are then evicted,
+/// least recently used first and lowest priority first among those last
+/// used in the same frame.  For a memory mapped file, the memory of evicted
+/// pages is released back to the operating system.
 class StreamPageCache
 {
     public:
         typedef uint64_t PosType;
 
-        StreamPageCache(std::istream& input, PosType pageSize = 512*1024)
-            : m_input(input),
-            m_pageSize(pageSize)
+        /// How a cache opened by file name accesses the file
+        enum FileAccess
         {
-            m_input.seekg(0, std::ios::end);
-            m_fileSize = static_cast<PosType>(m_input.tellg());
-            m_input.seekg(0);
-            if (!m_input)
-                throw DisplazError("Page cache could not open file");
-        }
+            Access_Read,      ///< Copy pages into buffers with positional reads
+            Access_MemoryMap  ///< Memory map the file and read pages in place
+        };
+
+        /// Cache pages of `input`
+        ///
+        /// Background fetch threads share the stream, so only one page is
+        /// read at a time.
+        StreamPageCache(std::istream& input, PosType pageSize = 512*1024);
+
+        /// Cache pages of the file `fileName`
+        ///
+        /// Pages are read with positional reads on a file descriptor, so
+        /// several background fetch threads can read at once.  With
+        /// Access_MemoryMap, the file is instead mapped into memory, and
+        /// fetching a page only brings it into memory; span() then gives
+        /// access to cached data without copying.  If the file can't be
+        /// mapped, pages are read as for Access_Read.
+        StreamPageCache(const std::string& fileName, PosType pageSize = 512*1024,
+                        FileAccess access = Access_Read);
+
+        ~StreamPageCache();
+
+        /// Counts of cache accesses since construction
+        struct Stats
+        {
+            uint64_t hits = 0;      ///< Successful read() calls
+            uint64_t misses = 0;    ///< read() calls for uncached data
+            uint64_t fetches = 0;   ///< Pages fetched
+            uint64_t evictions = 0; ///< Pages evicted to keep within budget
+            uint64_t cancelled = 0; ///< Requested pages cancelled before fetching
+        };
+
+        /// Set maximum total size of cached pages
+        void setMaxBytes(PosType maxBytes) { m_maxBytes = maxBytes; evict(); }
+
+        /// Set maximum size of a single read when fetching runs of
+        /// adjacent pages.  At least one page is always read.
+        void setMaxReadBytes(PosType maxReadBytes) { m_maxReadBytes = maxReadBytes; }
+
+        /// Total size of cached pages
+        PosType cachedBytes() const { return m_pages.size()*m_pageSize; }
+
+        const Stats& stats() const { return m_stats; }
+
+        /// Start a new frame.  Pages used during the current frame are
+        /// never evicted.
+        void beginFrame() { ++m_frame; }
 
         /// Mark pages overlapping the given range for fetching
         ///
-        /// Page priority is taken as the maximum of any fetch requests which
-        /// overlap the given page.
+        /// Page priority is taken as the maximum of any fetch requests in
+        /// the current frame which overlap the given page.
         ///
         /// prefetch() does not do any actual fetching of data;  it returns
         /// immediately with status indicating whether the data is already
@@ -56,19 +117,39 @@ class StreamPageCache
             PosType pagesBegin = pageIndex(offset);
             PosType pagesEnd = pageIndex(offset + length - 1) + 1;
             bool inCache = true;
+            bool addedPages = false;
+            std::unique_lock<std::mutex> lock(m_pendingMutex, std::defer_lock);
             for (PosType pageIdx = pagesBegin; pageIdx < pagesEnd; ++pageIdx)
             {
                 auto page = m_pages.find(pageIdx);
-                if (page == m_pages.end())
+                if (page != m_pages.end())
+                {
+                    touchPage(page->second, priority);
+                }
+                else
                 {
+                    if (!lock.owns_lock())
+                        lock.lock();
+                    inCache = false;
+                    if (m_fetchingPages.count(pageIdx))
+                        continue;
                     auto pendingPage = m_pendingPages.find(pageIdx);
                     if (pendingPage == m_pendingPages.end())
-                        m_pendingPages[pageIdx] = priority;
-                    else if (pendingPage->second < priority)
-                        pendingPage->second = priority;
-                    inCache = false;
+                    {
+                        m_pendingPages[pageIdx] = PendingRequest{priority, m_frame};
+                        addedPages = true;
+                    }
+                    else
+                    {
+                        PendingRequest& request = pendingPage->second;
+                        if (request.lastRequestFrame != m_frame || request.priority < priority)
+                            request.priority = priority;
+                        request.lastRequestFrame = m_frame;
+                    }
                 }
             }
+            if (addedPages)
+                m_fetchWakeup.notify_all();
             return inCache;
         }
 
@@ -87,8 +168,10 @@ class StreamPageCache
                 if (page == m_pages.end())
                 {
                     //tfm::printf("Didn't find page %d\n", pageIdx);
+                    ++m_stats.misses;
                     return false;
                 }
+                page->second.lastUsedFrame = m_frame;
                 PosType pageOffsetBegin = pageIdx * m_pageSize;
                 PosType pageOffsetEnd   = (pageIdx+1) * m_pageSize;
                 // Range of bytes to copy within page
@@ -98,49 +181,165 @@ class StreamPageCache
                                     offset + length - pageOffsetBegin : m_pageSize;
                 PosType nbytes = byteEnd - byteBegin;
                 //tfm::printf("read(): byteBegin = %d, byteEnd = %d\n", byteBegin, byteEnd);
-                memcpy(buf, page->second.get() + byteBegin, nbytes);
+                const char* pageData = m_mapped ? m_mapped + pageOffsetBegin :
+                                                  page->second.data.get();
+                memcpy(buf, pageData + byteBegin, nbytes);
                 buf += nbytes;
             }
+            ++m_stats.hits;
             return true;
         }
 
-        /// Fetch a bunch of pages which have been previously marked.
+        /// Return pointer to the `length` bytes at `offset` in place in the
+        /// memory mapped file
         ///
-        /// Eventually this will probably happen in the background
-        size_t fetchNow(size_t numFetch)
+        /// Returns null if the file isn't memory mapped or the range isn't
+        /// in the cache.  The data remains valid for the lifetime of the
+        /// cache, but the memory of evicted pages is released, so accessing
+        /// it afterward reads the file again.  Use prefetch() to keep pages
+        /// in use from being evicted.
+        const char* span(PosType offset, PosType length)
         {
-            typedef std::pair<double, PosType> PendingPage;
-            std::vector<PendingPage> priorityPages;
-            for (auto p = m_pendingPages.begin(); p != m_pendingPages.end(); ++p)
-                priorityPages.push_back(PendingPage(p->second, p->first));
-            numFetch = std::min(numFetch, priorityPages.size());
-            std::nth_element(priorityPages.begin(), priorityPages.begin() + numFetch,
-                             priorityPages.end(), std::greater<PendingPage>());
-            for (size_t i = 0; i < numFetch; ++i)
+            if (!m_mapped || length == 0 || offset + length > m_fileSize)
+                return nullptr;
+            PosType pagesBegin = pageIndex(offset);
+            PosType pagesEnd = pageIndex(offset + length - 1) + 1;
+            for (PosType pageIdx = pagesBegin; pageIdx < pagesEnd; ++pageIdx)
             {
-                PosType pageIdx = priorityPages[i].second;
-                std::unique_ptr<char[]>& buf = m_pages[pageIdx];
-                assert(!buf);
-                buf.reset(new char[m_pageSize]);
-                PosType pageOffset = pageIdx*m_pageSize;
-                m_input.seekg(pageOffset);
-                m_input.read(buf.get(), std::min(m_pageSize, m_fileSize - pageOffset));
-                m_pendingPages.erase(pageIdx);
+                if (m_pages.find(pageIdx) == m_pages.end())
+                    return nullptr;
             }
-            return numFetch;
+            for (PosType pageIdx = pagesBegin; pageIdx < pagesEnd; ++pageIdx)
+                m_pages[pageIdx].lastUsedFrame = m_frame;
+            ++m_stats.hits;
+            return m_mapped + offset;
         }
 
+        /// Fetch the highest priority pages which have been previously
+        /// marked, up to `maxBytes` rounded up to a whole number of pages,
+        /// blocking until they're read.
+        ///
+        /// Return the number of pages fetched.
+        size_t fetchNow(PosType maxBytes);
+
+        /// Drop pages marked for fetching which haven't been requested with
+        /// prefetch() since the start of the current frame
+        ///
+        /// Pages already being read are unaffected.  Return the number of
+        /// pages dropped.
+        size_t cancelUnrequested();
+
+        /// Start `numThreads` threads to fetch marked pages in the
+        /// background, highest priority first
+        ///
+        /// Fetched pages are available to read() after the next call to
+        /// collectFetched().  If given, `pageFetched` is called from the
+        /// fetching thread after each read, which may fetch several pages.
+        void startFetchThreads(int numThreads,
+                               std::function<void()> pageFetched = std::function<void()>());
+
+        /// Stop and join the threads started by startFetchThreads()
+        ///
+        /// Pages being read are finished first, but no more are started,
+        /// and the `pageFetched` callback is never called again.
+        void stopFetchThreads();
+
+        /// Add pages fetched by the background threads to the cache
+        ///
+        /// Added pages count as used in the current frame, and may evict
+        /// pages used in earlier frames.  Call this before beginFrame() so
+        /// that pages from the previous frame are kept.  Return the number
+        /// of pages added.
+        size_t collectFetched();
+
     private:
+        struct CachedPage
+        {
+            std::unique_ptr<char[]> data; ///< Null for memory mapped files
+            uint64_t lastUsedFrame;
+            double priority; ///< Priority of the latest prefetch() requests
+        };
+
+        /// Page read by a fetch thread, in a singly linked list for lock free
+        /// handover to the thread using the cache
+        struct FetchedPage
+        {
+            PosType pageIdx;
+            double priority;
+            std::unique_ptr<char[]> data;
+            FetchedPage* next;
+        };
+
+        /// Page marked for fetching
+        struct PendingRequest
+        {
+            double priority;
+            uint64_t lastRequestFrame;
+        };
+
+        /// Mark page as used by a prefetch() in the current frame
+        void touchPage(CachedPage& page, double priority)
+        {
+            if (page.lastUsedFrame != m_frame)
+                page.priority = priority;
+            else
+                page.priority = std::max(page.priority, priority);
+            page.lastUsedFrame = m_frame;
+        }
+
+        void addPage(PosType pageIdx, std::unique_ptr<char[]> data, double priority);
+
+        /// Evict pages until the cache fits within m_maxBytes
+        void evict();
+
         PosType pageIndex(PosType address) const
         {
             return address/m_pageSize;
         }
 
-        std::istream& m_input;
+        /// Read `numPages` consecutive pages from the input with a single
+        /// read, zero filling any part past the end of the file or which
+        /// couldn't be read.  For memory mapped files, bring the pages into
+        /// memory and return null pages.
+        std::vector<std::unique_ptr<char[]>> readPages(PosType firstPage,
+                                                       PosType numPages);
+
+        /// Move page from m_pendingPages to m_fetchingPages, returning its
+        /// priority.  m_pendingMutex must be held.
+        double takePendingPage(PosType pageIdx);
+
+        /// Take the highest priority pending page, along with adjacent
+        /// pending pages up to m_maxReadBytes, as a run of (page index,
+        /// priority) in file order.  m_pendingMutex must be held.
+        void takePendingRun(std::vector<std::pair<PosType, double>>& run);
+
+        void fetchThreadLoop();
+
+        std::istream* m_input;
+        std::mutex m_inputMutex;
+        /// File descriptor (or handle on windows) when reading by file name
+        intptr_t m_file;
+        /// Memory mapped file data, and mapping handle on windows
+        const char* m_mapped;
+        intptr_t m_mapping;
         PosType m_pageSize;
         PosType m_fileSize;
-        std::unordered_map<PosType, double> m_pendingPages;
-        std::unordered_map<PosType, std::unique_ptr<char[]>> m_pages;
+        std::unordered_map<PosType, CachedPage> m_pages;
+        PosType m_maxBytes;
+        PosType m_maxReadBytes;
+        uint64_t m_frame;
+        Stats m_stats;
+
+        /// Pages marked for fetching, with priority, and pages being fetched
+        /// or fetched but not yet collected
+        std::mutex m_pendingMutex;
+        std::condition_variable m_fetchWakeup;
+        std::unordered_map<PosType, PendingRequest> m_pendingPages;
+        std::unordered_set<PosType> m_fetchingPages;
+        bool m_stopFetch;
+        std::vector<std::thread> m_fetchThreads;
+        std::function<void()> m_pageFetched;
+        std::atomic<FetchedPage*> m_fetchedPages;
 };
 
 
@@ -202,6 +401,32 @@ class PageCacheReader
             return read((char*)array.get(), size*sizeof(T));
         }
 
+        /// Point `data` at `size` elements from the stream in native endian
+        /// binary form
+        ///
+        /// If the cache can provide the elements in place (see
+        /// StreamPageCache::span()) and they're suitably aligned, `data`
+        /// points at them directly.  Otherwise they're read into `storage`
+        /// as for read(array, size), and `data` points there.
+        template<typename T>
+        bool read(const T*& data, std::unique_ptr<T[]>& storage, size_t size)
+        {
+            if (!m_bad)
+            {
+                const char* p = m_cache.span(m_offset, size*sizeof(T));
+                if (p && reinterpret_cast<uintptr_t>(p) % alignof(T) == 0)
+                {
+                    data = reinterpret_cast<const T*>(p);
+                    storage.reset();
+                    m_offset += size*sizeof(T);
+                    return true;
+                }
+            }
+            bool ok = read(storage, size);
+            data = storage.get();
+            return ok;
+        }
+
     private:
         StreamPageCache& m_cache;
         uint64_t m_initialOffset;
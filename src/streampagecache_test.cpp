@@ -3,8 +3,12 @@
 
 #include <catch.hpp>
 
+#include <QTemporaryDir>
+
+#include <chrono>
 #include <cstring>
 #include <iostream>
+#include <random>
 
 #include "streampagecache.h"
 
@@ -13,25 +17,59 @@
 #pragma GCC diagnostic ignored "-Wparentheses"
 #endif
 
+
+/// Scratch file for page cache tests, holding a copy of its contents
+///
+/// The file is written in a fresh temporary directory which is removed
+/// along with the TestFile.
+class TestFile
+{
+    public:
+        std::string fileName;
+        std::vector<char> data;
+
+        /// Write `size` random bytes, from a fixed seed so failures reproduce
+        explicit TestFile(size_t size)
+            : data(size)
+        {
+            std::mt19937 rng(42);
+            for (size_t i = 0; i < size; ++i)
+                data[i] = (char)(rng() % 256);
+            write();
+        }
+
+        /// Write `size` bytes copied from `buf`
+        TestFile(const char* buf, size_t size)
+            : data(buf, buf + size)
+        {
+            write();
+        }
+
+    private:
+        void write()
+        {
+            REQUIRE(m_dir.isValid());
+            fileName = m_dir.path().toStdString() + "/streampagecache_test.dat";
+            std::ofstream out(fileName, std::ios::binary);
+            out.write(data.data(), data.size());
+        }
+
+        QTemporaryDir m_dir;
+};
+
 TEST_CASE("Test page cache for std::istream")
 {
     const size_t size = 12345;
-    char buf[size];
-    for (size_t i = 0; i < size; ++i)
-        buf[i] = rand() % 256;
-    std::string tmpFileName = "streampagecache_test.dat";
-    {
-        std::ofstream out(tmpFileName, std::ios::binary);
-        out.write(buf, size);
-    }
+    TestFile file(size);
+    const char* buf = file.data.data();
 
-    std::ifstream in(tmpFileName, std::ios::binary);
+    std::ifstream in(file.fileName, std::ios::binary);
     StreamPageCache cache(in, 1001);
 
     char buf2[size] = {0};
 
     CHECK_FALSE(cache.prefetch(900, 200));
-    cache.fetchNow(2);
+    cache.fetchNow(2*1001);
     CHECK(cache.read(buf2, 900, 200));
     //checkEqual(buf + 900, buf2, 200);
     CHECK(std::memcmp(buf + 900, buf2, 200) == 0);
@@ -39,9 +77,278 @@ TEST_CASE("Test page cache for std::istream")
     for (size_t i = 0; i < size-3; ++i)
     {
         if (!cache.prefetch(i, 3))
-            cache.fetchNow(2);
+            cache.fetchNow(2*1001);
         CHECK(cache.read(buf2, i, 3));
         CHECK(std::memcmp(buf + i, buf2, 3) == 0);
     }
 }
 
+
+
+TEST_CASE("Test background page fetching")
+{
+    const size_t size = 12345;
+    TestFile file(size);
+    const char* buf = file.data.data();
+
+    std::ifstream in(file.fileName, std::ios::binary);
+    StreamPageCache streamCache(in, 1001);
+    StreamPageCache fileCache(file.fileName, 1001);
+    StreamPageCache mapCache(file.fileName, 1001, StreamPageCache::Access_MemoryMap);
+    for (StreamPageCache* cache : {&streamCache, &fileCache, &mapCache})
+    {
+        std::atomic<int> numFetched(0);
+        cache->startFetchThreads(3, [&numFetched]() { ++numFetched; });
+        char buf2[size] = {0};
+        // Request all pages, then wait for them to arrive
+        CHECK_FALSE(cache->prefetch(0, size));
+        size_t numCollected = 0;
+        for (int i = 0; i < 1000 && numCollected < 13; ++i)
+        {
+            numCollected += cache->collectFetched();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        CHECK(numCollected == 13);
+        // Adjacent pages may be read together, with one callback per read
+        CHECK(numFetched >= 1);
+        CHECK(numFetched <= 13);
+        CHECK(cache->prefetch(0, size));
+        CHECK(cache->read(buf2, 0, size));
+        CHECK(std::memcmp(buf, buf2, size) == 0);
+        CHECK(cache->fetchNow(size) == 0);
+    }
+}
+
+
+TEST_CASE("Test page cache eviction")
+{
+    const size_t size = 10000;
+    TestFile file(size);
+    const char* buf = file.data.data();
+
+    StreamPageCache cache(file.fileName, 1000);
+    cache.setMaxBytes(3000);
+    char buf2[size] = {0};
+    // Pages 0 and 1 used in an old frame, 2 with low priority and 3 with
+    // high priority in a more recent one.
+    cache.prefetch(0, 2000);
+    cache.fetchNow(10*1000);
+    cache.beginFrame();
+    cache.prefetch(2000, 1000, 1);
+    cache.prefetch(3000, 1000, 2);
+    cache.fetchNow(10*1000);
+    CHECK(cache.cachedBytes() == 3000);
+    CHECK(cache.stats().evictions == 1);
+    cache.beginFrame();
+    CHECK(cache.read(buf2, 3000, 1000));
+    cache.prefetch(4000, 1000);
+    cache.fetchNow(10*1000);
+    // Least recently used page goes first
+    CHECK(cache.stats().evictions == 2);
+    CHECK_FALSE(cache.read(buf2, 0, 2000));
+    CHECK(cache.read(buf2, 2000, 3000));
+    CHECK(std::memcmp(buf + 2000, buf2, 3000) == 0);
+    // Pages used in the current frame are kept, even past the budget
+    cache.beginFrame();
+    CHECK(cache.read(buf2, 2000, 3000));
+    cache.prefetch(0, 1000);
+    cache.fetchNow(10*1000);
+    CHECK(cache.cachedBytes() == 4000);
+    CHECK(cache.stats().evictions == 2);
+    // Lower priority goes first among pages last used in the same frame
+    cache.beginFrame();
+    cache.prefetch(2000, 1000, 1);
+    cache.prefetch(3000, 1000, 3);
+    cache.prefetch(4000, 1000, 2);
+    cache.beginFrame();
+    cache.setMaxBytes(2000);
+    CHECK(cache.stats().evictions == 4);
+    CHECK_FALSE(cache.read(buf2, 0, 1000));
+    CHECK_FALSE(cache.read(buf2, 2000, 1000));
+    CHECK(cache.read(buf2, 3000, 2000));
+    CHECK(cache.stats().fetches == 6);
+}
+
+
+TEST_CASE("Test memory mapped page cache")
+{
+    const size_t size = 12000;
+    float buf[size/sizeof(float)];
+    for (size_t i = 0; i < size/sizeof(float); ++i)
+        buf[i] = float(i);
+    TestFile file((const char*)buf, size);
+
+    StreamPageCache cache(file.fileName, 4096, StreamPageCache::Access_MemoryMap);
+    char buf2[size] = {0};
+    CHECK(cache.span(100, 200) == nullptr);
+    CHECK_FALSE(cache.prefetch(100, 8000));
+    cache.fetchNow(10*4096);
+    CHECK(cache.read(buf2, 100, 8000));
+    CHECK(std::memcmp((const char*)buf + 100, buf2, 8000) == 0);
+    const char* span = cache.span(100, 8000);
+    REQUIRE(span != nullptr);
+    CHECK(std::memcmp((const char*)buf + 100, span, 8000) == 0);
+    // Uncached pages aren't available in place
+    CHECK(cache.span(8000, 1000) == nullptr);
+
+    // Aligned arrays point into the file; others are copied
+    const float* data = nullptr;
+    std::unique_ptr<float[]> storage;
+    PageCacheReader reader(cache, 400);
+    CHECK(reader.read(data, storage, 100));
+    CHECK(!storage);
+    CHECK(data[0] == 100);
+    CHECK(data[99] == 199);
+    PageCacheReader unalignedReader(cache, 402);
+    CHECK(unalignedReader.read(data, storage, 1));
+    CHECK(data == storage.get());
+    PageCacheReader missingReader(cache, 8000);
+    CHECK_FALSE(missingReader.read(data, storage, 500));
+    CHECK(missingReader.bad());
+}
+
+
+TEST_CASE("Test memory mapped page cache eviction")
+{
+    const size_t pageSize = 64*1024;
+    const size_t size = 4*pageSize;
+    TestFile file(size);
+    const char* buf = file.data.data();
+
+    StreamPageCache cache(file.fileName, pageSize, StreamPageCache::Access_MemoryMap);
+    cache.setMaxBytes(2*pageSize);
+    char buf2[pageSize] = {0};
+    cache.prefetch(0, 2*pageSize);
+    cache.fetchNow(size);
+    const char* span = cache.span(0, 2*pageSize);
+    REQUIRE(span != nullptr);
+    // Pages 2 and 3 displace 0 and 1, which were used in an older frame
+    cache.beginFrame();
+    cache.prefetch(2*pageSize, 2*pageSize);
+    cache.fetchNow(size);
+    CHECK(cache.stats().evictions == 2);
+    CHECK(cache.cachedBytes() == 2*pageSize);
+    CHECK(cache.span(0, pageSize) == nullptr);
+    CHECK_FALSE(cache.read(buf2, pageSize, pageSize));
+    CHECK(cache.read(buf2, 3*pageSize, pageSize));
+    CHECK(std::memcmp(buf + 3*pageSize, buf2, pageSize) == 0);
+    // The memory of evicted pages is released, but data in place stays
+    // valid and is read from the file again.
+    CHECK(std::memcmp(buf, span, 2*pageSize) == 0);
+    // Pages kept in use with prefetch() aren't evicted
+    cache.beginFrame();
+    CHECK(cache.prefetch(2*pageSize, pageSize));
+    cache.prefetch(0, pageSize);
+    cache.fetchNow(size);
+    CHECK(cache.stats().evictions == 3);
+    CHECK(cache.span(2*pageSize, pageSize) != nullptr);
+    CHECK(cache.span(3*pageSize, pageSize) == nullptr);
+}
+
+
+TEST_CASE("Test eviction of background fetched pages")
+{
+    const size_t size = 10000;
+    TestFile file(size);
+    const char* buf = file.data.data();
+
+    StreamPageCache cache(file.fileName, 1000);
+    cache.setMaxBytes(3000);
+    cache.startFetchThreads(1);
+    char buf2[3000] = {0};
+    auto collect = [&cache](size_t numPages)
+    {
+        size_t numCollected = 0;
+        for (int i = 0; i < 1000 && numCollected < numPages; ++i)
+        {
+            numCollected += cache.collectFetched();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return numCollected;
+    };
+    // Frames collect fetched pages, then begin, then request the visible
+    // pages and prefetch others speculatively, as in HCloudView::draw().
+    cache.prefetch(0, 3000, 10);
+    REQUIRE(collect(3) == 3);
+    cache.beginFrame();
+    CHECK(cache.prefetch(0, 3000, 10));
+    CHECK_FALSE(cache.prefetch(5000, 3000, 1));
+    // Prefetched pages take the cache over budget, but don't displace the
+    // pages visible in the previous frame.
+    REQUIRE(collect(3) == 3);
+    CHECK(cache.stats().evictions == 0);
+    cache.beginFrame();
+    CHECK(cache.prefetch(0, 3000, 10));
+    CHECK_FALSE(cache.prefetch(9000, 1000, 1));
+    // Stale prefetched pages are evicted once the visible pages have been
+    // used in a newer frame.
+    REQUIRE(collect(1) == 1);
+    CHECK(cache.stats().evictions == 3);
+    CHECK(cache.cachedBytes() == 4000);
+    CHECK(cache.read(buf2, 0, 3000));
+    CHECK(std::memcmp(buf, buf2, 3000) == 0);
+    CHECK_FALSE(cache.read(buf2, 5000, 1000));
+    CHECK(cache.read(buf2, 9000, 1000));
+    CHECK(std::memcmp(buf + 9000, buf2, 1000) == 0);
+}
+
+
+TEST_CASE("Test coalesced page reads")
+{
+    const size_t size = 12345;
+    TestFile file(size);
+    const char* buf = file.data.data();
+
+    std::ifstream in(file.fileName, std::ios::binary);
+    StreamPageCache streamCache(in, 1001);
+    StreamPageCache fileCache(file.fileName, 1001);
+    StreamPageCache mapCache(file.fileName, 1001, StreamPageCache::Access_MemoryMap);
+    for (StreamPageCache* cache : {&streamCache, &fileCache, &mapCache})
+    {
+        // Reads are limited to three pages, so the runs of pages 0-4 and
+        // 7-12 need two reads each.
+        cache->setMaxReadBytes(3*1001);
+        char buf2[size] = {0};
+        CHECK_FALSE(cache->prefetch(0, 5*1001, 1));
+        CHECK_FALSE(cache->prefetch(7*1001, size - 7*1001));
+        // Quota is rounded up to whole pages, highest priority first
+        CHECK(cache->fetchNow(4*1001 + 1) == 5);
+        CHECK(cache->read(buf2, 0, 5*1001));
+        CHECK(std::memcmp(buf, buf2, 5*1001) == 0);
+        CHECK_FALSE(cache->read(buf2, 7*1001, 10));
+        CHECK(cache->fetchNow(size) == 6);
+        // Last page is partial and zero filled
+        CHECK(cache->read(buf2, 7*1001, size - 7*1001));
+        CHECK(std::memcmp(buf + 7*1001, buf2, size - 7*1001) == 0);
+        CHECK_FALSE(cache->read(buf2, 5*1001, 10));
+        CHECK(cache->stats().fetches == 11);
+    }
+}
+
+
+TEST_CASE("Test cancelling page requests")
+{
+    const size_t size = 10000;
+    TestFile file(size);
+    const char* buf = file.data.data();
+
+    StreamPageCache cache(file.fileName, 1000);
+    char buf2[size] = {0};
+    cache.prefetch(0, 1000, 1);
+    cache.prefetch(5000, 1000, 5);
+    CHECK(cache.cancelUnrequested() == 0);
+    // Only pages requested again in the new frame survive, with priority
+    // from the new requests.
+    cache.beginFrame();
+    cache.prefetch(0, 1000, 2);
+    cache.prefetch(8000, 1000, 3);
+    CHECK(cache.cancelUnrequested() == 1);
+    CHECK(cache.stats().cancelled == 1);
+    CHECK(cache.fetchNow(1000) == 1);
+    CHECK(cache.read(buf2, 8000, 1000));
+    CHECK(std::memcmp(buf + 8000, buf2, 1000) == 0);
+    CHECK(cache.fetchNow(size) == 1);
+    CHECK(cache.read(buf2, 0, 1000));
+    CHECK_FALSE(cache.read(buf2, 5000, 1000));
+    CHECK(cache.fetchNow(size) == 0);
+}
@@ -0,0 +1,223 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include "text_io.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline bool isSeparator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == ',' || c == ';';
+}
+
+
+const char* parseDouble(const char* str, const char* end, double& value)
+{
+    // Exact powers of ten representable as doubles
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char* p = str;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+    // Accumulate up to 19 significant digits in an integer mantissa
+    uint64_t mantissa = 0;
+    int numSigDigits = 0;
+    int exponent = 0;
+    bool haveDigits = false;
+    for (; p < end && isDigit(*p); ++p)
+    {
+        haveDigits = true;
+        if (numSigDigits < 19)
+        {
+            mantissa = 10*mantissa + (*p - '0');
+            numSigDigits += (mantissa != 0);
+        }
+        else
+            ++exponent;
+    }
+    if (p < end && *p == '.')
+    {
+        ++p;
+        for (; p < end && isDigit(*p); ++p)
+        {
+            haveDigits = true;
+            if (numSigDigits < 19)
+            {
+                mantissa = 10*mantissa + (*p - '0');
+                numSigDigits += (mantissa != 0);
+                --exponent;
+            }
+        }
+    }
+    if (!haveDigits)
+        return nullptr;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* e = p + 1;
+        bool negativeExp = false;
+        if (e < end && (*e == '-' || *e == '+'))
+        {
+            negativeExp = *e == '-';
+            ++e;
+        }
+        if (e < end && isDigit(*e))
+        {
+            int exp = 0;
+            for (; e < end && isDigit(*e); ++e)
+            {
+                if (exp < 100000)
+                    exp = 10*exp + (*e - '0');
+            }
+            exponent += negativeExp ? -exp : exp;
+            p = e;
+        }
+    }
+    if (p < end && !isSeparator(*p) && *p != '\n')
+        return nullptr;
+    double v = (double)mantissa;
+    if (exponent != 0 && mantissa != 0)
+    {
+        if (mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+            v = exponent < 0 ? v / pow10[-exponent] : v * pow10[exponent];
+        else
+            v = (double)((long double)mantissa * std::pow(10.0L, exponent));
+    }
+    value = negative ? -v : v;
+    return p;
+}
+
+
+int parseTextRow(const char*& p, const char* end, double* values, int maxValues)
+{
+    int count = 0;
+    bool parsing = true;
+    while (p < end && *p != '\n')
+    {
+        if (isSeparator(*p))
+        {
+            ++p;
+            continue;
+        }
+        if (parsing && count < maxValues)
+        {
+            const char* next = parseDouble(p, end, values[count]);
+            if (next)
+            {
+                ++count;
+                p = next;
+                continue;
+            }
+        }
+        // Skip remainder of the line
+        parsing = false;
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        p = eol ? eol : end;
+    }
+    if (p < end)
+        ++p;
+    return count;
+}
+
+
+std::vector<std::string> splitTextRow(const char*& p, const char* end)
+{
+    std::vector<std::string> tokens;
+    while (p < end && *p != '\n')
+    {
+        if (isSeparator(*p))
+        {
+            ++p;
+            continue;
+        }
+        const char* tokEnd = p;
+        while (tokEnd < end && *tokEnd != '\n' && !isSeparator(*tokEnd))
+            ++tokEnd;
+        tokens.push_back(std::string(p, tokEnd));
+        p = tokEnd;
+    }
+    if (p < end)
+        ++p;
+    return tokens;
+}
+
+
+TextTableParser::TextTableParser(const char* data, size_t size, int numColumns,
+                                 size_t chunkSize, int minColumns)
+    : m_data(data),
+    m_size(size),
+    m_numColumns(numColumns),
+    m_minColumns(minColumns < 0 ? numColumns : std::min(minColumns, numColumns)),
+    m_numShortRows(0)
+{
+    // Split at the first line boundary after each multiple of chunkSize
+    chunkSize = std::max<size_t>(chunkSize, 1);
+    m_chunkBegin.push_back(0);
+    for (size_t pos = chunkSize; pos < size; pos += chunkSize)
+    {
+        if (pos <= m_chunkBegin.back())
+            continue;
+        const char* eol = (const char*)memchr(data + pos - 1, '\n', size - pos + 1);
+        if (!eol)
+            break;
+        size_t lineStart = eol + 1 - data;
+        if (lineStart < size)
+            m_chunkBegin.push_back(lineStart);
+    }
+    m_chunkBegin.push_back(size);
+}
+
+
+size_t TextTableParser::countRows(const ChunkDoneFunc& chunkDone)
+{
+    size_t numChunks = m_chunkBegin.size() - 1;
+    std::vector<size_t> chunkRows(numChunks, 0);
+    std::vector<size_t> chunkShortRows(numChunks, 0);
+    parallelFor(0, numChunks, 1, [&](size_t chunkBegin, size_t chunkEnd)
+    {
+        std::vector<double> values(m_numColumns);
+        for (size_t c = chunkBegin; c < chunkEnd; ++c)
+        {
+            const char* p = m_data + m_chunkBegin[c];
+            const char* end = m_data + m_chunkBegin[c+1];
+            size_t rows = 0;
+            size_t shortRows = 0;
+            while (p < end)
+            {
+                int n = parseTextRow(p, end, values.data(), m_numColumns);
+                if (n >= m_minColumns)
+                {
+                    ++rows;
+                    shortRows += (n < m_numColumns);
+                }
+            }
+            chunkRows[c] = rows;
+            chunkShortRows[c] = shortRows;
+            if (chunkDone)
+                chunkDone(m_chunkBegin[c+1] - m_chunkBegin[c]);
+        }
+    });
+    m_chunkFirstRow.resize(numChunks + 1);
+    m_chunkFirstRow[0] = 0;
+    m_numShortRows = 0;
+    for (size_t c = 0; c < numChunks; ++c)
+    {
+        m_chunkFirstRow[c+1] = m_chunkFirstRow[c] + chunkRows[c];
+        m_numShortRows += chunkShortRows[c];
+    }
+    return m_chunkFirstRow.back();
+}
@@ -0,0 +1,113 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#ifndef DISPLAZ_TEXT_IO_INCLUDED
+#define DISPLAZ_TEXT_IO_INCLUDED
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "parallel.h"
+
+
+/// Parse a floating point number from the text in [str,end)
+///
+/// The number must be in C locale format (optional sign, digits with optional
+/// '.', optional exponent) and be followed by the end of the text, whitespace,
+/// ',' or ';'.  Return a pointer to just past the number, or null if there
+/// was no number.
+///
+/// The result is correctly rounded for numbers with at most 15 significant
+/// digits and small exponents, and otherwise accurate to a few ulp.
+const char* parseDouble(const char* str, const char* end, double& value);
+
+
+/// Parse a single line of numbers separated by whitespace, ',' or ';'
+///
+/// At most `maxValues` leading numbers are parsed from the line starting at
+/// `p`; any following text on the line is ignored.  On return, `p` points to
+/// the start of the next line.  Return the number of values parsed.
+int parseTextRow(const char*& p, const char* end, double* values, int maxValues);
+
+
+/// Split the text on the current line at `p` into whitespace separated
+/// tokens, and move `p` to the start of the next line.
+std::vector<std::string> splitTextRow(const char*& p, const char* end);
+
+
+/// Parallel parser for tables of numbers in text format
+///
+/// The text is split into chunks at line boundaries so that rows can be
+/// parsed by several threads at once.  A row is any line with at least
+/// `minColumns` leading numbers (by default, `numColumns`); other lines (such
+/// as comments) are skipped.  Columns missing from short rows are set to zero.
+///
+/// Typical use is to call countRows() to size the output arrays, then
+/// parseRows() to fill them.
+class TextTableParser
+{
+    public:
+        TextTableParser(const char* data, size_t size, int numColumns,
+                        size_t chunkSize = 4*1024*1024, int minColumns = -1);
+
+        /// Function called with the size in bytes of each chunk of text once
+        /// it's processed, from the thread which processed it
+        typedef std::function<void(size_t)> ChunkDoneFunc;
+
+        /// Count number of rows in the text, in parallel
+        size_t countRows(const ChunkDoneFunc& chunkDone = ChunkDoneFunc());
+
+        /// Parse all rows in parallel, calling `rowFunc(rowIndex, values)`
+        /// for each, where `values` points to the first `numColumns` numbers
+        /// of the row.  countRows() must be called first.
+        template<typename RowFuncT>
+        void parseRows(RowFuncT rowFunc,
+                       const ChunkDoneFunc& chunkDone = ChunkDoneFunc()) const;
+
+        int numColumns() const { return m_numColumns; }
+
+        /// Number of rows with fewer than `numColumns` numbers, as found by
+        /// countRows()
+        size_t numShortRows() const { return m_numShortRows; }
+
+    private:
+        const char* m_data;
+        size_t m_size;
+        int m_numColumns;
+        int m_minColumns;
+        size_t m_numShortRows;
+        std::vector<size_t> m_chunkBegin;   ///< Chunk byte offsets, plus end
+        std::vector<size_t> m_chunkFirstRow;
+};
+
+
+template<typename RowFuncT>
+void TextTableParser::parseRows(RowFuncT rowFunc, const ChunkDoneFunc& chunkDone) const
+{
+    size_t numChunks = m_chunkBegin.size() - 1;
+    parallelFor(0, numChunks, 1, [&](size_t chunkBegin, size_t chunkEnd)
+    {
+        std::vector<double> values(m_numColumns);
+        for (size_t c = chunkBegin; c < chunkEnd; ++c)
+        {
+            const char* p = m_data + m_chunkBegin[c];
+            const char* end = m_data + m_chunkBegin[c+1];
+            size_t row = m_chunkFirstRow[c];
+            while (p < end)
+            {
+                int n = parseTextRow(p, end, values.data(), m_numColumns);
+                if (n < m_minColumns)
+                    continue;
+                std::fill(values.begin() + n, values.end(), 0.0);
+                rowFunc(row++, values.data());
+            }
+            if (chunkDone)
+                chunkDone(m_chunkBegin[c+1] - m_chunkBegin[c]);
+        }
+    });
+}
+
+
+#endif // DISPLAZ_TEXT_IO_INCLUDED
@@ -0,0 +1,141 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include "text_io.h"
+#include "util.h"
+
+// gcc 4.6 and 4.7 warns/suggests parentheses around == comparison
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wparentheses"
+#endif
+
+
+static bool parsesAs(const char* str, double expected)
+{
+    double value = 0;
+    const char* end = str + strlen(str);
+    return parseDouble(str, end, value) == end && value == expected;
+}
+
+
+TEST_CASE("parseDouble")
+{
+    CHECK(parsesAs("0", 0));
+    CHECK(parsesAs("42", 42));
+    CHECK(parsesAs("-1.5", -1.5));
+    CHECK(parsesAs("+.25", 0.25));
+    CHECK(parsesAs("3.", 3));
+    CHECK(parsesAs("1e3", 1000));
+    CHECK(parsesAs("1.25E-2", 0.0125));
+    CHECK(parsesAs("000123.4500", 123.45));
+    CHECK(parsesAs("6378137.123", 6378137.123));
+    CHECK(parsesAs("0.1", 0.1));
+    // Agrees with strtod for a range of typical coordinates
+    for (int i = 0; i < 1000; ++i)
+    {
+        std::string s = tfm::format("%.*f", i % 10, (rand() - RAND_MAX/2) * 0.001);
+        CHECK(parsesAs(s.c_str(), strtod(s.c_str(), 0)));
+    }
+    // Long mantissas and large exponents are close
+    double value = 0;
+    const char* longNum = "3.14159265358979323846264338327950288";
+    CHECK(parseDouble(longNum, longNum + strlen(longNum), value));
+    CHECK(fabs(value - 3.14159265358979323846) < 1e-15);
+    const char* bigNum = "1.5e300";
+    CHECK(parseDouble(bigNum, bigNum + strlen(bigNum), value));
+    CHECK(fabs(value/1.5e300 - 1) < 1e-15);
+    // Invalid numbers
+    for (const char* bad : {"", "-", ".", "e5", "abc", "1.5x", "1e"})
+        CHECK(!parseDouble(bad, bad + strlen(bad), value));
+}
+
+
+TEST_CASE("parseTextRow")
+{
+    const char* text = "1 2.5\t-3,4;5\r\n"
+                       "# comment 1 2 3\n"
+                       "6 7 8 junk 9\n"
+                       "10 11";
+    const char* end = text + strlen(text);
+    const char* p = text;
+    double v[5] = {0};
+    CHECK(parseTextRow(p, end, v, 5) == 5);
+    CHECK(v[0] == 1);
+    CHECK(v[2] == -3);
+    CHECK(v[4] == 5);
+    CHECK(parseTextRow(p, end, v, 5) == 0);
+    CHECK(parseTextRow(p, end, v, 5) == 3);
+    CHECK(v[2] == 8);
+    CHECK(parseTextRow(p, end, v, 1) == 1);
+    CHECK(v[0] == 10);
+    CHECK(p == end);
+}
+
+
+TEST_CASE("TextTableParser reads all rows")
+{
+    std::string text = "x y z i\n";
+    const size_t N = 10000;
+    for (size_t i = 0; i < N; ++i)
+    {
+        if (i % 1000 == 0)
+            text += "# comment\n\n";
+        text += tfm::format("%d %d.5 -%d %d\n", i, i, i, i % 7);
+    }
+    for (size_t chunkSize : {1, 100, 4096, 1000000})
+    {
+        TextTableParser parser(text.data(), text.size(), 4, chunkSize);
+        // Both passes report progress over all the text
+        std::atomic<size_t> bytesDone(0);
+        auto chunkDone = [&](size_t chunkBytes) { bytesDone += chunkBytes; };
+        REQUIRE(parser.countRows(chunkDone) == N);
+        CHECK(bytesDone == text.size());
+        std::vector<int> hits(N, 0);
+        bool valuesOk = true;
+        parser.parseRows([&](size_t row, const double* v)
+        {
+            hits[row] += 1;
+            valuesOk &= v[0] == row && v[1] == row + 0.5 &&
+                        v[2] == -(double)row && v[3] == row % 7;
+        }, chunkDone);
+        CHECK(valuesOk);
+        CHECK(bytesDone == 2*text.size());
+        CHECK(std::count(hits.begin(), hits.end(), 1) == (int)N);
+    }
+}
+
+
+TEST_CASE("TextTableParser rows of different lengths")
+{
+    std::string text = "x y z i\n"
+                       "1 2 3 4\n"
+                       "5 6 7\n"
+                       "8 9\n"
+                       "10 11 12 13 14\n"
+                       "15 16 17\n";
+    // By default only full rows are accepted
+    TextTableParser fullRows(text.data(), text.size(), 4);
+    CHECK(fullRows.countRows() == 2);
+    CHECK(fullRows.numShortRows() == 0);
+    for (size_t chunkSize : {1, 8, 4096})
+    {
+        TextTableParser parser(text.data(), text.size(), 4, chunkSize, 3);
+        REQUIRE(parser.countRows() == 4);
+        CHECK(parser.numShortRows() == 2);
+        std::vector<std::vector<double>> rows(4);
+        parser.parseRows([&](size_t row, const double* v)
+        {
+            rows[row].assign(v, v + 4);
+        });
+        CHECK(rows[0] == std::vector<double>({1, 2, 3, 4}));
+        CHECK(rows[1] == std::vector<double>({5, 6, 7, 0}));
+        CHECK(rows[2] == std::vector<double>({10, 11, 12, 13}));
+        CHECK(rows[3] == std::vector<double>({15, 16, 17, 0}));
+    }
+}
@@ -4,7 +4,10 @@
 #ifndef UTIL_H_INCLUDED
 #define UTIL_H_INCLUDED
 
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <iostream>
 #include <memory>
@@ -138,7 +141,8 @@ V3d polygonNormal(const std::vector<float>& verts,
 /// For efficiency, the number of classes should be small compared to the
 /// length of the range.  If not, it's much better just to use std::sort, since
 /// multi_partition is quite similar to a bubble sort in the limit of a large
-/// number of classes.
+/// number of classes.  See also counting_partition(), which is faster when
+/// scratch space is available.
 template<typename IterT, typename IterTIter, typename ClassFuncT>
 void multi_partition(IterT first, IterT last, ClassFuncT classFunc,
                      IterTIter classEndIters, int numClasses)
@@ -159,6 +163,91 @@ void multi_partition(IterT first, IterT last, ClassFuncT classFunc,
 }
 
 
+/// Partition of elements into multiple classes using a counting sort.
+///
+/// This has the same result as multi_partition() in terms of class ranges,
+/// but does a constant amount of work per element regardless of the number of
+/// classes, and preserves the relative order of elements within each class.
+///
+/// `classes[i]` is the precomputed class of `first[i]`, in [0,numClasses).
+/// `scratch` must point to space for `last - first` elements; on return it
+/// contains garbage.  On return, classEnds[c] points to the end of the range
+/// of [first,last) occupied by elements of class c.
+template<typename T>
+void counting_partition(T* first, T* last, const uint8_t* classes,
+                        T* scratch, T** classEnds, int numClasses)
+{
+    assert(numClasses <= 256);
+    size_t n = last - first;
+    size_t offsets[256] = {0};
+    for (size_t i = 0; i < n; ++i)
+        ++offsets[classes[i]];
+    size_t offset = 0;
+    for (int c = 0; c < numClasses; ++c)
+    {
+        size_t count = offsets[c];
+        offsets[c] = offset;
+        offset += count;
+        classEnds[c] = first + offset;
+    }
+    for (size_t i = 0; i < n; ++i)
+        scratch[offsets[classes[i]]++] = first[i];
+    std::copy(scratch, scratch + n, first);
+}
+
+
+/// Deterministic decimation of a sequence of points
+///
+/// Used by the file loaders to keep at most `maxPointCount` of `totalPoints`
+/// input points.  The input is split into consecutive blocks of factor()
+/// points and a single point is kept from each block, chosen pseudo randomly
+/// within the block to avoid repeated patterns.  The choice depends only on
+/// the block index, so the kept points can be computed in any order: input
+/// point `i` is kept as output point `i/factor()` if keep(i) is true.
+class PointDecimator
+{
+    public:
+        PointDecimator(uint64_t totalPoints, uint64_t maxPointCount)
+            : m_totalPoints(totalPoints),
+            m_factor(totalPoints == 0 || maxPointCount == 0 ? 1 :
+                     1 + (totalPoints - 1) / maxPointCount)
+        { }
+
+        /// Number of input points per output point
+        uint64_t factor() const { return m_factor; }
+
+        uint64_t totalPoints() const { return m_totalPoints; }
+
+        /// Number of points kept
+        uint64_t outputCount() const { return (m_totalPoints + m_factor - 1) / m_factor; }
+
+        /// Index of the input point kept as output point `outputIndex`
+        uint64_t inputIndex(uint64_t outputIndex) const
+        {
+            uint64_t begin = outputIndex*m_factor;
+            if (m_factor == 1)
+                return begin;
+            uint64_t blockLen = std::min(m_factor, m_totalPoints - begin);
+            // splitmix64 finalizer
+            uint64_t h = outputIndex + 0x9E3779B97F4A7C15ULL;
+            h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+            h ^= h >> 31;
+            return begin + h % blockLen;
+        }
+
+        /// Return true if input point `index` is kept
+        bool keep(uint64_t index) const
+        {
+            return m_factor == 1 || inputIndex(index / m_factor) == index;
+        }
+
+    private:
+        uint64_t m_totalPoints;
+        uint64_t m_factor;
+};
+
+
 /// Return true if box b1 contains box b2
 template<typename T>
 bool contains(const Imath::Box<T> b1, const Imath::Box<T> b2)
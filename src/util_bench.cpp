@@ -0,0 +1,81 @@
+// Copyright 2015, Christopher J. Foster and the other displaz contributors.
+// Use of this code is governed by the BSD-style license found in LICENSE.txt
+
+// Micro benchmarks for performance sensitive utilities in util.h
+//
+// Usage: util_bench [num_points]
+
+#include <chrono>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+
+#include "util.h"
+
+
+/// Run `func` a few times and return the fastest time in milliseconds
+template<typename FuncT>
+static double timeMillisecs(FuncT func, int repeats = 3)
+{
+    double best = 1e100;
+    for (int i = 0; i < repeats; ++i)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        func();
+        auto t1 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+    }
+    return best;
+}
+
+
+/// Octant classification of points about the origin
+struct OctantClass
+{
+    const V3f* P;
+    int operator()(size_t i) const
+    {
+        return 4*(P[i].z >= 0) + 2*(P[i].y >= 0) + (P[i].x >= 0);
+    }
+};
+
+
+int main(int argc, char* argv[])
+{
+    size_t N = argc > 1 ? (size_t)atoll(argv[1]) : 10*1000*1000;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> u(-1, 1);
+    std::vector<V3f> P(N);
+    for (size_t i = 0; i < N; ++i)
+        P[i] = V3f(u(rng), u(rng), u(rng));
+    std::vector<size_t> inds(N), scratch(N);
+    std::vector<uint8_t> classes(N);
+    size_t* ends[8];
+    OctantClass classFunc = {P.data()};
+
+    // Reset to a fixed random permutation before each run, since a
+    // partitioned input is much friendlier to the cache.
+    std::vector<size_t> initInds(N);
+    std::iota(initInds.begin(), initInds.end(), 0);
+    std::shuffle(initInds.begin(), initInds.end(), rng);
+
+    double tMulti = timeMillisecs([&]()
+    {
+        inds = initInds;
+        multi_partition(inds.data(), inds.data() + N, classFunc, ends, 8);
+    });
+    double tCounting = timeMillisecs([&]()
+    {
+        inds = initInds;
+        for (size_t i = 0; i < N; ++i)
+            classes[i] = (uint8_t)classFunc(inds[i]);
+        counting_partition(inds.data(), inds.data() + N, classes.data(),
+                           scratch.data(), ends, 8);
+    });
+    double tCopy = timeMillisecs([&]() { inds = initInds; });
+
+    tfm::printf("Octant partition of %d points (times include %.1f ms reset copy)\n", N, tCopy);
+    tfm::printf("  multi_partition     %8.1f ms\n", tMulti);
+    tfm::printf("  counting_partition  %8.1f ms  (%.1fx)\n", tCounting, tMulti/tCounting);
+    return 0;
+}
@@ -82,6 +82,81 @@ TEST_CASE("Simple test for multi_partition")
 }
 
 
+TEST_CASE("Simple test for counting_partition")
+{
+    int v[] = { 1, 1, 1, 0, 1, 2, 0, 0, 3, 3, 3 };
+    const int N = sizeof(v)/sizeof(v[0]);
+    uint8_t classes[N];
+    for (int i = 0; i < N; ++i)
+        classes[i] = (uint8_t)v[i];
+    int scratch[N];
+    int* endIters[] = {0,0,0,0};
+    int M = 4;
+
+    counting_partition(v, v + N, classes, scratch, endIters, M);
+
+    int vExpect[] = { 0, 0, 0, 1, 1, 1, 1, 2, 3, 3, 3 };
+    for (int i = 0; i < N; ++i)
+        CHECK(v[i] == vExpect[i]);
+
+    int classEndInds[] = { 3, 7, 8, 11 };
+    for (int i = 0; i < M; ++i)
+        CHECK(classEndInds[i] == endIters[i] - &v[0]);
+}
+
+
+TEST_CASE("counting_partition agrees with multi_partition")
+{
+    const int N = 1000;
+    const int M = 8;
+    std::vector<int> v1(N);
+    std::vector<uint8_t> classes(N);
+    for (int i = 0; i < N; ++i)
+        v1[i] = rand() % M;
+    std::vector<int> v2 = v1, scratch(N);
+    for (int i = 0; i < N; ++i)
+        classes[i] = (uint8_t)v2[i];
+    int* ends1[M];
+    int* ends2[M];
+    multi_partition(v1.data(), v1.data() + N, &identity, ends1, M);
+    counting_partition(v2.data(), v2.data() + N, classes.data(), scratch.data(), ends2, M);
+    CHECK(v1 == v2);
+    for (int i = 0; i < M; ++i)
+        CHECK(ends1[i] - v1.data() == ends2[i] - v2.data());
+}
+
+
+TEST_CASE("PointDecimator")
+{
+    // No decimation required
+    PointDecimator all(100, 1000);
+    CHECK(all.factor() == 1);
+    CHECK(all.outputCount() == 100);
+    CHECK(all.inputIndex(42) == 42);
+    CHECK(all.keep(99));
+    // One point kept per block, consistent with keep()
+    for (uint64_t total : {1000, 1003, 1009})
+    {
+        PointDecimator dec(total, 100);
+        CHECK(dec.factor() == (total == 1000 ? 10 : 11));
+        CHECK(dec.outputCount() <= 100);
+        uint64_t numKept = 0;
+        bool consistent = true;
+        for (uint64_t i = 0; i < total; ++i)
+        {
+            if (dec.keep(i))
+            {
+                consistent &= dec.inputIndex(i/dec.factor()) == i;
+                ++numKept;
+            }
+        }
+        CHECK(consistent);
+        CHECK(numKept == dec.outputCount());
+        CHECK(dec.inputIndex(dec.outputCount() - 1) < total);
+    }
+}
+
+
 TEST_CASE("Bounding cylinder computation")
 {
     Box3d box(V3d(1,-1,-1), V3d(2,1,1));